@@ -160,6 +160,17 @@ int64_t icount_to_ns(int64_t icount)
     return icount << qatomic_read(&timers_state.icount_time_shift);
 }
 
+void icount_set_ns(int64_t ns)
+{
+    seqlock_write_lock(&timers_state.vm_clock_seqlock,
+                       &timers_state.vm_clock_lock);
+    qatomic_set_i64(&timers_state.qemu_icount_bias,
+                    ns - icount_to_ns(timers_state.qemu_icount));
+    seqlock_write_unlock(&timers_state.vm_clock_seqlock,
+                         &timers_state.vm_clock_lock);
+    qemu_clock_notify(QEMU_CLOCK_VIRTUAL);
+}
+
 /*
  * Correlation between real and virtual time is always going to be
  * fairly approximate, so ignore small variation.
@@ -992,3 +992,17 @@ SRST
   ``info cryptodev``
     Show the crypto devices.
 ERST
+
+    {
+        .name       = "ym7101",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show Sega Genesis VDP state",
+        .cmd_info_hrt = qmp_x_query_ym7101,
+    },
+
+SRST
+  ``info ym7101``
+    Show the registers, table addresses, beam position and DMA state of
+    the Sega Genesis video display processor.
+ERST
@@ -0,0 +1,204 @@
+/*
+ * QEMU Sega Genesis headless benchmark
+ *
+ * Runs the machine for a fixed number of video frames, then reports host
+ * time per frame, MMIO accesses per frame and translation block
+ * statistics, and shuts down.
+ *
+ * With -icount and an input script (see genesis-ctrls.c) the guest sees
+ * the same inputs at the same frames on every run, so the per-frame
+ * framebuffer hashes can be compared across builds to catch rendering or
+ * timing regressions.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "qemu/error-report.h"
+#include "qemu/qemu-print.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
+#include "qapi/type-helpers.h"
+#include "qom/object.h"
+#include "hw/qdev-core.h"
+#include "target/m68k/cpu.h"
+#include "sysemu/cpu-timers.h"
+#include "sysemu/runstate.h"
+#include "ui/console.h"
+#include "hw/m68k/genesis.h"
+
+typedef struct
+{
+    Notifier frame_notifier;
+    QemuConsole *con;
+
+    uint32_t frames;
+    uint32_t frame;
+    bool done;
+
+    FILE *hash_out;
+    uint64_t last_hash;
+
+    int64_t start_ns;
+    uint64_t start_mmio;
+    uint64_t start_cycles;
+} GenesisBench;
+
+static GenesisBench bench;
+
+/* 64-bit FNV-1a over the displayed pixels */
+static uint64_t hash_surface(void)
+{
+    DisplaySurface *surface = qemu_console_surface(bench.con);
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    int x, y;
+
+    if (!surface) {
+        return 0;
+    }
+
+    for (y = 0; y < surface_height(surface); y++) {
+        const uint32_t *row = (const uint32_t *)
+            ((uint8_t *)surface_data(surface) + y * surface_stride(surface));
+
+        for (x = 0; x < surface_width(surface); x++) {
+            hash = (hash ^ row[x]) * 0x100000001b3ULL;
+        }
+    }
+
+    return hash;
+}
+
+/*
+ * Every Genesis device with I/O registers counts the accesses to them:
+ * the VDP, the controllers, the Z80 window, the coprocessor registers and
+ * the cartridge mapper.  ROM, RAM and the cartridge SRAM are plain memory
+ * and never trap, so they are not counted.
+ */
+static int sum_mmio_accesses(Object *obj, void *opaque)
+{
+    uint64_t *total = opaque;
+
+    if (object_property_find(obj, "mmio-accesses")) {
+        *total += object_property_get_uint(obj, "mmio-accesses", NULL);
+    }
+
+    return 0;
+}
+
+static uint64_t mmio_accesses(void)
+{
+    uint64_t total = 0;
+
+    object_child_foreach_recursive(object_get_root(), sum_mmio_accesses,
+                                   &total);
+    return total;
+}
+
+/* The 68000 is the first CPU */
+static uint64_t m68k_cycles(void)
+{
+    return M68K_CPU(first_cpu)->env.cycles;
+}
+
+static void report(void)
+{
+    int64_t elapsed = get_clock() - bench.start_ns;
+    uint64_t mmio = mmio_accesses() - bench.start_mmio;
+    uint64_t cycles = m68k_cycles() - bench.start_cycles;
+    g_autoptr(HumanReadableText) jit = NULL;
+
+    qemu_printf("genesis-bench: %" PRIu32 " frames in %.3f s\n",
+                bench.frames, elapsed / 1e9);
+    qemu_printf("  fps            %.2f\n",
+                bench.frames * 1e9 / MAX(elapsed, 1));
+    qemu_printf("  ns/frame       %" PRId64 "\n", elapsed / bench.frames);
+    qemu_printf("  mmio/frame     %.1f\n", (double)mmio / bench.frames);
+    qemu_printf("  68k cyc/frame  %.1f\n", (double)cycles / bench.frames);
+    qemu_printf("  final hash     %016" PRIx64 "\n", bench.last_hash);
+
+    jit = qmp_x_query_jit(NULL);
+    if (jit) {
+        qemu_printf("%s", jit->human_readable_text);
+    }
+}
+
+static void genesis_bench_frame(Notifier *notifier, void *data)
+{
+    if (bench.done) {
+        return;
+    }
+
+    /* Vertical blank of frame N: the picture for it is complete */
+    if (bench.frame > 0) {
+        bench.last_hash = hash_surface();
+        if (bench.hash_out) {
+            fprintf(bench.hash_out, "%" PRIu32 " %016" PRIx64 "\n",
+                    bench.frame, bench.last_hash);
+        }
+    }
+
+    if (bench.frame == bench.frames) {
+        bench.done = true;
+        report();
+        if (bench.hash_out) {
+            fclose(bench.hash_out);
+            bench.hash_out = NULL;
+        }
+        qemu_system_shutdown_request(SHUTDOWN_CAUSE_GUEST_SHUTDOWN);
+        return;
+    }
+
+    bench.frame++;
+}
+
+static void genesis_bench_vm_state(void *opaque, bool running, RunState state)
+{
+    if (running && !bench.start_ns) {
+        bench.start_ns = get_clock();
+        bench.start_mmio = mmio_accesses();
+        bench.start_cycles = m68k_cycles();
+    }
+}
+
+void genesis_bench_init(DeviceState *vdp, uint32_t frames,
+                        const char *hash_file, Error **errp)
+{
+    bench.frames = frames;
+    bench.con = qemu_console_lookup_by_device(vdp, 0);
+
+    if (hash_file) {
+        bench.hash_out = fopen(hash_file, "w");
+        if (!bench.hash_out) {
+            error_setg_errno(errp, errno, "bench-hash: cannot open '%s'",
+                             hash_file);
+            return;
+        }
+    }
+
+    if (!icount_enabled()) {
+        warn_report("bench-frames without -icount is not frame exact; "
+                    "use -icount shift=7,sleep=off for repeatable runs");
+    }
+
+    bench.frame_notifier.notify = genesis_bench_frame;
+    ym7101_add_frame_notifier(vdp, &bench.frame_notifier);
+    qemu_add_vm_change_state_handler(genesis_bench_vm_state, NULL);
+}
@@ -1,6 +1,22 @@
 /*
  * QEMU Sega Genesis Controllers Emulator
  *
+ * Two pads, 3 or 6 button, read through the TH multiplexing protocol.
+ * Pad 1 follows the host keyboard, unless an input script is given: then
+ * both pads replay the script frame by frame, with no host input at all,
+ * so that runs are deterministic.
+ *
+ * Input script, one entry per line, sorted by frame:
+ *
+ *     # frame  port  buttons
+ *     120      0     S
+ *     125      0     -
+ *     300      0     RB
+ *
+ * Buttons are U D L R A B C S(tart) X Y Z M(ode), '-' for none.  An entry
+ * takes effect at the vertical blank that starts that frame and holds
+ * until the next one for the same port.
+ *
  * Permission is hereby granted, free of charge, to any person obtaining a copy
  * of this software and associated documentation files (the "Software"), to deal
  * in the Software without restriction, including without limitation the rights
@@ -21,9 +37,14 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/cutils.h"
 #include "qemu/log.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
 #include "hw/sysbus.h"
+#include "hw/qdev-properties.h"
 #include "ui/console.h"
+#include "ui/input.h"
 #include "migration/vmstate.h"
 #include "qom/object.h"
 
@@ -46,6 +67,11 @@ OBJECT_DECLARE_SIMPLE_TYPE(GenesisCtrlsState, GENESIS_CTRLS)
 #define REG_S_CTRL2 0x19
 #define REG_S_CTRL3 0x1F
 
+#define PORT_TH 0x40
+
+// A 6 button pad drops back to the first step if TH is left alone this long
+#define SIX_BUTTON_TIMEOUT_NS 1500000
+
 typedef struct
 {
     uint16_t buttons;
@@ -54,8 +80,20 @@ typedef struct
     uint8_t next_read;
 
     uint8_t s_ctrl;
+
+    // Value written to the data register, driven on the output pins
+    uint8_t data;
+    bool six_button;
+    int64_t th_time;
 } GenesisControllerPort;
 
+typedef struct
+{
+    uint32_t frame;
+    uint8_t port;
+    uint16_t buttons;
+} GenesisCtrlsInput;
+
 struct GenesisCtrlsState
 {
     SysBusDevice sbd;
@@ -63,25 +101,114 @@ struct GenesisCtrlsState
 
     GenesisControllerPort port[2];
     GenesisControllerPort expansion;
+
+    uint64_t mmio_accesses;
+
+    bool six_button;
+    QemuInputHandlerState *input_handler;
+    uint16_t keys;
+    NotifierList input_notifiers;
+
+    // Scripted input, advanced from the VDP's frame notifier
+    DeviceState *vdp;
+    char *script;
+    GenesisCtrlsInput *input;
+    size_t input_len;
+    uint32_t input_next;
+    uint32_t frame;
+    Notifier frame_notifier;
 } ;
 
+static uint8_t port_th(GenesisControllerPort *port)
+{
+    // TH is pulled up when it isn't an output
+    return (port->ctrl & PORT_TH) ? (port->data & PORT_TH) : PORT_TH;
+}
+
+// Work out the pins the pad drives for the current TH step
+static void update_port(GenesisControllerPort *port)
+{
+    uint16_t b = port->buttons;
+    uint8_t th = port_th(port);
+    uint8_t step = port->six_button ? port->th_count : (th ? 0 : 1);
+
+    switch (step)
+    {
+    case 5:
+        // ID: all directions low
+        port->next_read = (b >> 2) & 0x30;
+        break;
+    case 6:
+        // C B Mode X Y Z
+        port->next_read = (b & 0x30) | ((b >> 8) & 0x0f);
+        break;
+    case 7:
+        port->next_read = ((b >> 2) & 0x30) | 0x0f;
+        break;
+    default:
+        if (th)
+        {
+            // C B Right Left Down Up
+            port->next_read = b & 0x3f;
+        }
+        else
+        {
+            // Start A 0 0 Down Up
+            port->next_read = (b & 0x03) | ((b >> 2) & 0x30);
+        }
+        break;
+    }
+
+    port->next_read |= th;
+}
+
+static void set_th(GenesisControllerPort *port, uint8_t old_th)
+{
+    int64_t now;
+
+    if (port_th(port) == old_th)
+    {
+        return;
+    }
+
+    now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    if (now - port->th_time > SIX_BUTTON_TIMEOUT_NS)
+    {
+        // Start over: step 0 is TH high, step 1 TH low
+        port->th_count = old_th ? 0 : 7;
+    }
+    port->th_count = (port->th_count + 1) & 7;
+    port->th_time = now;
+    update_port(port);
+}
+
 static uint8_t get_port_data(GenesisControllerPort *port)
 {
-    // TODO: Implement this, for now just return 0
-    DPRINTF("WARN: get_port_data not implemented.\n");
-    return 0;
+    if (port->th_count > 1 &&
+        qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - port->th_time >
+        SIX_BUTTON_TIMEOUT_NS)
+    {
+        port->th_count = port_th(port) ? 0 : 1;
+        update_port(port);
+    }
+
+    return (port->data & (port->ctrl | 0x80)) | (port->next_read & ~port->ctrl & 0x7f);
 }
 
 static void set_port_data(GenesisControllerPort *port, uint64_t value)
 {
-    // TODO: Implement this, do nothing for now
-    DPRINTF("WARN: set_port_data not implemented.\n");
+    uint8_t old_th = port_th(port);
+
+    port->data = value;
+    set_th(port, old_th);
 }
 
 static void set_port_ctrl(GenesisControllerPort *port, uint8_t value)
 {
-    // TODO: Implement this, do nothing for now
-    DPRINTF("WARN: set_port_ctrl not implemented.\n");
+    uint8_t old_th = port_th(port);
+
+    port->ctrl = value;
+    set_th(port, old_th);
 }
 
 static uint8_t ctrls_read_u8(void *opaque, hwaddr addr)
@@ -133,6 +260,8 @@ static MemTxResult ctrls_read(void *opaque, hwaddr addr, uint64_t *data,
 {
     uint8_t r = ctrls_read_u8(opaque, addr);
 
+    GENESIS_CTRLS(opaque)->mmio_accesses++;
+
     if (size == 1)
     {
         *data = r;
@@ -157,6 +286,8 @@ static MemTxResult ctrls_write(void *opaque, hwaddr addr, uint64_t value,
     GenesisCtrlsState *self = ((GenesisCtrlsState *)opaque);
     DPRINTF("genesis_controller: write from register %llx the value %llx\n", addr, value);
 
+    self->mmio_accesses++;
+
     switch (addr)
     {
     case REG_DATA1:
@@ -216,6 +347,197 @@ static void genesis_ctrls_reset(DeviceState *dev)
     s->port[0].buttons = 0xffff;
     s->port[1].buttons = 0xffff;
     s->expansion.buttons = 0xffff;
+
+    s->port[0].six_button = s->six_button;
+    s->port[1].six_button = s->six_button;
+
+    update_port(&s->port[0]);
+    update_port(&s->port[1]);
+    update_port(&s->expansion);
+}
+
+void genesis_ctrls_set_buttons(DeviceState *dev, int port, uint16_t pressed)
+{
+    GenesisCtrlsState *s = GENESIS_CTRLS(dev);
+
+    g_assert(port >= 0 && port < ARRAY_SIZE(s->port));
+
+    // Buttons are active low
+    s->port[port].buttons = ~pressed;
+    update_port(&s->port[port]);
+}
+
+// Host keyboard to pad 1
+static const uint16_t genesis_ctrls_keymap[Q_KEY_CODE__MAX] = {
+    [Q_KEY_CODE_UP] = GENESIS_BUTTON_UP,
+    [Q_KEY_CODE_DOWN] = GENESIS_BUTTON_DOWN,
+    [Q_KEY_CODE_LEFT] = GENESIS_BUTTON_LEFT,
+    [Q_KEY_CODE_RIGHT] = GENESIS_BUTTON_RIGHT,
+    [Q_KEY_CODE_A] = GENESIS_BUTTON_A,
+    [Q_KEY_CODE_S] = GENESIS_BUTTON_B,
+    [Q_KEY_CODE_D] = GENESIS_BUTTON_C,
+    [Q_KEY_CODE_Q] = GENESIS_BUTTON_X,
+    [Q_KEY_CODE_W] = GENESIS_BUTTON_Y,
+    [Q_KEY_CODE_E] = GENESIS_BUTTON_Z,
+    [Q_KEY_CODE_RET] = GENESIS_BUTTON_START,
+    [Q_KEY_CODE_TAB] = GENESIS_BUTTON_MODE,
+};
+
+static void genesis_ctrls_event(DeviceState *dev, QemuConsole *src,
+                                InputEvent *evt)
+{
+    GenesisCtrlsState *s = GENESIS_CTRLS(dev);
+    InputKeyEvent *key = evt->u.key.data;
+    int qcode = qemu_input_key_value_to_qcode(key->key);
+    uint16_t button = genesis_ctrls_keymap[qcode];
+
+    if (!button)
+    {
+        return;
+    }
+
+    if (key->down)
+    {
+        s->keys |= button;
+    }
+    else
+    {
+        s->keys &= ~button;
+    }
+    genesis_ctrls_set_buttons(dev, 0, s->keys);
+    notifier_list_notify(&s->input_notifiers, &s->keys);
+}
+
+void genesis_ctrls_add_input_notifier(DeviceState *dev, Notifier *notifier)
+{
+    notifier_list_add(&GENESIS_CTRLS(dev)->input_notifiers, notifier);
+}
+
+void genesis_ctrls_set_host_buttons(DeviceState *dev, uint16_t pressed)
+{
+    GenesisCtrlsState *s = GENESIS_CTRLS(dev);
+
+    s->keys = pressed;
+    genesis_ctrls_set_buttons(dev, 0, pressed);
+}
+
+static const QemuInputHandler genesis_ctrls_handler = {
+    .name = "Sega Genesis pad",
+    .mask = INPUT_EVENT_MASK_KEY,
+    .event = genesis_ctrls_event,
+};
+
+static const char genesis_ctrls_buttons[] = "UDLRBCASZYXM";
+
+static bool parse_buttons(const char *s, uint16_t *buttons)
+{
+    *buttons = 0;
+
+    if (strcmp(s, "-") == 0)
+    {
+        return true;
+    }
+
+    for (; *s; s++)
+    {
+        const char *p = strchr(genesis_ctrls_buttons, *s);
+
+        if (!p)
+        {
+            return false;
+        }
+        *buttons |= 1 << (p - genesis_ctrls_buttons);
+    }
+
+    return true;
+}
+
+static bool parse_script(GenesisCtrlsState *s, Error **errp)
+{
+    g_autofree char *contents = NULL;
+    g_auto(GStrv) lines = NULL;
+    g_autoptr(GError) err = NULL;
+    GArray *input = g_array_new(false, false, sizeof(GenesisCtrlsInput));
+    uint32_t last_frame = 0;
+    int i;
+
+    if (!g_file_get_contents(s->script, &contents, NULL, &err))
+    {
+        error_setg(errp, "input script: %s", err->message);
+        g_array_free(input, true);
+        return false;
+    }
+
+    lines = g_strsplit(contents, "\n", -1);
+    for (i = 0; lines[i]; i++)
+    {
+        g_auto(GStrv) fields = NULL;
+        GenesisCtrlsInput entry;
+        char *line = g_strstrip(lines[i]);
+        char *comment = strchr(line, '#');
+        unsigned int frame, port;
+
+        if (comment)
+        {
+            *comment = '\0';
+        }
+        if (!*g_strstrip(line))
+        {
+            continue;
+        }
+
+        fields = g_strsplit_set(line, " \t", -1);
+        if (g_strv_length(fields) != 3 ||
+            qemu_strtoui(fields[0], NULL, 10, &frame) < 0 ||
+            qemu_strtoui(fields[1], NULL, 10, &port) < 0 || port > 1 ||
+            !parse_buttons(fields[2], &entry.buttons))
+        {
+            error_setg(errp, "%s:%d: expected '<frame> <port 0-1> <buttons>'",
+                       s->script, i + 1);
+            g_array_free(input, true);
+            return false;
+        }
+        if (frame < last_frame)
+        {
+            error_setg(errp, "%s:%d: frames must not go backwards",
+                       s->script, i + 1);
+            g_array_free(input, true);
+            return false;
+        }
+
+        entry.frame = last_frame = frame;
+        entry.port = port;
+        g_array_append_val(input, entry);
+    }
+
+    s->input_len = input->len;
+    s->input = (GenesisCtrlsInput *)g_array_free(input, false);
+    return true;
+}
+
+// Vertical blank: apply the script entries for the frame about to start
+static void genesis_ctrls_frame(Notifier *notifier, void *data)
+{
+    GenesisCtrlsState *s = container_of(notifier, GenesisCtrlsState,
+                                        frame_notifier);
+
+    s->frame++;
+    while (s->input_next < s->input_len &&
+           s->input[s->input_next].frame <= s->frame)
+    {
+        GenesisCtrlsInput *entry = &s->input[s->input_next++];
+
+        genesis_ctrls_set_buttons(DEVICE(s), entry->port, entry->buttons);
+    }
+}
+
+static void genesis_ctrls_init(Object *obj)
+{
+    GenesisCtrlsState *s = GENESIS_CTRLS(obj);
+
+    notifier_list_init(&s->input_notifiers);
+    object_property_add_uint64_ptr(obj, "mmio-accesses", &s->mmio_accesses,
+                                   OBJ_PROP_FLAG_READ);
 }
 
 static void genesis_ctrls_realize(DeviceState *dev, Error **errp)
@@ -228,12 +550,65 @@ static void genesis_ctrls_realize(DeviceState *dev, Error **errp)
     memory_region_init_io(&s->mr, OBJECT(dev), &ctrls_ops, s, "genesis.ctrls", CONTROLLERS_SIZE);
     sysbus_init_mmio(SYS_BUS_DEVICE(dev), &s->mr);
 
-    // qemu_add_kbd_event_handler(genesis_ctrls_event, s);
+    if (s->script)
+    {
+        if (!s->vdp)
+        {
+            error_setg(errp, "genesis-ctrls: script needs the vdp link");
+            return;
+        }
+        if (!parse_script(s, errp))
+        {
+            return;
+        }
+        s->frame_notifier.notify = genesis_ctrls_frame;
+        ym7101_add_frame_notifier(s->vdp, &s->frame_notifier);
+        return;
+    }
+
+    s->input_handler = qemu_input_handler_register(dev, &genesis_ctrls_handler);
 }
 
+static const VMStateDescription genesis_ctrls_port_vmstate = {
+    .name = "genesis-ctrls/port",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT16(buttons, GenesisControllerPort),
+        VMSTATE_UINT8(ctrl, GenesisControllerPort),
+        VMSTATE_UINT8(th_count, GenesisControllerPort),
+        VMSTATE_UINT8(next_read, GenesisControllerPort),
+        VMSTATE_UINT8(s_ctrl, GenesisControllerPort),
+        VMSTATE_UINT8(data, GenesisControllerPort),
+        VMSTATE_INT64(th_time, GenesisControllerPort),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription genesis_ctrls_vmstate = {
     .name = TYPE_GENESIS_CTRLS,
-    .unmigratable = 1, /* TODO: Implement this when m68k CPU is migratable */
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_STRUCT_ARRAY(port, GenesisCtrlsState, 2, 1,
+                             genesis_ctrls_port_vmstate,
+                             GenesisControllerPort),
+        VMSTATE_STRUCT(expansion, GenesisCtrlsState, 1,
+                       genesis_ctrls_port_vmstate, GenesisControllerPort),
+        VMSTATE_UINT16(keys, GenesisCtrlsState),
+        // Where the script is, so that a restore replays the same input
+        VMSTATE_UINT32(frame, GenesisCtrlsState),
+        VMSTATE_UINT32(input_next, GenesisCtrlsState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property genesis_ctrls_properties[] = {
+    DEFINE_PROP_BOOL("six-button", GenesisCtrlsState, six_button, true),
+    DEFINE_PROP_STRING("script", GenesisCtrlsState, script),
+    DEFINE_PROP_LINK("vdp", GenesisCtrlsState, vdp, TYPE_YM7101,
+                     DeviceState *),
+    DEFINE_PROP_END_OF_LIST(),
 };
 
 static void genesis_ctrls_class_init(ObjectClass *oc, void *data)
@@ -244,12 +619,14 @@ static void genesis_ctrls_class_init(ObjectClass *oc, void *data)
     dc->vmsd = &genesis_ctrls_vmstate;
     dc->realize = genesis_ctrls_realize;
     dc->reset = genesis_ctrls_reset;
+    device_class_set_props(dc, genesis_ctrls_properties);
 }
 
 static const TypeInfo genesis_ctrls_info = {
     .name = TYPE_GENESIS_CTRLS,
     .parent = TYPE_SYS_BUS_DEVICE,
     .instance_size = sizeof(GenesisCtrlsState),
+    .instance_init = genesis_ctrls_init,
     .class_init = genesis_ctrls_class_init,
 };
 
@@ -0,0 +1,384 @@
+/*
+ * QEMU Sega Genesis cartridge mapper
+ *
+ * The cartridge space at 0x000000-0x3FFFFF is eight 512 KiB windows, each
+ * an alias into the ROM.  Carts bigger than 4 MiB (the Sega SSF2 mapper)
+ * select the bank seen through windows 1-7 with the registers at
+ * 0xA130F3-0xA130FF; a bank switch only moves an alias, so the ROM stays
+ * plain RAM to TCG and needs no MMIO trapping.  0xA130F1 switches battery
+ * SRAM in over the ROM at 0x200000 and write-protects it.
+ *
+ * With sram-file set, the SRAM is a MAP_SHARED mapping of that file, so
+ * a save is in the host page cache as soon as the guest stores it and
+ * survives QEMU crashing.  To get it to disk, a timer takes the dirty log
+ * of the region every sram-sync-ms and msyncs only the dirty pages; no
+ * store is ever synchronous and there is no flush thread.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "qemu/host-utils.h"
+#include "hw/sysbus.h"
+#include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
+#include "qom/object.h"
+
+#include "hw/m68k/genesis.h"
+#include "trace.h"
+
+OBJECT_DECLARE_SIMPLE_TYPE(GenesisMapperState, GENESIS_MAPPER)
+
+#define CART_SIZE 0x400000
+#define WINDOW_SIZE 0x80000
+#define WINDOWS (CART_SIZE / WINDOW_SIZE)
+#define SRAM_BASE 0x200000
+
+#define REGS_SIZE 0x10
+#define REG_SRAM 0x01
+
+#define SRAM_ENABLE 0x01
+#define SRAM_PROTECT 0x02
+
+struct GenesisMapperState
+{
+    SysBusDevice sbd;
+    MemoryRegion cart;
+    MemoryRegion window[WINDOWS];
+    MemoryRegion sram;
+    MemoryRegion regs;
+
+    MemoryRegion *rom;
+    uint32_t sram_size;
+    char *sram_file;
+    uint32_t sram_sync_ms;
+    QEMUTimer *sram_sync;
+
+    uint8_t bank[WINDOWS];
+    uint8_t sram_ctrl;
+    uint64_t mmio_accesses;
+};
+
+/*
+ * Like the bank lines of a real board, only those needed to address the
+ * ROM are decoded: higher banks mirror the ones below.
+ */
+static void genesis_mapper_set_bank(GenesisMapperState *s, int window,
+                                    uint8_t bank)
+{
+    uint64_t banks = DIV_ROUND_UP(memory_region_size(s->rom), WINDOW_SIZE);
+
+    s->bank[window] = bank;
+    bank &= pow2ceil(banks) - 1;
+    memory_region_set_alias_offset(&s->window[window],
+                                   (hwaddr)bank * WINDOW_SIZE);
+}
+
+static void genesis_mapper_set_sram(GenesisMapperState *s, uint8_t ctrl)
+{
+    s->sram_ctrl = ctrl;
+    if (s->sram_size) {
+        memory_region_transaction_begin();
+        memory_region_set_enabled(&s->sram, ctrl & SRAM_ENABLE);
+        memory_region_set_readonly(&s->sram, ctrl & SRAM_PROTECT);
+        memory_region_transaction_commit();
+    }
+}
+
+static uint64_t genesis_mapper_read(void *opaque, hwaddr addr, unsigned size)
+{
+    GenesisMapperState *s = opaque;
+
+    s->mmio_accesses++;
+    if (size == 1 && !(addr & 1)) {
+        return 0;
+    }
+    addr |= 1;
+    return addr == REG_SRAM ? s->sram_ctrl : s->bank[addr >> 1];
+}
+
+static void genesis_mapper_write(void *opaque, hwaddr addr, uint64_t value,
+                                 unsigned size)
+{
+    GenesisMapperState *s = opaque;
+
+    s->mmio_accesses++;
+
+    /* The registers are on the odd bytes */
+    if (size == 1 && !(addr & 1)) {
+        return;
+    }
+    addr |= 1;
+    value &= 0xff;
+
+    trace_genesis_mapper_write(addr, value);
+
+    if (addr == REG_SRAM) {
+        genesis_mapper_set_sram(s, value);
+    } else {
+        genesis_mapper_set_bank(s, addr >> 1, value);
+    }
+}
+
+static void genesis_mapper_msync(GenesisMapperState *s, uint64_t start,
+                                 uint64_t end)
+{
+    uint8_t *host = memory_region_get_ram_ptr(&s->sram);
+
+    trace_genesis_mapper_msync(start, end - start);
+    if (qemu_msync(host + start, end - start,
+                   memory_region_get_fd(&s->sram)) < 0) {
+        warn_report_once("genesis-mapper: msync of %s failed: %s",
+                         s->sram_file, strerror(errno));
+    }
+}
+
+static void genesis_mapper_sram_flush(GenesisMapperState *s)
+{
+    uint64_t page = qemu_real_host_page_size();
+    DirtyBitmapSnapshot *snap;
+    uint64_t addr, start = 0;
+    bool run = false;
+
+    snap = memory_region_snapshot_and_clear_dirty(&s->sram, 0, s->sram_size,
+                                                  DIRTY_MEMORY_VGA);
+    for (addr = 0; addr < s->sram_size; addr += page) {
+        bool dirty = memory_region_snapshot_get_dirty(&s->sram, snap, addr,
+                                                      MIN(page,
+                                                          s->sram_size - addr));
+
+        if (dirty && !run) {
+            start = addr;
+            run = true;
+        } else if (!dirty && run) {
+            genesis_mapper_msync(s, start, addr);
+            run = false;
+        }
+    }
+    if (run) {
+        genesis_mapper_msync(s, start, s->sram_size);
+    }
+    g_free(snap);
+}
+
+static void genesis_mapper_sram_sync(void *opaque)
+{
+    GenesisMapperState *s = opaque;
+
+    genesis_mapper_sram_flush(s);
+    timer_mod(s->sram_sync,
+              qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + s->sram_sync_ms);
+}
+
+/* Map @s->sram_file shared, growing it to the size of the SRAM if needed */
+static void genesis_mapper_map_sram(GenesisMapperState *s, Error **errp)
+{
+#ifdef CONFIG_POSIX
+    ERRP_GUARD();
+    uint64_t size = ROUND_UP(s->sram_size, qemu_real_host_page_size());
+    struct stat st;
+    int fd;
+
+    fd = qemu_create(s->sram_file, O_RDWR, 0644, errp);
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &st) < 0 ||
+        (st.st_size < size && ftruncate(fd, size) < 0)) {
+        error_setg_errno(errp, errno, "genesis-mapper: can't size %s",
+                         s->sram_file);
+        close(fd);
+        return;
+    }
+
+    memory_region_init_ram_from_fd(&s->sram, OBJECT(s), "genesis-mapper.sram",
+                                   s->sram_size, RAM_SHARED, fd, 0, errp);
+    if (*errp) {
+        close(fd);
+        return;
+    }
+
+    vmstate_register_ram(&s->sram, DEVICE(s));
+    memory_region_set_log(&s->sram, true, DIRTY_MEMORY_VGA);
+    s->sram_sync = timer_new_ms(QEMU_CLOCK_REALTIME,
+                                genesis_mapper_sram_sync, s);
+    timer_mod(s->sram_sync,
+              qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + s->sram_sync_ms);
+#else
+    error_setg(errp, "genesis-mapper: sram-file needs a POSIX host");
+#endif
+}
+
+static const MemoryRegionOps genesis_mapper_ops = {
+    .read = genesis_mapper_read,
+    .write = genesis_mapper_write,
+    .endianness = DEVICE_BIG_ENDIAN,
+    .valid = {
+        .min_access_size = 1,
+        .max_access_size = 2,
+    },
+};
+
+static void genesis_mapper_reset(DeviceState *dev)
+{
+    GenesisMapperState *s = GENESIS_MAPPER(dev);
+    int i;
+
+    memory_region_transaction_begin();
+    for (i = 0; i < WINDOWS; i++) {
+        genesis_mapper_set_bank(s, i, i);
+    }
+    /* SRAM past the end of the ROM can't hide anything, so starts mapped */
+    genesis_mapper_set_sram(s, memory_region_size(s->rom) <= SRAM_BASE ?
+                            SRAM_ENABLE : 0);
+    memory_region_transaction_commit();
+}
+
+static void genesis_mapper_realize(DeviceState *dev, Error **errp)
+{
+    ERRP_GUARD();
+    GenesisMapperState *s = GENESIS_MAPPER(dev);
+    Object *obj = OBJECT(dev);
+    int i;
+
+    if (!s->rom) {
+        error_setg(errp, "genesis-mapper: rom link not set");
+        return;
+    }
+    if (s->sram_size > CART_SIZE - SRAM_BASE) {
+        error_setg(errp, "genesis-mapper: sram-size too large");
+        return;
+    }
+    if (s->sram_file && !s->sram_sync_ms) {
+        error_setg(errp, "genesis-mapper: sram-sync-ms must be positive");
+        return;
+    }
+
+    memory_region_init(&s->cart, obj, "genesis-mapper.cart", CART_SIZE);
+    for (i = 0; i < WINDOWS; i++) {
+        g_autofree char *name = g_strdup_printf("genesis-mapper.window%d", i);
+
+        memory_region_init_alias(&s->window[i], obj, name, s->rom,
+                                 i * WINDOW_SIZE, WINDOW_SIZE);
+        memory_region_add_subregion(&s->cart, i * WINDOW_SIZE, &s->window[i]);
+    }
+
+    if (s->sram_size) {
+        if (s->sram_file) {
+            genesis_mapper_map_sram(s, errp);
+        } else {
+            memory_region_init_ram(&s->sram, obj, "genesis-mapper.sram",
+                                   s->sram_size, errp);
+        }
+        if (*errp) {
+            return;
+        }
+        memory_region_add_subregion_overlap(&s->cart, SRAM_BASE, &s->sram, 1);
+    }
+
+    memory_region_init_io(&s->regs, obj, &genesis_mapper_ops, s,
+                          "genesis-mapper.regs", REGS_SIZE);
+
+    sysbus_init_mmio(SYS_BUS_DEVICE(dev), &s->cart);
+    sysbus_init_mmio(SYS_BUS_DEVICE(dev), &s->regs);
+}
+
+static void genesis_mapper_unrealize(DeviceState *dev)
+{
+    GenesisMapperState *s = GENESIS_MAPPER(dev);
+
+    if (s->sram_sync) {
+        timer_free(s->sram_sync);
+        genesis_mapper_sram_flush(s);
+    }
+}
+
+static int genesis_mapper_post_load(void *opaque, int version_id)
+{
+    GenesisMapperState *s = opaque;
+    int i;
+
+    memory_region_transaction_begin();
+    for (i = 0; i < WINDOWS; i++) {
+        genesis_mapper_set_bank(s, i, s->bank[i]);
+    }
+    genesis_mapper_set_sram(s, s->sram_ctrl);
+    memory_region_transaction_commit();
+    return 0;
+}
+
+/* SRAM contents travel with its RAM block */
+static const VMStateDescription genesis_mapper_vmstate = {
+    .name = TYPE_GENESIS_MAPPER,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = genesis_mapper_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT8_ARRAY(bank, GenesisMapperState, WINDOWS),
+        VMSTATE_UINT8(sram_ctrl, GenesisMapperState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property genesis_mapper_properties[] = {
+    DEFINE_PROP_LINK("rom", GenesisMapperState, rom, TYPE_MEMORY_REGION,
+                     MemoryRegion *),
+    DEFINE_PROP_UINT32("sram-size", GenesisMapperState, sram_size, 0),
+    DEFINE_PROP_STRING("sram-file", GenesisMapperState, sram_file),
+    DEFINE_PROP_UINT32("sram-sync-ms", GenesisMapperState, sram_sync_ms, 1000),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void genesis_mapper_class_init(ObjectClass *oc, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(oc);
+
+    dc->desc = "Sega Genesis cartridge mapper";
+    dc->vmsd = &genesis_mapper_vmstate;
+    dc->realize = genesis_mapper_realize;
+    dc->unrealize = genesis_mapper_unrealize;
+    dc->reset = genesis_mapper_reset;
+    device_class_set_props(dc, genesis_mapper_properties);
+}
+
+static void genesis_mapper_init(Object *obj)
+{
+    GenesisMapperState *s = GENESIS_MAPPER(obj);
+
+    object_property_add_uint64_ptr(obj, "mmio-accesses", &s->mmio_accesses,
+                                   OBJ_PROP_FLAG_READ);
+}
+
+static const TypeInfo genesis_mapper_info = {
+    .name = TYPE_GENESIS_MAPPER,
+    .parent = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(GenesisMapperState),
+    .instance_init = genesis_mapper_init,
+    .class_init = genesis_mapper_class_init,
+};
+
+static void genesis_mapper_register_types(void)
+{
+    type_register_static(&genesis_mapper_info);
+}
+
+type_init(genesis_mapper_register_types)
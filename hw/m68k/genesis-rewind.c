@@ -0,0 +1,411 @@
+/*
+ * QEMU Sega Genesis rewind buffer
+ *
+ * Every @interval frames the machine state is captured into a ring that
+ * holds the last @depth captures.  Only the newest snapshot is kept whole.
+ * Each older one is stored as the XOR of itself and the snapshot after it,
+ * compressed.  Work RAM and VRAM change little over a few frames, so these
+ * deltas are mostly zeroes and compress to a small fraction of the 200 KiB
+ * or so that a whole snapshot takes.
+ *
+ * Stepping back applies the deltas to the newest snapshot, newest first,
+ * until it reaches one that is old enough.  It loads that one and drops
+ * everything newer.
+ *
+ * A snapshot is the device state, as qemu_save_device_state() writes it
+ * for COLO, followed by every writable RAM block.  Capture and restore run
+ * on the vCPU between translation blocks.  The machine must run with
+ * -icount: the timer section then rewinds virtual time together with the
+ * device timestamps that depend on it.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
+#include "hw/core/cpu.h"
+#include "exec/exec-all.h"
+#include "exec/ram_addr.h"
+#include "exec/ramblock.h"
+#include "io/channel-buffer.h"
+#include "migration/qemu-file.h"
+#include "migration/savevm.h"
+#include "sysemu/cpu-timers.h"
+#include "hw/m68k/genesis.h"
+#include "trace.h"
+#include <zlib.h>
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+
+typedef struct {
+    uint32_t frame;         /* frame the snapshot was taken at */
+    size_t len;             /* its length */
+    size_t dev_len;         /* device state bytes at its start */
+    void *delta;            /* compressed XOR with the next snapshot */
+    size_t delta_len;
+} RewindEntry;
+
+typedef struct {
+    Notifier frame_notifier;
+    uint32_t interval;
+    uint32_t depth;
+    uint32_t frame;
+
+    /* Older snapshots, oldest at ring[head] */
+    RewindEntry *ring;
+    uint32_t head;
+    uint32_t count;
+
+    /* Newest snapshot, whole */
+    uint8_t *snap;
+    size_t snap_len;
+    size_t snap_dev_len;
+    uint32_t snap_frame;
+
+    /* Scratch for the uncompressed and the compressed delta */
+    uint8_t *work;
+    size_t work_size;
+    uint8_t *zbuf;
+    size_t zbuf_size;
+} GenesisRewind;
+
+static GenesisRewind history;
+
+typedef struct {
+    uint32_t frames;
+    Error *err;
+} RewindRequest;
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+} RewindCopy;
+
+static int ram_block_len(RAMBlock *rb, void *opaque)
+{
+    size_t *len = opaque;
+
+    if (genesis_snapshot_ram_block(rb)) {
+        *len += qemu_ram_get_used_length(rb);
+    }
+    return 0;
+}
+
+static int save_ram_block(RAMBlock *rb, void *opaque)
+{
+    RewindCopy *copy = opaque;
+    size_t size = qemu_ram_get_used_length(rb);
+
+    if (genesis_snapshot_ram_block(rb)) {
+        memcpy(copy->buf + copy->len, qemu_ram_get_host_addr(rb), size);
+        copy->len += size;
+    }
+    return 0;
+}
+
+static int load_ram_block(RAMBlock *rb, void *opaque)
+{
+    RewindCopy *copy = opaque;
+    size_t size = qemu_ram_get_used_length(rb);
+
+    if (genesis_snapshot_ram_block(rb)) {
+        memcpy(qemu_ram_get_host_addr(rb), copy->buf + copy->len, size);
+        cpu_physical_memory_set_dirty_range(qemu_ram_get_offset(rb), size,
+                                            DIRTY_CLIENTS_NOCODE);
+        copy->len += size;
+    }
+    return 0;
+}
+
+static uint8_t *genesis_rewind_save(size_t *len, size_t *dev_len)
+{
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(128 * KiB);
+    QEMUFile *f = qemu_file_new_output(QIO_CHANNEL(bioc));
+    RewindCopy copy = { 0 };
+    size_t ram_len = 0;
+    int ret;
+
+    ret = qemu_save_device_state(f);
+    if (!ret) {
+        ret = qemu_fflush(f);
+    }
+    if (!ret) {
+        qemu_ram_foreach_block(ram_block_len, &ram_len);
+        copy.buf = g_malloc(bioc->usage + ram_len);
+        memcpy(copy.buf, bioc->data, bioc->usage);
+        copy.len = *dev_len = bioc->usage;
+        qemu_ram_foreach_block(save_ram_block, &copy);
+        *len = copy.len;
+    }
+
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+    return copy.buf;
+}
+
+static int genesis_rewind_load(const uint8_t *snap, size_t len,
+                               size_t dev_len)
+{
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(dev_len);
+    RewindCopy copy = { (uint8_t *)snap, dev_len };
+    QEMUFile *f;
+    int ret;
+
+    qemu_ram_foreach_block(load_ram_block, &copy);
+    assert(copy.len == len);
+    tb_flush(first_cpu);
+
+    memcpy(bioc->data, snap, dev_len);
+    bioc->usage = dev_len;
+    f = qemu_file_new_input(QIO_CHANNEL(bioc));
+    if (qemu_get_be32(f) != QEMU_VM_FILE_MAGIC ||
+        qemu_get_be32(f) != QEMU_VM_FILE_VERSION) {
+        ret = -EINVAL;
+    } else {
+        ret = qemu_load_device_state(f);
+    }
+
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+    return ret;
+}
+
+static void grow(uint8_t **buf, size_t *size, size_t needed)
+{
+    if (*size < needed) {
+        *buf = g_realloc(*buf, needed);
+        *size = needed;
+    }
+}
+
+static bool delta_compress(RewindEntry *e, size_t len)
+{
+#ifdef CONFIG_ZSTD
+    size_t clen;
+
+    grow(&history.zbuf, &history.zbuf_size, ZSTD_compressBound(len));
+    clen = ZSTD_compress(history.zbuf, history.zbuf_size, history.work, len,
+                         1);
+    if (ZSTD_isError(clen)) {
+        return false;
+    }
+#else
+    uLongf clen;
+
+    grow(&history.zbuf, &history.zbuf_size, compressBound(len));
+    clen = history.zbuf_size;
+    if (compress2(history.zbuf, &clen, history.work, len,
+                  Z_BEST_SPEED) != Z_OK) {
+        return false;
+    }
+#endif
+    e->delta = g_memdup2(history.zbuf, clen);
+    e->delta_len = clen;
+    return true;
+}
+
+static bool delta_decompress(const RewindEntry *e, size_t len)
+{
+    grow(&history.work, &history.work_size, len);
+#ifdef CONFIG_ZSTD
+    return ZSTD_decompress(history.work, len, e->delta, e->delta_len) == len;
+#else
+    uLongf out = len;
+
+    return uncompress(history.work, &out, e->delta, e->delta_len) == Z_OK &&
+           out == len;
+#endif
+}
+
+static void genesis_rewind_drop(void)
+{
+    while (history.count) {
+        g_free(history.ring[history.head].delta);
+        history.head = (history.head + 1) % history.depth;
+        history.count--;
+    }
+    g_free(history.snap);
+    history.snap = NULL;
+}
+
+static void genesis_rewind_push(uint8_t *snap, size_t len, size_t dev_len,
+                                uint32_t frame)
+{
+    RewindEntry e = {
+        .frame = history.snap_frame,
+        .len = history.snap_len,
+        .dev_len = history.snap_dev_len,
+    };
+    size_t n = MAX(len, history.snap_len);
+    size_t i;
+
+    if (history.snap) {
+        grow(&history.work, &history.work_size, n);
+        for (i = 0; i < n; i++) {
+            history.work[i] = (i < history.snap_len ? history.snap[i] : 0) ^
+                              (i < len ? snap[i] : 0);
+        }
+
+        if (!delta_compress(&e, n)) {
+            warn_report("genesis-rewind: compression failed, "
+                        "history dropped");
+            genesis_rewind_drop();
+        } else {
+            if (history.count == history.depth) {
+                g_free(history.ring[history.head].delta);
+                history.head = (history.head + 1) % history.depth;
+                history.count--;
+            }
+            history.ring[(history.head + history.count) % history.depth] = e;
+            history.count++;
+        }
+        g_free(history.snap);
+    }
+
+    history.snap = snap;
+    history.snap_len = len;
+    history.snap_dev_len = dev_len;
+    history.snap_frame = frame;
+    trace_genesis_rewind_capture(frame, len, e.delta_len, history.count);
+}
+
+static void genesis_rewind_capture(CPUState *cs, run_on_cpu_data data)
+{
+    size_t len, dev_len;
+    uint8_t *snap;
+
+    /* Stepped back onto this frame since the capture was queued */
+    if (history.snap && history.snap_frame == history.frame) {
+        return;
+    }
+
+    snap = genesis_rewind_save(&len, &dev_len);
+    if (!snap) {
+        warn_report("genesis-rewind: cannot save the device state");
+        return;
+    }
+    genesis_rewind_push(snap, len, dev_len, history.frame);
+}
+
+static void genesis_rewind_step(CPUState *cs, run_on_cpu_data data)
+{
+    RewindRequest *req = data.host_ptr;
+    uint32_t oldest;
+    uint32_t target;
+
+    if (!history.snap) {
+        error_setg(&req->err, "No rewind history yet");
+        return;
+    }
+
+    oldest = history.count ? history.ring[history.head].frame
+                           : history.snap_frame;
+    if (req->frames > history.frame - oldest) {
+        error_setg(&req->err, "Only %" PRIu32 " frames of rewind history",
+                   history.frame - oldest);
+        return;
+    }
+    target = history.frame - req->frames;
+
+    /* Undo the deltas, newest first, until the snapshot is old enough */
+    while (history.snap_frame > target) {
+        RewindEntry *e = &history.ring[(history.head + history.count - 1) %
+                                       history.depth];
+        size_t n = MAX(e->len, history.snap_len);
+        size_t i;
+
+        if (!delta_decompress(e, n)) {
+            error_setg(&req->err, "Rewind history is corrupt");
+            genesis_rewind_drop();
+            return;
+        }
+        if (n > history.snap_len) {
+            history.snap = g_realloc(history.snap, n);
+            memset(history.snap + history.snap_len, 0, n - history.snap_len);
+        }
+        for (i = 0; i < e->len; i++) {
+            history.snap[i] ^= history.work[i];
+        }
+
+        history.snap_len = e->len;
+        history.snap_dev_len = e->dev_len;
+        history.snap_frame = e->frame;
+        g_free(e->delta);
+        history.count--;
+    }
+
+    if (genesis_rewind_load(history.snap, history.snap_len,
+                            history.snap_dev_len) < 0) {
+        error_setg(&req->err, "Cannot load the frame %" PRIu32 " snapshot",
+                   history.snap_frame);
+        return;
+    }
+
+    trace_genesis_rewind_step(history.frame, history.snap_frame,
+                              history.count);
+    history.frame = history.snap_frame;
+}
+
+void qmp_x_genesis_rewind(uint32_t frames, Error **errp)
+{
+    ERRP_GUARD();
+    RewindRequest req = { .frames = frames };
+
+    if (!history.interval) {
+        error_setg(errp, "Rewind is not enabled");
+        error_append_hint(errp, "Set the machine's rewind-interval.\n");
+        return;
+    }
+
+    run_on_cpu(first_cpu, genesis_rewind_step, RUN_ON_CPU_HOST_PTR(&req));
+    error_propagate(errp, req.err);
+}
+
+static void genesis_rewind_frame(Notifier *notifier, void *data)
+{
+    history.frame++;
+    if (history.frame % history.interval == 0) {
+        async_run_on_cpu(first_cpu, genesis_rewind_capture,
+                         RUN_ON_CPU_NULL);
+    }
+}
+
+void genesis_rewind_init(DeviceState *vdp, uint32_t interval, uint32_t depth,
+                         Error **errp)
+{
+    if (!icount_enabled()) {
+        error_setg(errp, "rewind-interval needs -icount");
+        return;
+    }
+    if (!depth) {
+        error_setg(errp, "rewind-depth must be at least 1");
+        return;
+    }
+
+    history.interval = interval;
+    history.depth = depth;
+    history.ring = g_new0(RewindEntry, depth);
+
+    history.frame_notifier.notify = genesis_rewind_frame;
+    ym7101_add_frame_notifier(vdp, &history.frame_notifier);
+}
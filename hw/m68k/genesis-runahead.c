@@ -0,0 +1,118 @@
+/*
+ * QEMU Sega Genesis run-ahead
+ *
+ * Games read the pad, then take a frame or more to show the result, on
+ * top of the host's own display latency.  Run-ahead hides that delay by
+ * showing the machine @frames frames past the point where the input was
+ * applied.
+ *
+ * The machine runs normally and is snapshotted at each vertical blank
+ * into a ring of @frames + 1 slots.  While the host input stays the same,
+ * the frames already emulated are exactly what the guest would have
+ * produced, and nothing else is done.  When the input changes, the
+ * machine goes back to the oldest slot, the new input is applied there,
+ * and the frames up to the present are replayed with the display held.
+ * Audio cannot be taken back, so the FM chip, and with it the PSG, does
+ * not render past the oldest slot.  Sound therefore lags the picture by
+ * @frames frames.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "hw/core/cpu.h"
+#include "hw/m68k/genesis.h"
+#include "genesis-runahead.h"
+#include "trace.h"
+
+typedef struct {
+    Notifier frame_notifier;
+    Notifier input_notifier;
+    DeviceState *vdp;
+    DeviceState *fm;
+    DeviceState *ctrls;
+
+    GenesisSnapshot *snap;
+    GenesisRunAheadRing ring;
+
+    /* Host input, as last reported by the controllers */
+    uint16_t keys;
+    bool input_changed;
+} GenesisRunAhead;
+
+static GenesisRunAhead runahead;
+
+/* On the vCPU, between translation blocks, shortly after vertical blank */
+static void genesis_runahead_frame_work(CPUState *cs, run_on_cpu_data data)
+{
+    GenesisRunAhead *ra = &runahead;
+    GenesisRunAheadRing *r = &ra->ring;
+
+    if (ra->input_changed && r->count) {
+        /* The oldest slot is this same point, frames ago: go back there */
+        ra->input_changed = false;
+        genesis_snapshot_load(ra->snap, genesis_runahead_rollback(r));
+        genesis_ctrls_set_host_buttons(ra->ctrls, ra->keys);
+        trace_genesis_runahead_rollback(r->replay);
+        ym7101_hold_display(ra->vdp, r->replay > 0);
+    } else {
+        bool replaying = r->replay;
+
+        genesis_snapshot_save(ra->snap, genesis_runahead_advance(r));
+        if (replaying && !r->replay) {
+            ym7101_hold_display(ra->vdp, false);
+        }
+    }
+
+    ym2612_set_render_limit(ra->fm, genesis_snapshot_time(ra->snap,
+                                                          r->oldest));
+}
+
+static void genesis_runahead_frame(Notifier *notifier, void *data)
+{
+    async_run_on_cpu(first_cpu, genesis_runahead_frame_work, RUN_ON_CPU_NULL);
+}
+
+static void genesis_runahead_input(Notifier *notifier, void *data)
+{
+    runahead.keys = *(uint16_t *)data;
+    runahead.input_changed = true;
+}
+
+void genesis_runahead_init(Object *machine, DeviceState *vdp,
+                           DeviceState *fm, DeviceState *ctrls,
+                           uint32_t frames, Error **errp)
+{
+    GenesisRunAhead *ra = &runahead;
+
+    ra->snap = genesis_snapshot_new(machine, frames + 1, errp);
+    if (!ra->snap) {
+        return;
+    }
+    ra->ring.slots = frames + 1;
+    ra->vdp = vdp;
+    ra->fm = fm;
+    ra->ctrls = ctrls;
+
+    ra->frame_notifier.notify = genesis_runahead_frame;
+    ym7101_add_frame_notifier(vdp, &ra->frame_notifier);
+    ra->input_notifier.notify = genesis_runahead_input;
+    genesis_ctrls_add_input_notifier(ctrls, &ra->input_notifier);
+}
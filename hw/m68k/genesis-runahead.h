@@ -0,0 +1,66 @@
+/*
+ * QEMU Sega Genesis run-ahead - snapshot ring
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef HW_M68K_GENESIS_RUNAHEAD_H
+#define HW_M68K_GENESIS_RUNAHEAD_H
+
+/* Which slot each frame is saved to or restored from */
+typedef struct GenesisRunAheadRing {
+    int slots;
+    int oldest;
+    int count;
+
+    /* Frames still to replay, hidden, after a rollback */
+    int replay;
+} GenesisRunAheadRing;
+
+/*
+ * Go back to the oldest slot and return it.  A rollback during a replay
+ * goes back further still, so the frames it undoes are added to those
+ * left to replay: the display resumes where it was held.
+ */
+static inline int genesis_runahead_rollback(GenesisRunAheadRing *r)
+{
+    r->replay = MIN(r->replay + r->count - 1, r->slots - 1);
+    r->count = 1;
+    return r->oldest;
+}
+
+/* Return the slot for this frame's snapshot, dropping the oldest if full */
+static inline int genesis_runahead_advance(GenesisRunAheadRing *r)
+{
+    int slot;
+
+    if (r->count == r->slots) {
+        r->oldest = (r->oldest + 1) % r->slots;
+        r->count--;
+    }
+    slot = (r->oldest + r->count) % r->slots;
+    r->count++;
+
+    if (r->replay) {
+        r->replay--;
+    }
+    return slot;
+}
+
+#endif /* HW_M68K_GENESIS_RUNAHEAD_H */
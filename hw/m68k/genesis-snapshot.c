@@ -0,0 +1,354 @@
+/*
+ * QEMU Sega Genesis in-memory snapshots
+ *
+ * A fast save/restore of the whole machine, for run-ahead.  The device
+ * VMState descriptions say which fields make up the state.  Each field is
+ * copied as it sits in memory into a flat slot, with no QEMUFile stream
+ * and no byte swapping.  Nested structures are copied whole.  Timers are
+ * saved as their expiry time.  After a restore the post_load hooks
+ * rebuild the derived state, just as they do after migration.  The
+ * writable RAM blocks are copied page by page, and only pages that
+ * differ are written back.  The virtual clock goes back with the machine,
+ * so -icount is required.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "hw/core/cpu.h"
+#include "hw/qdev-core.h"
+#include "exec/exec-all.h"
+#include "exec/ram_addr.h"
+#include "exec/ramblock.h"
+#include "migration/vmstate.h"
+#include "sysemu/cpu-timers.h"
+#include "hw/m68k/genesis.h"
+
+#define SNAPSHOT_PAGE 4096
+
+typedef struct {
+    const VMStateDescription *vmsd;
+    void *opaque;
+    /* The CPU's own state, restored without its post_load */
+    bool cpu_common;
+} SnapshotDevice;
+
+typedef struct {
+    uint8_t *host;
+    ram_addr_t offset;
+    size_t len;
+} SnapshotRAM;
+
+struct GenesisSnapshot {
+    GArray *devices;
+    GArray *ram;
+    size_t size;
+    size_t ram_offset;
+    int slots;
+    uint8_t *data;
+};
+
+typedef enum {
+    SNAPSHOT_SIZE,
+    SNAPSHOT_SAVE,
+    SNAPSHOT_LOAD,
+} SnapshotOp;
+
+static bool snapshot_field_supported(const VMStateField *field, Error **errp)
+{
+    if (field->flags & (VMS_VARRAY_INT32 | VMS_VARRAY_UINT32 |
+                        VMS_VARRAY_UINT16 | VMS_VARRAY_UINT8 |
+                        VMS_VBUFFER | VMS_ARRAY_OF_POINTER | VMS_VSTRUCT) ||
+        field->info == &vmstate_info_tmp) {
+        error_setg(errp, "run-ahead cannot copy field '%s'", field->name);
+        return false;
+    }
+    return true;
+}
+
+static void snapshot_copy(uint8_t **pos, void *p, size_t len, SnapshotOp op)
+{
+    if (op == SNAPSHOT_SAVE) {
+        memcpy(*pos, p, len);
+    } else if (op == SNAPSHOT_LOAD) {
+        memcpy(p, *pos, len);
+    }
+    *pos += len;
+}
+
+/*
+ * Walk the fields of @vmsd, then its subsections, behind one flag byte each.
+ * The post_load hooks run after a load unless @post_load is false.
+ */
+static bool snapshot_walk(const VMStateDescription *vmsd, void *opaque,
+                          uint8_t **pos, SnapshotOp op, bool post_load,
+                          Error **errp)
+{
+    const VMStateField *field;
+    const VMStateDescription * const *sub;
+
+    if (op == SNAPSHOT_SAVE && vmsd->pre_save) {
+        vmsd->pre_save(opaque);
+    }
+    if (op == SNAPSHOT_LOAD && vmsd->pre_load) {
+        vmsd->pre_load(opaque);
+    }
+
+    for (field = vmsd->fields; field && field->name; field++) {
+        uint8_t *base = (uint8_t *)opaque + field->offset;
+        SnapshotOp fop = op;
+        int n = 1;
+        int i;
+
+        if (op == SNAPSHOT_SIZE && !snapshot_field_supported(field, errp)) {
+            return false;
+        }
+        if (field->info == &vmstate_info_unused_buffer) {
+            continue;
+        }
+        /* Absent fields keep their space, so that the layout is fixed */
+        if (field->field_exists) {
+            uint8_t exists = op == SNAPSHOT_SAVE &&
+                             field->field_exists(opaque, vmsd->version_id);
+
+            snapshot_copy(pos, &exists, 1, op);
+            if (!exists) {
+                fop = SNAPSHOT_SIZE;
+            }
+        }
+        if (field->flags & VMS_ARRAY) {
+            n = field->num;
+            if (field->flags & VMS_MULTIPLY_ELEMENTS) {
+                n *= field->num;
+            }
+        }
+        if ((field->flags & VMS_POINTER) && fop != SNAPSHOT_SIZE) {
+            base = *(uint8_t **)base;
+        }
+
+        if (field->info == &vmstate_info_timer) {
+            for (i = 0; i < n; i++) {
+                QEMUTimer *t = (QEMUTimer *)(base + i * field->size);
+                int64_t expire = -1;
+
+                if (fop == SNAPSHOT_SAVE) {
+                    expire = timer_expire_time_ns(t);
+                }
+                snapshot_copy(pos, &expire, sizeof(expire), fop);
+                if (fop == SNAPSHOT_LOAD) {
+                    if (expire < 0) {
+                        timer_del(t);
+                    } else {
+                        timer_mod_ns(t, expire);
+                    }
+                }
+            }
+        } else {
+            /* Plain values, arrays and whole structures alike */
+            snapshot_copy(pos, base, field->size * n, fop);
+        }
+    }
+
+    for (sub = vmsd->subsections; sub && *sub; sub++) {
+        uint8_t needed = op == SNAPSHOT_SAVE &&
+                         (!(*sub)->needed || (*sub)->needed(opaque));
+
+        snapshot_copy(pos, &needed, 1, op);
+        if (!snapshot_walk(*sub, opaque, pos, needed ? op : SNAPSHOT_SIZE,
+                           post_load, errp)) {
+            return false;
+        }
+    }
+
+    if (op == SNAPSHOT_LOAD && post_load && vmsd->post_load) {
+        vmsd->post_load(opaque, vmsd->version_id);
+    }
+    return true;
+}
+
+static void snapshot_add(GenesisSnapshot *s, const VMStateDescription *vmsd,
+                         void *opaque)
+{
+    SnapshotDevice d = { vmsd, opaque, vmsd == &vmstate_cpu_common };
+
+    g_array_append_val(s->devices, d);
+}
+
+static int snapshot_add_device(Object *obj, void *opaque)
+{
+    GenesisSnapshot *s = opaque;
+    DeviceState *dev = (DeviceState *)object_dynamic_cast(obj, TYPE_DEVICE);
+    const VMStateDescription *vmsd;
+
+    if (!dev) {
+        return 0;
+    }
+    if (object_dynamic_cast(obj, TYPE_CPU)) {
+        snapshot_add(s, &vmstate_cpu_common, obj);
+    }
+    vmsd = qdev_get_vmsd(dev);
+    if (vmsd && !vmsd->unmigratable) {
+        snapshot_add(s, vmsd, dev);
+    }
+    return 0;
+}
+
+bool genesis_snapshot_ram_block(RAMBlock *rb)
+{
+    return qemu_ram_is_migratable(rb) && !memory_region_is_rom(rb->mr);
+}
+
+static int snapshot_add_ram(RAMBlock *rb, void *opaque)
+{
+    GenesisSnapshot *s = opaque;
+    SnapshotRAM r = {
+        .host = qemu_ram_get_host_addr(rb),
+        .offset = qemu_ram_get_offset(rb),
+        .len = qemu_ram_get_used_length(rb),
+    };
+
+    if (genesis_snapshot_ram_block(rb)) {
+        g_array_append_val(s->ram, r);
+    }
+    return 0;
+}
+
+GenesisSnapshot *genesis_snapshot_new(Object *machine, int slots,
+                                      Error **errp)
+{
+    GenesisSnapshot *s;
+    uint8_t *pos = NULL;
+    int i;
+
+    if (!icount_enabled()) {
+        error_setg(errp, "in-memory snapshots need -icount");
+        return NULL;
+    }
+
+    s = g_new0(GenesisSnapshot, 1);
+    s->devices = g_array_new(false, false, sizeof(SnapshotDevice));
+    s->ram = g_array_new(false, false, sizeof(SnapshotRAM));
+    object_child_foreach_recursive(machine, snapshot_add_device, s);
+    qemu_ram_foreach_block(snapshot_add_ram, s);
+
+    /* The layout is fixed: measure it once */
+    pos += sizeof(int64_t);
+    for (i = 0; i < s->devices->len; i++) {
+        SnapshotDevice *d = &g_array_index(s->devices, SnapshotDevice, i);
+
+        if (!snapshot_walk(d->vmsd, d->opaque, &pos, SNAPSHOT_SIZE, true,
+                           errp)) {
+            genesis_snapshot_free(s);
+            return NULL;
+        }
+    }
+    s->ram_offset = (size_t)pos;
+    for (i = 0; i < s->ram->len; i++) {
+        pos += g_array_index(s->ram, SnapshotRAM, i).len;
+    }
+
+    s->size = (size_t)pos;
+    s->slots = slots;
+    s->data = g_malloc(s->size * slots);
+    return s;
+}
+
+void genesis_snapshot_free(GenesisSnapshot *s)
+{
+    g_array_free(s->devices, true);
+    g_array_free(s->ram, true);
+    g_free(s->data);
+    g_free(s);
+}
+
+void genesis_snapshot_save(GenesisSnapshot *s, int slot)
+{
+    uint8_t *pos = s->data + slot * s->size;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    int i;
+
+    snapshot_copy(&pos, &now, sizeof(now), SNAPSHOT_SAVE);
+    for (i = 0; i < s->devices->len; i++) {
+        SnapshotDevice *d = &g_array_index(s->devices, SnapshotDevice, i);
+
+        snapshot_walk(d->vmsd, d->opaque, &pos, SNAPSHOT_SAVE, true,
+                      &error_abort);
+    }
+    assert(pos == s->data + slot * s->size + s->ram_offset);
+    for (i = 0; i < s->ram->len; i++) {
+        SnapshotRAM *r = &g_array_index(s->ram, SnapshotRAM, i);
+
+        snapshot_copy(&pos, r->host, r->len, SNAPSHOT_SAVE);
+    }
+}
+
+int64_t genesis_snapshot_time(GenesisSnapshot *s, int slot)
+{
+    int64_t now;
+
+    memcpy(&now, s->data + slot * s->size, sizeof(now));
+    return now;
+}
+
+void genesis_snapshot_load(GenesisSnapshot *s, int slot)
+{
+    uint8_t *pos = s->data + slot * s->size;
+    int64_t now;
+    int i;
+
+    snapshot_copy(&pos, &now, sizeof(now), SNAPSHOT_LOAD);
+    icount_set_ns(now);
+
+    pos = s->data + slot * s->size + s->ram_offset;
+    for (i = 0; i < s->ram->len; i++) {
+        SnapshotRAM *r = &g_array_index(s->ram, SnapshotRAM, i);
+        size_t off;
+
+        for (off = 0; off < r->len; off += SNAPSHOT_PAGE) {
+            size_t len = MIN(SNAPSHOT_PAGE, r->len - off);
+
+            if (memcmp(r->host + off, pos + off, len)) {
+                memcpy(r->host + off, pos + off, len);
+                tb_invalidate_phys_range(r->offset + off,
+                                         r->offset + off + len - 1);
+                cpu_physical_memory_set_dirty_range(r->offset + off, len,
+                                                    DIRTY_CLIENTS_NOCODE);
+            }
+        }
+        pos += r->len;
+    }
+
+    pos = s->data + slot * s->size + sizeof(now);
+    for (i = 0; i < s->devices->len; i++) {
+        SnapshotDevice *d = &g_array_index(s->devices, SnapshotDevice, i);
+
+        /*
+         * cpu_common_post_load() would flush every TB, as after loadvm.
+         * The pages that changed have had theirs invalidated above, so
+         * only the TLB needs to go.
+         */
+        snapshot_walk(d->vmsd, d->opaque, &pos, SNAPSHOT_LOAD, !d->cpu_common,
+                      &error_abort);
+        if (d->cpu_common) {
+            tlb_flush(CPU(d->opaque));
+        }
+    }
+}
@@ -0,0 +1,453 @@
+/*
+ * QEMU Sega Genesis Z80 sound coprocessor
+ *
+ * The Z80 is not a QEMU CPU: QEMU only runs CPUs of one architecture, so
+ * it is interpreted here and scheduled cooperatively against the 68000.
+ * Its time is derived from QEMU_CLOCK_VIRTUAL (instruction driven under
+ * -icount), and it catches up in batches: whenever the 68000 touches the
+ * Z80 side of the bus, when the VDP raises its interrupt, and from a
+ * timer every GENESIS_Z80_SLICE cycles so it never runs too far behind.
+ *
+ * Z80 address space:
+ *   0000-1fff  8 KiB RAM, mirrored at 2000-3fff
+ *   4000-5fff  YM2612, four ports mirrored
+ *   6000-60ff  bank register, one bit per write
+ *   7f00-7f1f  VDP
+ *   8000-ffff  32 KiB window into the 68000 bus, selected by the bank
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/timer.h"
+#include "qemu/host-utils.h"
+#include "qapi/error.h"
+#include "hw/sysbus.h"
+#include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
+#include "exec/address-spaces.h"
+#include "qom/object.h"
+
+#include "hw/m68k/genesis.h"
+#include "z80-cpu.h"
+#include "trace.h"
+
+OBJECT_DECLARE_SIMPLE_TYPE(GenesisZ80State, GENESIS_Z80)
+
+/* NTSC master clock / 15 */
+#define GENESIS_Z80_CLOCK_HZ 3579545
+
+/* Cycles run per batch when nothing else synchronises the Z80 */
+#define GENESIS_Z80_SLICE 512
+
+/* The VDP holds /INT for about one line */
+#define GENESIS_Z80_INT_CYCLES 171
+
+#define Z80_RAM_SIZE 0x2000
+#define Z80_WINDOW_SIZE 0x10000
+#define Z80_IO_BASE 0x4000
+#define Z80_IO_SIZE 0x4000
+
+#define Z80_BANK_BASE 0x6000
+#define Z80_VDP_BASE 0x7f00
+#define Z80_BANKED_BASE 0x8000
+
+#define GENESIS_VDP_BASE 0xc00000
+
+struct GenesisZ80State
+{
+    SysBusDevice sbd;
+
+    /* 0xA00000-0xA0FFFF as seen by the 68000 */
+    MemoryRegion window;
+    MemoryRegion ram;
+    MemoryRegion ram_mirror;
+    MemoryRegion io;
+    uint8_t *ram_ptr;
+
+    QEMUTimer *timer;
+    Z80CPU cpu;
+
+    /* YM2612, shared with the 68000 */
+    DeviceState *fm;
+
+    /* Bus control, from 0xA11100 and 0xA11200 */
+    bool busreq;
+    bool reset;
+
+    /* 68000 address bits 23-15 of the banked window */
+    uint16_t bank;
+
+    /* Z80 time: cycles run since clock_base, /INT held from int_start */
+    int64_t clock_base;
+    uint64_t cycles;
+    uint64_t int_start;
+    uint64_t int_end;
+
+    /*
+     * Set while the Z80 runs.  Through the bank the Z80 can reach its own
+     * window and the bus control registers, which sync it again.
+     */
+    bool in_sync;
+
+    uint64_t mmio_accesses;
+};
+
+static bool genesis_z80_running(GenesisZ80State *s)
+{
+    return !s->busreq && !s->reset;
+}
+
+static uint64_t genesis_z80_target(GenesisZ80State *s)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    return muldiv64(now - s->clock_base, GENESIS_Z80_CLOCK_HZ,
+                    NANOSECONDS_PER_SECOND);
+}
+
+/* Bring the Z80 up to the current virtual time */
+static void genesis_z80_sync(GenesisZ80State *s)
+{
+    uint64_t target = genesis_z80_target(s);
+
+    if (s->in_sync) {
+        return;
+    }
+    s->in_sync = true;
+    while (s->cycles < target) {
+        uint64_t budget = target - s->cycles;
+
+        if (!genesis_z80_running(s)) {
+            s->cycles = target;
+            break;
+        }
+
+        /* Stop at the edges of /INT so it is seen at the right time */
+        if (s->cycles < s->int_start) {
+            s->cpu.irq = false;
+            budget = MIN(budget, s->int_start - s->cycles);
+        } else if (s->cycles < s->int_end) {
+            s->cpu.irq = true;
+            budget = MIN(budget, s->int_end - s->cycles);
+        } else {
+            s->cpu.irq = false;
+        }
+        s->cycles += z80_run(&s->cpu, MIN(budget, INT_MAX));
+    }
+    s->in_sync = false;
+}
+
+static void genesis_z80_schedule(GenesisZ80State *s)
+{
+    if (!genesis_z80_running(s)) {
+        timer_del(s->timer);
+        return;
+    }
+
+    timer_mod(s->timer, s->clock_base +
+              muldiv64(s->cycles + GENESIS_Z80_SLICE, NANOSECONDS_PER_SECOND,
+                       GENESIS_Z80_CLOCK_HZ));
+}
+
+static void genesis_z80_timer_cb(void *opaque)
+{
+    GenesisZ80State *s = opaque;
+
+    genesis_z80_sync(s);
+    genesis_z80_schedule(s);
+}
+
+static void genesis_z80_bank_shift(GenesisZ80State *s, uint8_t value)
+{
+    s->bank = ((s->bank >> 1) | ((value & 1) << 8)) & 0x1ff;
+}
+
+/* Z80 bus */
+
+static uint8_t z80_bus_read(void *opaque, uint16_t addr)
+{
+    GenesisZ80State *s = opaque;
+
+    if (addr < Z80_IO_BASE) {
+        return s->ram_ptr[addr & (Z80_RAM_SIZE - 1)];
+    }
+    if (addr >= Z80_BANKED_BASE) {
+        return address_space_ldub(&address_space_memory,
+                                  (s->bank << 15) | (addr & 0x7fff),
+                                  MEMTXATTRS_UNSPECIFIED, NULL);
+    }
+    if (addr >= Z80_VDP_BASE) {
+        return address_space_ldub(&address_space_memory,
+                                  GENESIS_VDP_BASE | (addr & 0x1f),
+                                  MEMTXATTRS_UNSPECIFIED, NULL);
+    }
+    if (addr < Z80_BANK_BASE) {
+        return ym2612_read(s->fm, addr & 3);
+    }
+    return 0xff;
+}
+
+static void z80_bus_write(void *opaque, uint16_t addr, uint8_t value)
+{
+    GenesisZ80State *s = opaque;
+
+    if (addr < Z80_IO_BASE) {
+        s->ram_ptr[addr & (Z80_RAM_SIZE - 1)] = value;
+    } else if (addr >= Z80_BANKED_BASE) {
+        address_space_stb(&address_space_memory,
+                          (s->bank << 15) | (addr & 0x7fff), value,
+                          MEMTXATTRS_UNSPECIFIED, NULL);
+    } else if (addr >= Z80_VDP_BASE) {
+        address_space_stb(&address_space_memory,
+                          GENESIS_VDP_BASE | (addr & 0x1f), value,
+                          MEMTXATTRS_UNSPECIFIED, NULL);
+    } else if (addr >= Z80_BANK_BASE) {
+        if (addr < Z80_BANK_BASE + 0x100) {
+            genesis_z80_bank_shift(s, value);
+        }
+    } else {
+        ym2612_write(s->fm, addr & 3, value);
+    }
+}
+
+/* The Genesis leaves the Z80 I/O space unconnected */
+static uint8_t z80_bus_in(void *opaque, uint16_t port)
+{
+    return 0xff;
+}
+
+static void z80_bus_out(void *opaque, uint16_t port, uint8_t value)
+{
+}
+
+static const Z80Bus genesis_z80_bus = {
+    .read = z80_bus_read,
+    .write = z80_bus_write,
+    .in = z80_bus_in,
+    .out = z80_bus_out,
+};
+
+/* 68000 side of 0xA04000-0xA07FFF */
+
+static MemTxResult genesis_z80_io_read(void *opaque, hwaddr addr,
+                                       uint64_t *data, unsigned size,
+                                       MemTxAttrs attrs)
+{
+    GenesisZ80State *s = opaque;
+
+    s->mmio_accesses++;
+    genesis_z80_sync(s);
+
+    if (addr < Z80_BANK_BASE - Z80_IO_BASE) {
+        *data = ym2612_read(s->fm, addr & 3);
+        if (size == 2) {
+            *data |= *data << 8;
+        }
+    } else {
+        *data = ~0ULL;
+    }
+    return MEMTX_OK;
+}
+
+static MemTxResult genesis_z80_io_write(void *opaque, hwaddr addr,
+                                        uint64_t value, unsigned size,
+                                        MemTxAttrs attrs)
+{
+    GenesisZ80State *s = opaque;
+
+    s->mmio_accesses++;
+    genesis_z80_sync(s);
+
+    if (addr < Z80_BANK_BASE - Z80_IO_BASE) {
+        /* A word write drives the same byte onto both halves */
+        ym2612_write(s->fm, addr & 3, size == 2 ? value >> 8 : value);
+    } else if (addr < Z80_BANK_BASE - Z80_IO_BASE + 0x100) {
+        genesis_z80_bank_shift(s, value);
+    } else {
+        qemu_log_mask(LOG_UNIMP, "genesis-z80: write to 0x%04" HWADDR_PRIx
+                      " ignored\n", addr + Z80_IO_BASE);
+    }
+    return MEMTX_OK;
+}
+
+static const MemoryRegionOps genesis_z80_io_ops = {
+    .read_with_attrs = genesis_z80_io_read,
+    .write_with_attrs = genesis_z80_io_write,
+    .endianness = DEVICE_BIG_ENDIAN,
+    .valid = {
+        .min_access_size = 1,
+        .max_access_size = 2,
+    },
+};
+
+/* Bus control */
+
+void genesis_z80_set_busreq(DeviceState *dev, bool request)
+{
+    GenesisZ80State *s = GENESIS_Z80(dev);
+
+    genesis_z80_sync(s);
+    s->busreq = request;
+    trace_genesis_z80_control(s->busreq, s->reset, s->cpu.pc);
+    genesis_z80_schedule(s);
+}
+
+void genesis_z80_set_reset(DeviceState *dev, bool reset)
+{
+    GenesisZ80State *s = GENESIS_Z80(dev);
+
+    genesis_z80_sync(s);
+    if (reset && !s->reset) {
+        z80_reset(&s->cpu);
+    }
+    s->reset = reset;
+    trace_genesis_z80_control(s->busreq, s->reset, s->cpu.pc);
+    genesis_z80_schedule(s);
+}
+
+bool genesis_z80_bus_granted(DeviceState *dev)
+{
+    GenesisZ80State *s = GENESIS_Z80(dev);
+
+    /* BUSACK does not assert while the Z80 is held in reset */
+    return s->busreq && !s->reset;
+}
+
+/*
+ * Called from inside the VDP, so only note the time: running the Z80 here
+ * would re-enter the VDP if the Z80 touches it.
+ */
+void genesis_z80_vint(DeviceState *dev)
+{
+    GenesisZ80State *s = GENESIS_Z80(dev);
+
+    s->int_start = genesis_z80_target(s);
+    s->int_end = s->int_start + GENESIS_Z80_INT_CYCLES;
+}
+
+static void genesis_z80_reset(DeviceState *dev)
+{
+    GenesisZ80State *s = GENESIS_Z80(dev);
+
+    z80_reset(&s->cpu);
+    s->busreq = false;
+    s->reset = true;
+    s->bank = 0;
+    s->clock_base = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    s->cycles = 0;
+    s->int_start = 0;
+    s->int_end = 0;
+    genesis_z80_schedule(s);
+}
+
+static void genesis_z80_init(Object *obj)
+{
+    GenesisZ80State *s = GENESIS_Z80(obj);
+
+    object_property_add_uint64_ptr(obj, "mmio-accesses", &s->mmio_accesses,
+                                   OBJ_PROP_FLAG_READ);
+}
+
+static void genesis_z80_realize(DeviceState *dev, Error **errp)
+{
+    GenesisZ80State *s = GENESIS_Z80(dev);
+    Object *obj = OBJECT(dev);
+
+    memory_region_init(&s->window, obj, "genesis-z80", Z80_WINDOW_SIZE);
+
+    if (!memory_region_init_ram(&s->ram, obj, "genesis-z80.ram",
+                                Z80_RAM_SIZE, errp)) {
+        return;
+    }
+    memory_region_add_subregion(&s->window, 0, &s->ram);
+    memory_region_init_alias(&s->ram_mirror, obj, "genesis-z80.ram-mirror",
+                             &s->ram, 0, Z80_RAM_SIZE);
+    memory_region_add_subregion(&s->window, Z80_RAM_SIZE, &s->ram_mirror);
+    s->ram_ptr = memory_region_get_ram_ptr(&s->ram);
+
+    memory_region_init_io(&s->io, obj, &genesis_z80_io_ops, s,
+                          "genesis-z80.io", Z80_IO_SIZE);
+    memory_region_add_subregion(&s->window, Z80_IO_BASE, &s->io);
+
+    sysbus_init_mmio(SYS_BUS_DEVICE(dev), &s->window);
+
+    z80_init(&s->cpu, &genesis_z80_bus, s);
+    s->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, genesis_z80_timer_cb, s);
+}
+
+static Property genesis_z80_properties[] = {
+    DEFINE_PROP_LINK("fm", GenesisZ80State, fm, TYPE_YM2612, DeviceState *),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static int genesis_z80_post_load(void *opaque, int version_id)
+{
+    GenesisZ80State *s = opaque;
+
+    genesis_z80_schedule(s);
+    return 0;
+}
+
+/* The RAM goes with the device's RAM block */
+static const VMStateDescription genesis_z80_vmstate = {
+    .name = TYPE_GENESIS_Z80,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = genesis_z80_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_STRUCT(cpu, GenesisZ80State, 1, vmstate_z80_cpu, Z80CPU),
+        VMSTATE_BOOL(busreq, GenesisZ80State),
+        VMSTATE_BOOL(reset, GenesisZ80State),
+        VMSTATE_UINT16(bank, GenesisZ80State),
+        VMSTATE_INT64(clock_base, GenesisZ80State),
+        VMSTATE_UINT64(cycles, GenesisZ80State),
+        VMSTATE_UINT64(int_start, GenesisZ80State),
+        VMSTATE_UINT64(int_end, GenesisZ80State),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static void genesis_z80_class_init(ObjectClass *oc, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(oc);
+
+    dc->desc = "Sega Genesis Z80 coprocessor";
+    set_bit(DEVICE_CATEGORY_SOUND, dc->categories);
+    dc->vmsd = &genesis_z80_vmstate;
+    dc->realize = genesis_z80_realize;
+    dc->reset = genesis_z80_reset;
+    device_class_set_props(dc, genesis_z80_properties);
+}
+
+static const TypeInfo genesis_z80_info = {
+    .name = TYPE_GENESIS_Z80,
+    .parent = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(GenesisZ80State),
+    .instance_init = genesis_z80_init,
+    .class_init = genesis_z80_class_init,
+};
+
+static void genesis_z80_register_types(void)
+{
+    type_register_static(&genesis_z80_info);
+}
+
+type_init(genesis_z80_register_types)
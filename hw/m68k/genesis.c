@@ -37,15 +37,18 @@
 #define TYPE_GENESIS_MACHINE MACHINE_TYPE_NAME("sega-genesis")
 OBJECT_DECLARE_SIMPLE_TYPE(GenesisState, GENESIS_MACHINE)
 
-#define ROM_SIZE 0x00400000
+/* 64 banks of 512 KiB through the SSF2 mapper */
+#define ROM_MAX_SIZE 0x02000000
+#define SRAM_BASE 0x00200000
+#define SRAM_END 0x003FFFFF
 #define RAM_SIZE 0x00010000
-#define COPROCESSOR_RAM_SIZE 0x00010000
 #define COPROCESSOR_BUS_SIZE 0x4000
 
 #define IO_BASE 0x00A00000
-#define COPROCESSOR_RAM_BASE IO_BASE
+#define COPROCESSOR_BASE IO_BASE
 #define CONTROLLERS_BASE 0x00A10000
 #define COPROCESSOR_BUS_BASE 0x00A11000
+#define MAPPER_BASE 0x00A130F0
 #define YM7101_BASE 0x00C00000
 #define RAM_BASE 0x00FF0000
 
@@ -58,8 +61,8 @@ typedef struct
 
 typedef struct CoprocessorBus
 {
-    bool bus_request;
-    bool reset;
+    DeviceState *z80;
+    Notifier vint;
 } Coprocessor;
 
 typedef struct IODevices
@@ -75,11 +78,30 @@ struct GenesisState
 
     MemoryRegion io_all;
 
-    MemoryRegion coprocessor_ram;
     MemoryRegion ctrls;
     MemoryRegion coprocessor_bus;
 
     IODevices io_devices;
+    uint64_t mmio_accesses;
+
+    /* Cartridge image, or -kernel */
+    char *cart;
+    /* File the battery SRAM is mapped from, if any */
+    char *sram;
+
+    /* Headless benchmark, see genesis-bench.c */
+    uint32_t bench_frames;
+    char *bench_hash;
+
+    /* Pad input log replayed instead of host input, see genesis-ctrls.c */
+    char *input_script;
+
+    /* Frames of run-ahead, see genesis-runahead.c */
+    uint32_t run_ahead;
+
+    /* Rewind buffer, see genesis-rewind.c */
+    uint32_t rewind_interval;
+    uint32_t rewind_depth;
 };
 
 static void main_cpu_reset(void *opaque)
@@ -150,16 +172,14 @@ static MemTxResult coprocessor_read(void *opaque, hwaddr addr, uint64_t *data,
     Coprocessor *self = &m->io_devices.coprocessor;
 
     DPRINTF("coprocessor_read: %08llx\n", addr);
+    m->mmio_accesses++;
 
     switch (addr)
     {
     case 0x100:
-        val = 0;
-        if (self->bus_request && self->reset)
-        {
-            val = 0x01;
-        }
-        *data = ldub_p(&val);
+        // Bit 0 of the even byte reads 0 once the 68000 owns the Z80 bus
+        val = genesis_z80_bus_granted(self->z80) ? 0x00 : 0x01;
+        *data = size == 2 ? val << 8 : val;
         break;
     default:
         g_assert(!"unhandled coprocessor_read");
@@ -176,6 +196,7 @@ static MemTxResult coprocessor_write(void *opaque, hwaddr addr, uint64_t value,
     Coprocessor *self = &m->io_devices.coprocessor;
 
     DPRINTF("coprocessor_write: %08llx\n", addr);
+    m->mmio_accesses++;
 
     switch (addr)
     {
@@ -183,10 +204,10 @@ static MemTxResult coprocessor_write(void *opaque, hwaddr addr, uint64_t value,
         // ROM vs DRAM mode (not implemented)
         break;
     case 0x100:
-        self->bus_request = (value != 0);
+        genesis_z80_set_busreq(self->z80, value & (size == 2 ? 0x100 : 0x01));
         break;
     case 0x200:
-        self->reset = (value == 0);
+        genesis_z80_set_reset(self->z80, !(value & (size == 2 ? 0x100 : 0x01)));
         break;
     default:
         g_assert(!"unhandled coprocessor_write");
@@ -196,6 +217,13 @@ static MemTxResult coprocessor_write(void *opaque, hwaddr addr, uint64_t value,
     return MEMTX_OK;
 }
 
+static void coprocessor_vint(Notifier *notifier, void *data)
+{
+    Coprocessor *self = container_of(notifier, Coprocessor, vint);
+
+    genesis_z80_vint(self->z80);
+}
+
 static const MemoryRegionOps coprocessor_ops = {
     .read_with_attrs = coprocessor_read,
     .write_with_attrs = coprocessor_write,
@@ -251,21 +279,84 @@ static const TypeInfo genesis_pc_info = {
     .class_init = genesis_pc_class_init,
 };
 
+/*
+ * Map the cartridge straight from its file, read-only, so that every
+ * instance running the same game shares the host page cache.  Images
+ * whose size is not a multiple of the host page can't be mapped and are
+ * copied into a ROM region instead.
+ */
+static void genesis_load_cart(GenesisState *m, const char *path, Error **errp)
+{
+    ERRP_GUARD();
+    int64_t size = get_image_size(path);
+
+    if (size < 8)
+    {
+        error_setg(errp, "Unable to load ROM image '%s'", path);
+        return;
+    }
+    if (size > ROM_MAX_SIZE)
+    {
+        error_setg(errp, "ROM image '%s' is larger than %d MiB", path,
+                   ROM_MAX_SIZE >> 20);
+        return;
+    }
+
+#ifdef CONFIG_POSIX
+    if (QEMU_IS_ALIGNED(size, qemu_real_host_page_size()))
+    {
+        memory_region_init_ram_from_file(&m->rom, NULL, "sega.rom", size, 0,
+                                         RAM_READONLY | RAM_READONLY_FD,
+                                         path, 0, errp);
+        return;
+    }
+#endif
+
+    memory_region_init_rom(&m->rom, NULL, "sega.rom", size, errp);
+    if (*errp)
+    {
+        return;
+    }
+    if (load_image_mr(path, &m->rom) < 0)
+    {
+        error_setg(errp, "Unable to load ROM image '%s'", path);
+    }
+}
+
+// Battery SRAM declared in the cartridge header, 0 if none
+static uint32_t genesis_cart_sram_size(const uint8_t *rom, uint64_t size)
+{
+    uint32_t start, end;
+
+    if (size < 0x1BC || rom[0x1B0] != 'R' || rom[0x1B1] != 'A')
+    {
+        return 0;
+    }
+
+    start = ldl_be_p(rom + 0x1B4);
+    end = ldl_be_p(rom + 0x1B8);
+    if (start < SRAM_BASE || end < start || end > SRAM_END)
+    {
+        warn_report("Ignoring SRAM at 0x%06x-0x%06x in the cartridge header",
+                    start, end);
+        return 0;
+    }
+
+    return (end | 1) + 1 - SRAM_BASE;
+}
+
 static void sega_genesis_init(MachineState *machine)
 {
     GenesisState *m = GENESIS_MACHINE(machine);
     CPUM68KState *env;
     SysBusDevice *sysbus;
     M68kCPU *cpu;
-    ssize_t ret;
     uint8_t *ptr;
-    DeviceState *pcdev, *ym7101;
+    const char *cart = m->cart ? m->cart : machine->kernel_filename;
+    DeviceState *pcdev, *mapper, *ctrls, *z80, *psg, *fm, *ym7101;
     MemoryRegion *sysmem = get_system_memory();
     ResetInfo *reset_info = g_new0(ResetInfo, 1);
 
-    m->io_devices.coprocessor.bus_request = true;
-    m->io_devices.coprocessor.reset = true;
-
     DPRINTF("sega_genesis_init\n");
 
     /* Initialize the cpu core */
@@ -286,8 +377,29 @@ static void sega_genesis_init(MachineState *machine)
     qemu_register_reset(main_cpu_reset, reset_info);
 
     /* ROM */
-    memory_region_init_rom(&m->rom, NULL, "sega.rom", ROM_SIZE, &error_fatal);
-    memory_region_add_subregion(sysmem, 0, &m->rom);
+    if (!cart)
+    {
+        error_report("No cartridge given, use -machine cart=<file> "
+                     "or -kernel <file>");
+        exit(1);
+    }
+    genesis_load_cart(m, cart, &error_fatal);
+    ptr = memory_region_get_ram_ptr(&m->rom);
+
+    /* Cartridge mapper, with the ROM and SRAM behind it */
+    mapper = qdev_new(TYPE_GENESIS_MAPPER);
+    object_property_set_link(OBJECT(mapper), "rom", OBJECT(&m->rom),
+                             &error_abort);
+    qdev_prop_set_uint32(mapper, "sram-size",
+                         genesis_cart_sram_size(ptr,
+                                                memory_region_size(&m->rom)));
+    if (m->sram)
+    {
+        qdev_prop_set_string(mapper, "sram-file", m->sram);
+    }
+    sysbus = SYS_BUS_DEVICE(mapper);
+    sysbus_realize_and_unref(sysbus, &error_fatal);
+    sysbus_mmio_map(sysbus, 0, 0);
 
     /* RAM */
     memory_region_init_ram(&m->ram, NULL, "sega-genesis.ram",
@@ -299,14 +411,31 @@ static void sega_genesis_init(MachineState *machine)
                           "Sega IO", RAM_BASE - IO_BASE);
     memory_region_add_subregion(sysmem, IO_BASE,
                                 &m->io_all);
+    memory_region_add_subregion(&m->io_all, MAPPER_BASE - IO_BASE,
+                                sysbus_mmio_get_region(SYS_BUS_DEVICE(mapper),
+                                                       1));
+
+    /* PSG, written through the VDP and mixed into the FM output */
+    psg = qdev_new(TYPE_SN76489);
+    sysbus_realize_and_unref(SYS_BUS_DEVICE(psg), &error_fatal);
 
-    /* Z80 coprocessor ram*/
-    memory_region_init_ram(&m->coprocessor_ram, NULL, "coprocessor.ram",
-                           COPROCESSOR_RAM_SIZE, &error_fatal);
-    memory_region_add_subregion(&m->io_all, COPROCESSOR_RAM_BASE - IO_BASE, &m->coprocessor_ram);
+    /* FM synthesiser */
+    fm = qdev_new(TYPE_YM2612);
+    if (machine->audiodev)
+    {
+        qdev_prop_set_string(fm, "audiodev", machine->audiodev);
+    }
+    object_property_set_link(OBJECT(fm), "psg", OBJECT(psg), &error_abort);
+    sysbus_realize_and_unref(SYS_BUS_DEVICE(fm), &error_fatal);
 
-    /* Controllers */
-    sysbus_create_simple(TYPE_GENESIS_CTRLS, CONTROLLERS_BASE, NULL);
+    /* Z80 coprocessor, its RAM and the devices it shares with the 68000 */
+    z80 = qdev_new(TYPE_GENESIS_Z80);
+    object_property_set_link(OBJECT(z80), "fm", OBJECT(fm), &error_abort);
+    sysbus = SYS_BUS_DEVICE(z80);
+    sysbus_realize_and_unref(sysbus, &error_fatal);
+    memory_region_add_subregion(&m->io_all, COPROCESSOR_BASE - IO_BASE,
+                                sysbus_mmio_get_region(sysbus, 0));
+    m->io_devices.coprocessor.z80 = z80;
 
     /* Z80 coprocessor */
     memory_region_init_io(&m->coprocessor_bus, NULL, &coprocessor_ops, m,
@@ -318,30 +447,145 @@ static void sega_genesis_init(MachineState *machine)
 
     ym7101 = qdev_new(TYPE_YM7101);
     object_property_set_link(OBJECT(ym7101), "cpu", OBJECT(cpu), &error_abort);
+    object_property_set_link(OBJECT(ym7101), "psg", OBJECT(psg), &error_abort);
     sysbus = SYS_BUS_DEVICE(ym7101);
     sysbus_realize_and_unref(sysbus, &error_fatal);
     sysbus_mmio_map(sysbus, 0, YM7101_BASE);
 
-    // ret = load_image_mr("../test-roms/demo.bin", &m->rom);
-    ret = load_image_targphys("../test-roms/sonic2r.bin", 0, ROM_SIZE);
-
-    if (ret < 0)
+    /* Controllers, scripted from the VDP's frames if asked to */
+    ctrls = qdev_new(TYPE_GENESIS_CTRLS);
+    if (m->input_script)
     {
-        error_report("Unable to load ROM image");
-        exit(1);
+        qdev_prop_set_string(ctrls, "script", m->input_script);
+        object_property_set_link(OBJECT(ctrls), "vdp", OBJECT(ym7101),
+                                 &error_abort);
     }
+    sysbus = SYS_BUS_DEVICE(ctrls);
+    sysbus_realize_and_unref(sysbus, &error_fatal);
+    sysbus_mmio_map(sysbus, 0, CONTROLLERS_BASE);
+
+    m->io_devices.coprocessor.vint.notify = coprocessor_vint;
+    ym7101_add_frame_notifier(ym7101, &m->io_devices.coprocessor.vint);
 
     DPRINTF("cpu->env: %p\n", env);
 
     // /* Initialize CPU registers.  */
-    ptr = rom_ptr(0, ret);
-    assert(ptr != NULL);
-
     reset_info->cpu = cpu;
     reset_info->initial_pc = ldl_p(ptr + 4);
     reset_info->initial_stack = ldl_p(ptr);
 
-    DPRINTF("load_image_targphys %ld\n", ret);
+    DPRINTF("cart %s\n", cart);
+
+    if (m->bench_frames)
+    {
+        genesis_bench_init(ym7101, m->bench_frames, m->bench_hash,
+                           &error_fatal);
+    }
+
+    // Both restore the machine behind the other's back
+    if (m->run_ahead && m->rewind_interval)
+    {
+        error_report("run-ahead and rewind-interval can't be used together");
+        exit(1);
+    }
+
+    if (m->run_ahead)
+    {
+        genesis_runahead_init(OBJECT(machine), ym7101, fm, ctrls,
+                              m->run_ahead, &error_fatal);
+    }
+
+    if (m->rewind_interval)
+    {
+        genesis_rewind_init(ym7101, m->rewind_interval, m->rewind_depth,
+                            &error_fatal);
+    }
+}
+
+static char *genesis_get_cart(Object *obj, Error **errp)
+{
+    return g_strdup(GENESIS_MACHINE(obj)->cart);
+}
+
+static void genesis_set_cart(Object *obj, const char *value, Error **errp)
+{
+    GenesisState *m = GENESIS_MACHINE(obj);
+
+    g_free(m->cart);
+    m->cart = g_strdup(value);
+}
+
+static char *genesis_get_sram(Object *obj, Error **errp)
+{
+    return g_strdup(GENESIS_MACHINE(obj)->sram);
+}
+
+static void genesis_set_sram(Object *obj, const char *value, Error **errp)
+{
+    GenesisState *m = GENESIS_MACHINE(obj);
+
+    g_free(m->sram);
+    m->sram = g_strdup(value);
+}
+
+static char *genesis_get_input_script(Object *obj, Error **errp)
+{
+    return g_strdup(GENESIS_MACHINE(obj)->input_script);
+}
+
+static void genesis_set_input_script(Object *obj, const char *value,
+                                     Error **errp)
+{
+    GenesisState *m = GENESIS_MACHINE(obj);
+
+    g_free(m->input_script);
+    m->input_script = g_strdup(value);
+}
+
+static char *genesis_get_bench_hash(Object *obj, Error **errp)
+{
+    return g_strdup(GENESIS_MACHINE(obj)->bench_hash);
+}
+
+static void genesis_set_bench_hash(Object *obj, const char *value,
+                                   Error **errp)
+{
+    GenesisState *m = GENESIS_MACHINE(obj);
+
+    g_free(m->bench_hash);
+    m->bench_hash = g_strdup(value);
+}
+
+static void sega_genesis_instance_init(Object *obj)
+{
+    GenesisState *m = GENESIS_MACHINE(obj);
+
+    object_property_add_uint64_ptr(obj, "mmio-accesses", &m->mmio_accesses,
+                                   OBJ_PROP_FLAG_READ);
+    object_property_add_uint32_ptr(obj, "bench-frames", &m->bench_frames,
+                                   OBJ_PROP_FLAG_READWRITE);
+    object_property_set_description(obj, "bench-frames",
+                                    "Run this many frames headless, report "
+                                    "timings and quit");
+
+    object_property_add_uint32_ptr(obj, "run-ahead", &m->run_ahead,
+                                   OBJ_PROP_FLAG_READWRITE);
+    object_property_set_description(obj, "run-ahead",
+                                    "Show this many frames ahead of the "
+                                    "pad input (needs -icount)");
+
+    m->rewind_depth = 64;
+    object_property_add_uint32_ptr(obj, "rewind-interval",
+                                   &m->rewind_interval,
+                                   OBJ_PROP_FLAG_READWRITE);
+    object_property_set_description(obj, "rewind-interval",
+                                    "Capture the machine state for "
+                                    "x-genesis-rewind every this many "
+                                    "frames (needs -icount)");
+    object_property_add_uint32_ptr(obj, "rewind-depth", &m->rewind_depth,
+                                   OBJ_PROP_FLAG_READWRITE);
+    object_property_set_description(obj, "rewind-depth",
+                                    "Number of rewind captures kept");
 }
 
 static void sega_genesis_class_init(ObjectClass *oc, void *data)
@@ -352,12 +596,37 @@ static void sega_genesis_class_init(ObjectClass *oc, void *data)
     mc->init = sega_genesis_init;
     mc->default_cpu_type = M68K_CPU_TYPE_NAME("m68000");
     mc->max_cpus = 1;
+    machine_add_audiodev_property(mc);
+
+    object_class_property_add_str(oc, "cart", genesis_get_cart,
+                                  genesis_set_cart);
+    object_class_property_set_description(oc, "cart",
+                                          "Cartridge ROM image (defaults to "
+                                          "-kernel)");
+    object_class_property_add_str(oc, "sram", genesis_get_sram,
+                                  genesis_set_sram);
+    object_class_property_set_description(oc, "sram",
+                                          "File holding the battery-backed "
+                                          "cartridge SRAM");
+
+    object_class_property_add_str(oc, "input-script",
+                                  genesis_get_input_script,
+                                  genesis_set_input_script);
+    object_class_property_set_description(oc, "input-script",
+                                          "Per-frame pad input to replay "
+                                          "instead of host input");
+    object_class_property_add_str(oc, "bench-hash", genesis_get_bench_hash,
+                                  genesis_set_bench_hash);
+    object_class_property_set_description(oc, "bench-hash",
+                                          "File to write a framebuffer hash "
+                                          "per frame to");
 }
 
 static const TypeInfo sega_genesis_typeinfo = {
     .name = TYPE_GENESIS_MACHINE,
     .parent = TYPE_MACHINE,
     .class_init = sega_genesis_class_init,
+    .instance_init = sega_genesis_instance_init,
     .instance_size = sizeof(GenesisState),
 };
 
@@ -0,0 +1,441 @@
+/*
+ * QEMU SN76489 PSG, as built into the Genesis VDP
+ *
+ * Three square wave channels and a noise channel.  Nothing is computed
+ * when the guest writes: the write is queued with its virtual time.  When
+ * the FM chip's audio callback asks for a block, the queued writes are
+ * replayed at the matching points of the block and the channels are
+ * synthesised into it by adding one band-limited step (BLEP) per output
+ * transition to a delta buffer, which is then integrated.  The cost is
+ * proportional to the number of writes and edges, not to the sample
+ * rate, and there is no aliasing from naive square waves.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include <math.h>
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "hw/sysbus.h"
+#include "migration/vmstate.h"
+#include "qom/object.h"
+
+#include "hw/m68k/genesis.h"
+#include "trace.h"
+
+OBJECT_DECLARE_SIMPLE_TYPE(Sn76489State, SN76489)
+
+/* NTSC master clock / 15, counters clocked every 16 cycles */
+#define SN76489_TICK_HZ (3579545 / 16)
+
+#define SN76489_CHANNELS 4
+#define SN76489_NOISE 3
+
+/* Positions within a block are in 1/65536 of an output sample */
+#define POS_SHIFT 16
+
+/* BLEP kernel: taps per step and sub-sample phases */
+#define BLEP_TAPS 16
+#define BLEP_PHASE_BITS 6
+#define BLEP_PHASES (1 << BLEP_PHASE_BITS)
+#define BLEP_SCALE_BITS 15
+
+#define WRITE_FIFO_SIZE 1024
+
+typedef struct
+{
+    int64_t stamp;
+    uint8_t value;
+} Sn76489Write;
+
+struct Sn76489State
+{
+    SysBusDevice sbd;
+
+    /* Tone periods and noise control, and 4-bit attenuations */
+    uint16_t tone[3];
+    uint8_t noise;
+    uint8_t volume[SN76489_CHANNELS];
+    uint8_t latch;
+
+    /* Output state: polarity, and the level each channel contributes */
+    bool high[SN76489_CHANNELS];
+    int32_t level[SN76489_CHANNELS];
+    uint16_t lfsr;
+    /* The noise shifts on every other edge of its counter */
+    bool noise_phase;
+
+    /* Next counter expiry, relative to the start of the next block */
+    uint64_t next[SN76489_CHANNELS];
+
+    Sn76489Write fifo[WRITE_FIFO_SIZE];
+    unsigned fifo_head;
+    unsigned fifo_len;
+
+    /* Integrator and the deltas not yet integrated */
+    int32_t *delta;
+    int delta_size;
+    int32_t acc;
+
+    /* The start of delta, which is all that is live between blocks */
+    int32_t tail[BLEP_TAPS];
+};
+
+/* Tables shared by all instances, built by sn76489_class_init() */
+static int16_t blep_tab[BLEP_PHASES][BLEP_TAPS];
+static int32_t volume_tab[16];
+
+static void sn76489_add_delta(Sn76489State *s, uint64_t pos, int32_t delta)
+{
+    int i = pos >> POS_SHIFT;
+    const int16_t *k = blep_tab[(pos >> (POS_SHIFT - BLEP_PHASE_BITS)) &
+                                (BLEP_PHASES - 1)];
+    int32_t *d = &s->delta[i];
+    int t;
+
+    if (!delta) {
+        return;
+    }
+    for (t = 0; t < BLEP_TAPS; t++) {
+        d[t] += delta * k[t];
+    }
+}
+
+static int32_t sn76489_output(Sn76489State *s, int ch)
+{
+    return s->high[ch] ? volume_tab[s->volume[ch]] : -volume_tab[s->volume[ch]];
+}
+
+/* Bring a channel's output to its current state, with a step at @pos */
+static void sn76489_set_level(Sn76489State *s, int ch, uint64_t pos)
+{
+    int32_t level = sn76489_output(s, ch);
+
+    sn76489_add_delta(s, pos, level - s->level[ch]);
+    s->level[ch] = level;
+}
+
+static uint32_t sn76489_period(Sn76489State *s, int ch)
+{
+    if (ch == SN76489_NOISE) {
+        return (s->noise & 3) == 3 ? MAX(s->tone[2], 1) : 0x10 << (s->noise & 3);
+    }
+    return s->tone[ch];
+}
+
+/* Generate all edges of every channel before @end */
+static void sn76489_run(Sn76489State *s, uint64_t end, uint64_t tick)
+{
+    int ch;
+
+    for (ch = 0; ch < SN76489_CHANNELS; ch++) {
+        uint32_t period = sn76489_period(s, ch);
+
+        /*
+         * A period of 0 or 1 holds the output high; drivers use that with
+         * volume writes to play samples.
+         */
+        if (period <= 1) {
+            if (ch != SN76489_NOISE && !s->high[ch]) {
+                s->high[ch] = true;
+                sn76489_set_level(s, ch, s->next[ch] > end ? end : s->next[ch]);
+            }
+            s->next[ch] = MAX(s->next[ch], end);
+            continue;
+        }
+
+        while (s->next[ch] < end) {
+            if (ch == SN76489_NOISE) {
+                s->noise_phase = !s->noise_phase;
+                if (s->noise_phase) {
+                    bool white = s->noise & 4;
+                    uint16_t fb = (s->lfsr ^ (white ? s->lfsr >> 3 : 0)) & 1;
+
+                    s->lfsr = (s->lfsr >> 1) | (fb << 15);
+                    s->high[ch] = s->lfsr & 1;
+                }
+            } else {
+                s->high[ch] = !s->high[ch];
+            }
+            if (s->level[ch] != sn76489_output(s, ch)) {
+                sn76489_set_level(s, ch, s->next[ch]);
+            }
+            s->next[ch] += period * tick;
+        }
+    }
+}
+
+static void sn76489_apply(Sn76489State *s, uint8_t value, uint64_t pos)
+{
+    int ch;
+
+    if (value & 0x80) {
+        s->latch = value;
+    }
+    ch = (s->latch >> 5) & 3;
+
+    if (s->latch & 0x10) {
+        s->volume[ch] = value & 0x0f;
+        sn76489_set_level(s, ch, pos);
+        return;
+    }
+
+    if (ch == SN76489_NOISE) {
+        s->noise = value & 0x07;
+        s->lfsr = 0x8000;
+        return;
+    }
+
+    if (value & 0x80) {
+        s->tone[ch] = (s->tone[ch] & 0x3f0) | (value & 0x0f);
+    } else {
+        s->tone[ch] = (s->tone[ch] & 0x00f) | ((value & 0x3f) << 4);
+    }
+}
+
+void sn76489_write(DeviceState *dev, uint8_t value)
+{
+    Sn76489State *s = SN76489(dev);
+    Sn76489Write *w;
+
+    trace_sn76489_write(value);
+
+    if (s->fifo_len == WRITE_FIFO_SIZE) {
+        /* The audio side stalled: apply the oldest write now */
+        sn76489_apply(s, s->fifo[s->fifo_head].value, 0);
+        s->fifo_head = (s->fifo_head + 1) % WRITE_FIFO_SIZE;
+        s->fifo_len--;
+    }
+
+    w = &s->fifo[(s->fifo_head + s->fifo_len) % WRITE_FIFO_SIZE];
+    w->stamp = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    w->value = value;
+    s->fifo_len++;
+}
+
+void sn76489_render(DeviceState *dev, int16_t *buf, int samples, int rate,
+                    int64_t start, int64_t end)
+{
+    Sn76489State *s = SN76489(dev);
+    uint64_t tick = ((uint64_t)rate << POS_SHIFT) / SN76489_TICK_HZ;
+    uint64_t block_end = (uint64_t)samples << POS_SHIFT;
+    int i, ch;
+
+    if (samples + BLEP_TAPS > s->delta_size) {
+        s->delta = g_renew(int32_t, s->delta, samples + BLEP_TAPS);
+        memset(s->delta + s->delta_size, 0,
+               (samples + BLEP_TAPS - s->delta_size) * sizeof(int32_t));
+        s->delta_size = samples + BLEP_TAPS;
+    }
+
+    /* Replay the writes that fall in this block where they belong */
+    while (s->fifo_len) {
+        Sn76489Write *w = &s->fifo[s->fifo_head];
+        uint64_t pos = 0;
+
+        if (end > start) {
+            if (w->stamp >= end) {
+                break;
+            }
+            if (w->stamp > start) {
+                pos = muldiv64(w->stamp - start, block_end, end - start);
+            }
+        }
+
+        sn76489_run(s, pos, tick);
+        sn76489_apply(s, w->value, pos);
+        s->fifo_head = (s->fifo_head + 1) % WRITE_FIFO_SIZE;
+        s->fifo_len--;
+    }
+    sn76489_run(s, block_end, tick);
+
+    for (i = 0; i < samples; i++) {
+        int32_t out;
+
+        s->acc += s->delta[i];
+        out = buf[i * 2] + (s->acc >> BLEP_SCALE_BITS);
+        buf[i * 2] = MIN(MAX(out, INT16_MIN), INT16_MAX);
+        out = buf[i * 2 + 1] + (s->acc >> BLEP_SCALE_BITS);
+        buf[i * 2 + 1] = MIN(MAX(out, INT16_MIN), INT16_MAX);
+    }
+
+    /* Keep the kernel tails for the next block */
+    memmove(s->delta, s->delta + samples, BLEP_TAPS * sizeof(int32_t));
+    memset(s->delta + BLEP_TAPS, 0, samples * sizeof(int32_t));
+    for (ch = 0; ch < SN76489_CHANNELS; ch++) {
+        s->next[ch] -= MIN(s->next[ch], block_end);
+    }
+}
+
+static void sn76489_reset(DeviceState *dev)
+{
+    Sn76489State *s = SN76489(dev);
+    int ch;
+
+    memset(s->tone, 0, sizeof(s->tone));
+    s->noise = 0;
+    s->latch = 0;
+    s->lfsr = 0x8000;
+    s->noise_phase = false;
+    s->fifo_head = 0;
+    s->fifo_len = 0;
+    s->acc = 0;
+    memset(s->delta, 0, s->delta_size * sizeof(int32_t));
+    for (ch = 0; ch < SN76489_CHANNELS; ch++) {
+        s->volume[ch] = 0x0f;
+        s->high[ch] = false;
+        s->level[ch] = 0;
+        s->next[ch] = 0;
+    }
+}
+
+static void sn76489_realize(DeviceState *dev, Error **errp)
+{
+    Sn76489State *s = SN76489(dev);
+
+    /* Grown on demand if the backend asks for bigger blocks */
+    s->delta_size = 4096 + BLEP_TAPS;
+    s->delta = g_new0(int32_t, s->delta_size);
+}
+
+static void sn76489_unrealize(DeviceState *dev)
+{
+    Sn76489State *s = SN76489(dev);
+
+    g_free(s->delta);
+}
+
+static int sn76489_pre_save(void *opaque)
+{
+    Sn76489State *s = opaque;
+
+    memcpy(s->tail, s->delta, sizeof(s->tail));
+    return 0;
+}
+
+static int sn76489_post_load(void *opaque, int version_id)
+{
+    Sn76489State *s = opaque;
+
+    if (s->fifo_head >= WRITE_FIFO_SIZE || s->fifo_len > WRITE_FIFO_SIZE) {
+        return -EINVAL;
+    }
+
+    memset(s->delta, 0, s->delta_size * sizeof(int32_t));
+    memcpy(s->delta, s->tail, sizeof(s->tail));
+    return 0;
+}
+
+static const VMStateDescription sn76489_write_vmstate = {
+    .name = "sn76489/write",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_INT64(stamp, Sn76489Write),
+        VMSTATE_UINT8(value, Sn76489Write),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription sn76489_vmstate = {
+    .name = TYPE_SN76489,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .pre_save = sn76489_pre_save,
+    .post_load = sn76489_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT16_ARRAY(tone, Sn76489State, 3),
+        VMSTATE_UINT8(noise, Sn76489State),
+        VMSTATE_UINT8_ARRAY(volume, Sn76489State, SN76489_CHANNELS),
+        VMSTATE_UINT8(latch, Sn76489State),
+        VMSTATE_BOOL_ARRAY(high, Sn76489State, SN76489_CHANNELS),
+        VMSTATE_INT32_ARRAY(level, Sn76489State, SN76489_CHANNELS),
+        VMSTATE_UINT16(lfsr, Sn76489State),
+        VMSTATE_BOOL(noise_phase, Sn76489State),
+        VMSTATE_UINT64_ARRAY(next, Sn76489State, SN76489_CHANNELS),
+        VMSTATE_STRUCT_ARRAY(fifo, Sn76489State, WRITE_FIFO_SIZE, 1,
+                             sn76489_write_vmstate, Sn76489Write),
+        VMSTATE_UINT32(fifo_head, Sn76489State),
+        VMSTATE_UINT32(fifo_len, Sn76489State),
+        VMSTATE_INT32(acc, Sn76489State),
+        VMSTATE_INT32_ARRAY(tail, Sn76489State, BLEP_TAPS),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static void sn76489_class_init(ObjectClass *oc, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(oc);
+    int p, t;
+
+    /* 2 dB per attenuation step, the last one is silence */
+    for (t = 0; t < 15; t++) {
+        volume_tab[t] = lround(2048 * pow(10, -2.0 * t / 20));
+    }
+    volume_tab[15] = 0;
+
+    /*
+     * Blackman-windowed sinc, cut off a little below Nyquist, for each
+     * sub-sample phase.  Every phase sums to exactly 1 << BLEP_SCALE_BITS
+     * so steps integrate to the right height.
+     */
+    for (p = 0; p < BLEP_PHASES; p++) {
+        double h[BLEP_TAPS], sum = 0;
+        int32_t total = 0;
+
+        for (t = 0; t < BLEP_TAPS; t++) {
+            double x = t - BLEP_TAPS / 2 + 1 - (double)p / BLEP_PHASES;
+            double w = 0.42 + 0.5 * cos(M_PI * x / (BLEP_TAPS / 2)) +
+                       0.08 * cos(2 * M_PI * x / (BLEP_TAPS / 2));
+            double c = 0.9;
+
+            h[t] = (x == 0 ? c : sin(M_PI * c * x) / (M_PI * x)) *
+                   (fabs(x) < BLEP_TAPS / 2 ? w : 0);
+            sum += h[t];
+        }
+        for (t = 0; t < BLEP_TAPS; t++) {
+            blep_tab[p][t] = lround(h[t] / sum * (1 << BLEP_SCALE_BITS));
+            total += blep_tab[p][t];
+        }
+        blep_tab[p][BLEP_TAPS / 2 - 1] += (1 << BLEP_SCALE_BITS) - total;
+    }
+
+    dc->desc = "TI SN76489 PSG";
+    set_bit(DEVICE_CATEGORY_SOUND, dc->categories);
+    dc->vmsd = &sn76489_vmstate;
+    dc->realize = sn76489_realize;
+    dc->unrealize = sn76489_unrealize;
+    dc->reset = sn76489_reset;
+}
+
+static const TypeInfo sn76489_info = {
+    .name = TYPE_SN76489,
+    .parent = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(Sn76489State),
+    .class_init = sn76489_class_init,
+};
+
+static void sn76489_register_types(void)
+{
+    type_register_static(&sn76489_info);
+}
+
+type_init(sn76489_register_types)
@@ -0,0 +1 @@
+#include "trace/trace-hw_m68k.h"
@@ -0,0 +1,924 @@
+/*
+ * QEMU YM2612 (OPN2) FM synthesiser
+ *
+ * Six channels of four operators.  Register writes take effect at once;
+ * sound is produced in blocks, from the audio callback, for as many
+ * samples as the backend asks for.  Operator state is kept as
+ * [operator][channel] arrays so that the per-sample loops run across the
+ * six channels with no per-channel branches: the algorithm, feedback,
+ * panning and LFO sensitivity of each channel are turned into masks when
+ * their registers are written.
+ *
+ * The DAC (channel 6 replacement) is streamed by the Z80 at up to tens of
+ * kHz, far finer than a block, so DAC writes are timestamped in virtual
+ * time and replayed at the matching point of the next block.  The PSG
+ * does the same with its own writes and is mixed into this chip's voice.
+ *
+ * Not emulated: SSG-EG, CSM mode, the busy flag and the ladder effect.
+ * LFO phase modulation is a triangle approximation of the real table.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include <math.h>
+#include "qemu/log.h"
+#include "qemu/timer.h"
+#include "qemu/host-utils.h"
+#include "qapi/error.h"
+#include "hw/sysbus.h"
+#include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
+#include "audio/audio.h"
+#include "qom/object.h"
+
+#include "hw/m68k/genesis.h"
+#include "trace.h"
+
+OBJECT_DECLARE_SIMPLE_TYPE(Ym2612State, YM2612)
+
+/* NTSC master clock / 7, one sample every 144 clocks */
+#define YM2612_CLOCK_HZ 7670453
+#define YM2612_SAMPLE_CLOCKS 144
+#define YM2612_RATE (YM2612_CLOCK_HZ / YM2612_SAMPLE_CLOCKS)
+
+#define YM2612_CHANNELS 6
+#define YM2612_OPERATORS 4
+
+/* Envelope attenuation, 10 bits, 0 is loudest */
+#define ENV_BITS 10
+#define ENV_MAX ((1 << ENV_BITS) - 1)
+
+enum {
+    EG_ATTACK,
+    EG_DECAY,
+    EG_SUSTAIN,
+    EG_RELEASE,
+    EG_PHASES,
+};
+
+#define DAC_FIFO_SIZE 1024
+
+/* Status bits */
+#define STATUS_TIMER_A 0x01
+#define STATUS_TIMER_B 0x02
+
+/* Register 0x27 */
+#define TIMER_LOAD_A 0x01
+#define TIMER_LOAD_B 0x02
+#define TIMER_ENABLE_A 0x04
+#define TIMER_ENABLE_B 0x08
+#define TIMER_RESET_A 0x10
+#define TIMER_RESET_B 0x20
+#define CH3_MODE_MASK 0xc0
+
+typedef struct
+{
+    /* Operators in S1..S4 order, not register order */
+    uint32_t phase[YM2612_OPERATORS][YM2612_CHANNELS];
+    uint32_t phase_inc[YM2612_OPERATORS][YM2612_CHANNELS];
+    int32_t out[YM2612_OPERATORS][YM2612_CHANNELS];
+    int32_t env[YM2612_OPERATORS][YM2612_CHANNELS];
+    int32_t tl[YM2612_OPERATORS][YM2612_CHANNELS];
+    int32_t sl[YM2612_OPERATORS][YM2612_CHANNELS];
+    int32_t am_mask[YM2612_OPERATORS][YM2612_CHANNELS];
+    uint8_t eg_phase[YM2612_OPERATORS][YM2612_CHANNELS];
+    /* Effective rate 0-63 for each envelope phase, key scaling included */
+    uint8_t rate[EG_PHASES][YM2612_OPERATORS][YM2612_CHANNELS];
+
+    /* Which earlier operators modulate each operator, 0 or -1 */
+    int32_t conn[YM2612_OPERATORS][YM2612_OPERATORS - 1][YM2612_CHANNELS];
+    /* Which operators reach the output, 0 or -1 */
+    int32_t carrier[YM2612_OPERATORS][YM2612_CHANNELS];
+
+    /* S1 self-feedback: its last two outputs */
+    int32_t fb_prev[2][YM2612_CHANNELS];
+    int32_t fb_shift[YM2612_CHANNELS];
+    int32_t fb_mask[YM2612_CHANNELS];
+
+    int32_t ams_shift[YM2612_CHANNELS];
+    int32_t left[YM2612_CHANNELS];
+    int32_t right[YM2612_CHANNELS];
+} Ym2612Operators;
+
+typedef struct
+{
+    int64_t stamp;
+    uint8_t value;
+} Ym2612DacWrite;
+
+struct Ym2612State
+{
+    SysBusDevice sbd;
+
+    QEMUSoundCard card;
+    SWVoiceOut *voice;
+    DeviceState *psg;
+    int16_t *mixbuf;
+    int samples;
+
+    /* Register file, part I and part II */
+    uint8_t regs[2][0x100];
+    uint8_t addr[2];
+
+    /* Per channel pitch, and channel 3's per-operator pitch */
+    uint16_t fnum[YM2612_CHANNELS];
+    uint8_t block[YM2612_CHANNELS];
+    uint16_t ch3_fnum[3];
+    uint8_t ch3_block[3];
+    uint8_t key[YM2612_CHANNELS];
+
+    Ym2612Operators op;
+
+    uint32_t eg_counter;
+    uint8_t eg_div;
+
+    uint32_t lfo_count;
+    uint8_t lfo_step;
+
+    uint8_t dac;
+    bool dac_enable;
+    Ym2612DacWrite dac_fifo[DAC_FIFO_SIZE];
+    unsigned dac_head;
+    unsigned dac_len;
+
+    /* Virtual time, in ns, that rendering has reached, and may not pass */
+    int64_t render_ns;
+    int64_t render_limit;
+
+    /* Timers run on virtual time: loaded at *_start, flags in status */
+    uint8_t status;
+    uint64_t timer_a_start;
+    uint64_t timer_b_start;
+};
+
+/* Tables shared by all instances, built by ym2612_class_init() */
+static uint16_t logsin_tab[256];
+static uint16_t exp_tab[256];
+
+/*
+ * Envelope increments, eight steps per row.  Rates 0-47 use rows 0-3,
+ * then every four rates use the next four rows, up to row 16.
+ */
+static const uint8_t eg_inc_tab[19][8] = {
+    { 0, 1, 0, 1, 0, 1, 0, 1 },
+    { 0, 1, 0, 1, 1, 1, 0, 1 },
+    { 0, 1, 1, 1, 0, 1, 1, 1 },
+    { 0, 1, 1, 1, 1, 1, 1, 1 },
+    { 1, 1, 1, 1, 1, 1, 1, 1 },
+    { 1, 1, 1, 2, 1, 1, 1, 2 },
+    { 1, 2, 1, 2, 1, 2, 1, 2 },
+    { 1, 2, 2, 2, 1, 2, 2, 2 },
+    { 2, 2, 2, 2, 2, 2, 2, 2 },
+    { 2, 2, 2, 4, 2, 2, 2, 4 },
+    { 2, 4, 2, 4, 2, 4, 2, 4 },
+    { 2, 4, 4, 4, 2, 4, 4, 4 },
+    { 4, 4, 4, 4, 4, 4, 4, 4 },
+    { 4, 4, 4, 8, 4, 4, 4, 8 },
+    { 4, 8, 4, 8, 4, 8, 4, 8 },
+    { 4, 8, 8, 8, 4, 8, 8, 8 },
+    { 8, 8, 8, 8, 8, 8, 8, 8 },
+    { 16, 16, 16, 16, 16, 16, 16, 16 },
+    { 0, 0, 0, 0, 0, 0, 0, 0 },
+};
+
+static const uint8_t dt_tab[4][32] = {
+    { 0 },
+    { 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2,
+      2, 3, 3, 3, 4, 4, 4, 5, 5, 6, 6, 7, 8, 8, 8, 8 },
+    { 1, 1, 1, 1, 2, 2, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5,
+      5, 6, 6, 7, 8, 8, 9, 10, 11, 12, 13, 14, 16, 16, 16, 16 },
+    { 2, 2, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5, 5, 6, 6, 7,
+      8, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 20, 22, 22, 22, 22 },
+};
+
+/* Samples per LFO step for each frequency setting */
+static const uint8_t lfo_period_tab[8] = { 108, 77, 71, 67, 62, 44, 8, 5 };
+
+/* AM depth as a right shift of the 0-126 triangle */
+static const uint8_t ams_shift_tab[4] = { 8, 3, 1, 0 };
+
+/* PM depth, in 1/1024 of F-number at the triangle's peak of 32 */
+static const uint8_t pm_depth_tab[8] = { 0, 2, 4, 6, 8, 12, 24, 47 };
+
+/*
+ * Modulators of S2, S3 and S4 for each algorithm, as bit masks over
+ * S1..S3, and the operators that are carriers.
+ */
+static const uint8_t alg_conn_tab[8][YM2612_OPERATORS] = {
+    { 0, 0x1, 0x2, 0x4 },
+    { 0, 0, 0x3, 0x4 },
+    { 0, 0, 0x2, 0x5 },
+    { 0, 0x1, 0, 0x6 },
+    { 0, 0x1, 0, 0x4 },
+    { 0, 0x1, 0x1, 0x1 },
+    { 0, 0x1, 0, 0 },
+    { 0, 0, 0, 0 },
+};
+
+static const uint8_t alg_carrier_tab[8] = {
+    0x8, 0x8, 0x8, 0x8, 0xa, 0xe, 0xe, 0xf,
+};
+
+/* Register order within a channel is S1, S3, S2, S4 */
+static const uint8_t slot_tab[4] = { 0, 2, 1, 3 };
+static const uint8_t slot_offset_tab[YM2612_OPERATORS] = { 0x0, 0x8, 0x4, 0xc };
+
+static uint64_t ym2612_clock(void)
+{
+    return muldiv64(qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL), YM2612_CLOCK_HZ,
+                    NANOSECONDS_PER_SECOND) / YM2612_SAMPLE_CLOCKS;
+}
+
+/* Timers */
+
+static void ym2612_update_timers(Ym2612State *s)
+{
+    uint8_t ctrl = s->regs[0][0x27];
+    uint64_t now = ym2612_clock();
+    uint64_t period, n;
+
+    if (ctrl & TIMER_LOAD_A) {
+        period = 1024 - ((s->regs[0][0x24] << 2) | (s->regs[0][0x25] & 3));
+        n = (now - s->timer_a_start) / period;
+        if (n) {
+            s->timer_a_start += n * period;
+            if (ctrl & TIMER_ENABLE_A) {
+                s->status |= STATUS_TIMER_A;
+            }
+        }
+    }
+
+    if (ctrl & TIMER_LOAD_B) {
+        period = (256 - s->regs[0][0x26]) * 16;
+        n = (now - s->timer_b_start) / period;
+        if (n) {
+            s->timer_b_start += n * period;
+            if (ctrl & TIMER_ENABLE_B) {
+                s->status |= STATUS_TIMER_B;
+            }
+        }
+    }
+}
+
+static void ym2612_write_timer_ctrl(Ym2612State *s, uint8_t value)
+{
+    uint8_t old = s->regs[0][0x27];
+    uint64_t now = ym2612_clock();
+
+    ym2612_update_timers(s);
+
+    if ((value & TIMER_LOAD_A) && !(old & TIMER_LOAD_A)) {
+        s->timer_a_start = now;
+    }
+    if ((value & TIMER_LOAD_B) && !(old & TIMER_LOAD_B)) {
+        s->timer_b_start = now;
+    }
+    if (value & TIMER_RESET_A) {
+        s->status &= ~STATUS_TIMER_A;
+    }
+    if (value & TIMER_RESET_B) {
+        s->status &= ~STATUS_TIMER_B;
+    }
+}
+
+/* Derived operator state */
+
+static uint8_t key_code(uint16_t fnum, uint8_t block)
+{
+    uint8_t n4 = (fnum >> 10) & 1;
+    uint8_t f10 = (fnum >> 9) & 1;
+    uint8_t f9 = (fnum >> 8) & 1;
+    uint8_t f8 = (fnum >> 7) & 1;
+    uint8_t n3 = (n4 & (f10 | f9 | f8)) | ((n4 ^ 1) & f10 & f9 & f8);
+
+    return (block << 2) | (n4 << 1) | n3;
+}
+
+static uint8_t effective_rate(uint8_t rate, uint8_t rks)
+{
+    return rate ? MIN(rate * 2 + rks, 63) : 0;
+}
+
+static void ym2612_update_operator(Ym2612State *s, int ch, int op)
+{
+    Ym2612Operators *o = &s->op;
+    int part = ch / 3;
+    int base = (ch % 3) + slot_offset_tab[op];
+    uint8_t *r = s->regs[part];
+    uint8_t dt_mul = r[0x30 + base];
+    uint8_t ks_ar = r[0x50 + base];
+    uint8_t am_d1r = r[0x60 + base];
+    uint8_t d2r = r[0x70 + base];
+    uint8_t sl_rr = r[0x80 + base];
+    uint16_t fnum = s->fnum[ch];
+    uint8_t block = s->block[ch];
+    uint8_t kc, rks, mul, dt;
+    uint32_t inc;
+    int32_t lfo_pm;
+
+    if (ch == 2 && (s->regs[0][0x27] & CH3_MODE_MASK) && op < 3) {
+        fnum = s->ch3_fnum[op];
+        block = s->ch3_block[op];
+    }
+
+    /* Vibrato */
+    if ((s->regs[0][0x22] & 0x08) && (r[0xb4 + ch % 3] & 0x07)) {
+        int t = s->lfo_step;
+
+        lfo_pm = t < 32 ? t : t < 96 ? 64 - t : t - 128;
+        fnum += ((fnum >> 1) * pm_depth_tab[r[0xb4 + ch % 3] & 7] *
+                 lfo_pm) >> 14;
+        fnum &= 0x7ff;
+    }
+
+    kc = key_code(fnum, block);
+    rks = kc >> (3 - (ks_ar >> 6));
+    mul = dt_mul & 0x0f;
+    dt = (dt_mul >> 4) & 7;
+
+    inc = (fnum << block) >> 1;
+    if (dt & 4) {
+        inc -= dt_tab[dt & 3][kc];
+    } else {
+        inc += dt_tab[dt & 3][kc];
+    }
+    inc &= 0x1ffff;
+    o->phase_inc[op][ch] = mul ? inc * mul : inc >> 1;
+
+    o->tl[op][ch] = (r[0x40 + base] & 0x7f) << 3;
+    o->sl[op][ch] = (sl_rr >> 4) == 15 ? ENV_MAX : (sl_rr >> 4) << 5;
+    o->am_mask[op][ch] = (am_d1r & 0x80) ? -1 : 0;
+
+    o->rate[EG_ATTACK][op][ch] = effective_rate(ks_ar & 0x1f, rks);
+    o->rate[EG_DECAY][op][ch] = effective_rate(am_d1r & 0x1f, rks);
+    o->rate[EG_SUSTAIN][op][ch] = effective_rate(d2r & 0x1f, rks);
+    o->rate[EG_RELEASE][op][ch] = effective_rate(((sl_rr & 0x0f) << 1) | 1,
+                                                 rks);
+}
+
+static void ym2612_update_channel(Ym2612State *s, int ch)
+{
+    Ym2612Operators *o = &s->op;
+    uint8_t *r = s->regs[ch / 3];
+    uint8_t fb_alg = r[0xb0 + ch % 3];
+    uint8_t pan = r[0xb4 + ch % 3];
+    int alg = fb_alg & 7;
+    int fb = (fb_alg >> 3) & 7;
+    int op, src;
+
+    for (op = 0; op < YM2612_OPERATORS; op++) {
+        for (src = 0; src < YM2612_OPERATORS - 1; src++) {
+            o->conn[op][src][ch] = (alg_conn_tab[alg][op] >> src) & 1 ? -1 : 0;
+        }
+        o->carrier[op][ch] = (alg_carrier_tab[alg] >> op) & 1 ? -1 : 0;
+        ym2612_update_operator(s, ch, op);
+    }
+
+    o->fb_shift[ch] = fb ? 10 - fb : 0;
+    o->fb_mask[ch] = fb ? -1 : 0;
+    o->ams_shift[ch] = ams_shift_tab[(pan >> 4) & 3];
+    o->left[ch] = (pan & 0x80) ? -1 : 0;
+    o->right[ch] = (pan & 0x40) ? -1 : 0;
+}
+
+static void ym2612_key(Ym2612State *s, uint8_t value)
+{
+    Ym2612Operators *o = &s->op;
+    int ch = value & 3;
+    int op;
+
+    if (ch == 3) {
+        return;
+    }
+    if (value & 4) {
+        ch += 3;
+    }
+
+    for (op = 0; op < YM2612_OPERATORS; op++) {
+        bool on = value & (0x10 << op);
+        bool was = s->key[ch] & (1 << op);
+
+        if (on && !was) {
+            o->phase[op][ch] = 0;
+            o->eg_phase[op][ch] = EG_ATTACK;
+            if (o->rate[EG_ATTACK][op][ch] >= 62) {
+                o->env[op][ch] = 0;
+                o->eg_phase[op][ch] = EG_DECAY;
+            }
+        } else if (!on && was) {
+            o->eg_phase[op][ch] = EG_RELEASE;
+        }
+    }
+
+    s->key[ch] = value >> 4;
+}
+
+static void ym2612_dac_write(Ym2612State *s, uint8_t value)
+{
+    Ym2612DacWrite *w;
+
+    if (s->dac_len == DAC_FIFO_SIZE) {
+        /* The audio side stalled: play the oldest value now */
+        s->dac = s->dac_fifo[s->dac_head].value;
+        s->dac_head = (s->dac_head + 1) % DAC_FIFO_SIZE;
+        s->dac_len--;
+    }
+
+    w = &s->dac_fifo[(s->dac_head + s->dac_len) % DAC_FIFO_SIZE];
+    w->stamp = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    w->value = value;
+    s->dac_len++;
+}
+
+static void ym2612_write_reg(Ym2612State *s, int part, uint8_t reg,
+                             uint8_t value)
+{
+    int ch = (reg & 3) + part * 3;
+
+    trace_ym2612_write(part, reg, value);
+
+    if (reg < 0x30) {
+        if (part) {
+            return;
+        }
+        switch (reg) {
+        case 0x27:
+            ym2612_write_timer_ctrl(s, value);
+            s->regs[0][reg] = value;
+            ym2612_update_channel(s, 2);
+            return;
+        case 0x28:
+            ym2612_key(s, value);
+            return;
+        case 0x2a:
+            ym2612_dac_write(s, value);
+            return;
+        case 0x2b:
+            s->dac_enable = value & 0x80;
+            break;
+        case 0x22:
+            s->regs[0][reg] = value;
+            for (ch = 0; ch < YM2612_CHANNELS; ch++) {
+                ym2612_update_channel(s, ch);
+            }
+            return;
+        case 0x24:
+        case 0x25:
+        case 0x26:
+            ym2612_update_timers(s);
+            break;
+        }
+        s->regs[0][reg] = value;
+        return;
+    }
+
+    s->regs[part][reg] = value;
+
+    if ((reg & 3) == 3) {
+        return;
+    }
+
+    if (reg < 0xa0) {
+        ym2612_update_operator(s, ch, slot_tab[(reg >> 2) & 3]);
+        return;
+    }
+
+    switch (reg & 0xfc) {
+    case 0xa0:
+        s->fnum[ch] = ((s->regs[part][0xa4 + (reg & 3)] & 7) << 8) | value;
+        s->block[ch] = (s->regs[part][0xa4 + (reg & 3)] >> 3) & 7;
+        break;
+    case 0xa8:
+        if (part) {
+            return;
+        }
+        /* A8, A9 and AA set S3, S1 and S2 of channel 3 */
+        ch = reg & 3;
+        ch = ch == 0 ? 2 : ch - 1;
+        s->ch3_fnum[ch] = ((s->regs[0][0xac + (reg & 3)] & 7) << 8) | value;
+        s->ch3_block[ch] = (s->regs[0][0xac + (reg & 3)] >> 3) & 7;
+        ch = 2;
+        break;
+    case 0xa4:
+    case 0xac:
+        /* Latched until the low byte is written */
+        return;
+    }
+
+    ym2612_update_channel(s, ch);
+}
+
+/* Synthesis */
+
+static inline int32_t op_output(uint32_t phase, int32_t level)
+{
+    uint32_t p = phase & 0x3ff;
+    uint32_t att = logsin_tab[(p & 0x100) ? (~p & 0xff) : (p & 0xff)] +
+                   (level << 2);
+    int32_t out;
+
+    if (att >= 13 << 8) {
+        return 0;
+    }
+    out = exp_tab[att & 0xff] >> (att >> 8);
+    return (p & 0x200) ? -out : out;
+}
+
+static void ym2612_envelope(Ym2612State *s)
+{
+    Ym2612Operators *o = &s->op;
+    int op, ch;
+
+    s->eg_counter++;
+
+    for (op = 0; op < YM2612_OPERATORS; op++) {
+        for (ch = 0; ch < YM2612_CHANNELS; ch++) {
+            int phase = o->eg_phase[op][ch];
+            int rate = o->rate[phase][op][ch];
+            int shift = rate < 48 ? 11 - (rate >> 2) : 0;
+            int row, inc;
+
+            if (s->eg_counter & ((1 << shift) - 1)) {
+                continue;
+            }
+
+            row = rate < 2 ? 18 : rate < 48 ? (rate & 3) : 4 + (rate - 48);
+            row = MIN(row, 16);
+            inc = eg_inc_tab[row][(s->eg_counter >> shift) & 7];
+
+            switch (phase) {
+            case EG_ATTACK:
+                if (rate >= 62) {
+                    o->env[op][ch] = 0;
+                } else {
+                    o->env[op][ch] += (~o->env[op][ch] * inc) >> 4;
+                }
+                if (o->env[op][ch] <= 0) {
+                    o->env[op][ch] = 0;
+                    o->eg_phase[op][ch] = EG_DECAY;
+                }
+                break;
+            case EG_DECAY:
+                o->env[op][ch] += inc;
+                if (o->env[op][ch] >= o->sl[op][ch]) {
+                    o->eg_phase[op][ch] = EG_SUSTAIN;
+                }
+                break;
+            default:
+                o->env[op][ch] = MIN(o->env[op][ch] + inc, ENV_MAX);
+                break;
+            }
+        }
+    }
+}
+
+static void ym2612_lfo(Ym2612State *s)
+{
+    uint8_t lfo = s->regs[0][0x22];
+    int ch;
+
+    if (!(lfo & 0x08)) {
+        s->lfo_step = 0;
+        return;
+    }
+    if (++s->lfo_count < lfo_period_tab[lfo & 7]) {
+        return;
+    }
+    s->lfo_count = 0;
+    s->lfo_step = (s->lfo_step + 1) & 127;
+
+    /* Vibrato moves the pitch, which only a few channels use */
+    for (ch = 0; ch < YM2612_CHANNELS; ch++) {
+        if (s->regs[ch / 3][0xb4 + ch % 3] & 0x07) {
+            int op;
+
+            for (op = 0; op < YM2612_OPERATORS; op++) {
+                ym2612_update_operator(s, ch, op);
+            }
+        }
+    }
+}
+
+static void ym2612_render(Ym2612State *s, int16_t *buf, int samples,
+                          int64_t start, int64_t end)
+{
+    Ym2612Operators *o = &s->op;
+    int i, op, ch;
+
+    for (i = 0; i < samples; i++) {
+        int32_t chan[YM2612_CHANNELS];
+        int32_t left = 0, right = 0;
+        int32_t am;
+
+        /* DAC writes due by this point of the block */
+        while (s->dac_len) {
+            Ym2612DacWrite *w = &s->dac_fifo[s->dac_head];
+
+            if (end > start && w->stamp > start &&
+                (uint64_t)(w->stamp - start) * samples > (uint64_t)i * (end - start)) {
+                break;
+            }
+            s->dac = w->value;
+            s->dac_head = (s->dac_head + 1) % DAC_FIFO_SIZE;
+            s->dac_len--;
+        }
+
+        ym2612_lfo(s);
+        am = s->lfo_step < 64 ? s->lfo_step * 2 : (127 - s->lfo_step) * 2;
+
+        if (++s->eg_div == 3) {
+            s->eg_div = 0;
+            ym2612_envelope(s);
+        }
+
+        for (op = 0; op < YM2612_OPERATORS; op++) {
+            for (ch = 0; ch < YM2612_CHANNELS; ch++) {
+                int32_t mod, level;
+
+                if (op == 0) {
+                    mod = ((o->fb_prev[0][ch] + o->fb_prev[1][ch]) >>
+                           o->fb_shift[ch]) & o->fb_mask[ch];
+                } else {
+                    mod = ((o->out[0][ch] & o->conn[op][0][ch]) +
+                           (o->out[1][ch] & o->conn[op][1][ch]) +
+                           (o->out[2][ch] & o->conn[op][2][ch])) >> 1;
+                }
+
+                level = o->env[op][ch] + o->tl[op][ch] +
+                        ((am >> o->ams_shift[ch]) & o->am_mask[op][ch]);
+                level = MIN(level, ENV_MAX);
+
+                o->phase[op][ch] += o->phase_inc[op][ch];
+                o->out[op][ch] = op_output((o->phase[op][ch] >> 10) + mod,
+                                           level);
+            }
+        }
+
+        for (ch = 0; ch < YM2612_CHANNELS; ch++) {
+            int32_t sum = (o->out[0][ch] & o->carrier[0][ch]) +
+                          (o->out[1][ch] & o->carrier[1][ch]) +
+                          (o->out[2][ch] & o->carrier[2][ch]) +
+                          (o->out[3][ch] & o->carrier[3][ch]);
+
+            chan[ch] = MIN(MAX(sum, -8192), 8191);
+            o->fb_prev[1][ch] = o->fb_prev[0][ch];
+            o->fb_prev[0][ch] = o->out[0][ch];
+        }
+
+        if (s->dac_enable) {
+            chan[5] = (s->dac - 128) << 6;
+        }
+
+        for (ch = 0; ch < YM2612_CHANNELS; ch++) {
+            left += chan[ch] & o->left[ch];
+            right += chan[ch] & o->right[ch];
+        }
+
+        buf[i * 2] = left >> 1;
+        buf[i * 2 + 1] = right >> 1;
+    }
+}
+
+static void ym2612_out_cb(void *opaque, int free_b)
+{
+    Ym2612State *s = opaque;
+    int samples = MIN(s->samples, free_b >> 2);
+    int64_t start = s->render_ns;
+    int64_t end = MAX(MIN(qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL),
+                          s->render_limit), start);
+
+    if (!samples) {
+        return;
+    }
+
+    ym2612_render(s, s->mixbuf, samples, start, end);
+    if (s->psg) {
+        sn76489_render(s->psg, s->mixbuf, samples, YM2612_RATE, start, end);
+    }
+    s->render_ns = end;
+    AUD_write(s->voice, s->mixbuf, samples << 2);
+}
+
+void ym2612_set_render_limit(DeviceState *dev, int64_t limit_ns)
+{
+    YM2612(dev)->render_limit = limit_ns;
+}
+
+/* Bus interface, shared by the 68000 and the Z80 */
+
+uint8_t ym2612_read(DeviceState *dev, unsigned addr)
+{
+    Ym2612State *s = YM2612(dev);
+
+    ym2612_update_timers(s);
+    return s->status;
+}
+
+void ym2612_write(DeviceState *dev, unsigned addr, uint8_t value)
+{
+    Ym2612State *s = YM2612(dev);
+    int part = (addr >> 1) & 1;
+
+    if (!(addr & 1)) {
+        s->addr[part] = value;
+        return;
+    }
+
+    ym2612_write_reg(s, part, s->addr[part], value);
+}
+
+static void ym2612_reset(DeviceState *dev)
+{
+    Ym2612State *s = YM2612(dev);
+    int ch, op;
+
+    memset(s->regs, 0, sizeof(s->regs));
+    memset(s->addr, 0, sizeof(s->addr));
+    memset(s->fnum, 0, sizeof(s->fnum));
+    memset(s->block, 0, sizeof(s->block));
+    memset(s->ch3_fnum, 0, sizeof(s->ch3_fnum));
+    memset(s->ch3_block, 0, sizeof(s->ch3_block));
+    memset(s->key, 0, sizeof(s->key));
+    memset(&s->op, 0, sizeof(s->op));
+    s->eg_counter = 0;
+    s->eg_div = 0;
+    s->lfo_count = 0;
+    s->lfo_step = 0;
+    s->dac = 0x80;
+    s->dac_enable = false;
+    s->dac_head = 0;
+    s->dac_len = 0;
+    s->status = 0;
+    s->render_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    /* Panning defaults to both sides */
+    for (ch = 0; ch < YM2612_CHANNELS; ch++) {
+        s->regs[ch / 3][0xb4 + ch % 3] = 0xc0;
+        for (op = 0; op < YM2612_OPERATORS; op++) {
+            s->op.env[op][ch] = ENV_MAX;
+            s->op.eg_phase[op][ch] = EG_RELEASE;
+        }
+        ym2612_update_channel(s, ch);
+    }
+
+    AUD_set_active_out(s->voice, 1);
+}
+
+static void ym2612_realize(DeviceState *dev, Error **errp)
+{
+    Ym2612State *s = YM2612(dev);
+    struct audsettings as;
+
+    if (!AUD_register_card("YM2612", &s->card, errp)) {
+        return;
+    }
+
+    as.freq = YM2612_RATE;
+    as.nchannels = 2;
+    as.fmt = AUDIO_FORMAT_S16;
+    as.endianness = AUDIO_HOST_ENDIANNESS;
+
+    s->voice = AUD_open_out(&s->card, s->voice, "ym2612.out", s,
+                            ym2612_out_cb, &as);
+    if (!s->voice) {
+        error_setg(errp, "ym2612: could not open the audio output");
+        AUD_remove_card(&s->card);
+        return;
+    }
+    s->samples = AUD_get_buffer_size_out(s->voice) >> 2;
+    s->mixbuf = g_new0(int16_t, s->samples * 2);
+    s->render_limit = INT64_MAX;
+}
+
+static void ym2612_unrealize(DeviceState *dev)
+{
+    Ym2612State *s = YM2612(dev);
+
+    g_free(s->mixbuf);
+    AUD_remove_card(&s->card);
+}
+
+static int ym2612_post_load(void *opaque, int version_id)
+{
+    Ym2612State *s = opaque;
+    int ch;
+
+    if (s->dac_head >= DAC_FIFO_SIZE || s->dac_len > DAC_FIFO_SIZE) {
+        return -EINVAL;
+    }
+
+    /* Everything derived from the registers is rebuilt, not migrated */
+    for (ch = 0; ch < YM2612_CHANNELS; ch++) {
+        ym2612_update_channel(s, ch);
+    }
+    return 0;
+}
+
+static const VMStateDescription ym2612_dac_write_vmstate = {
+    .name = "ym2612/dac-write",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_INT64(stamp, Ym2612DacWrite),
+        VMSTATE_UINT8(value, Ym2612DacWrite),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+#define VMSTATE_YM2612_OPS(_f, _info, _type)                          \
+    VMSTATE_2DARRAY(op._f, Ym2612State, YM2612_OPERATORS,             \
+                    YM2612_CHANNELS, 0, _info, _type)
+
+static const VMStateDescription ym2612_vmstate = {
+    .name = TYPE_YM2612,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = ym2612_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT8_2DARRAY(regs, Ym2612State, 2, 0x100),
+        VMSTATE_UINT8_ARRAY(addr, Ym2612State, 2),
+        VMSTATE_UINT16_ARRAY(fnum, Ym2612State, YM2612_CHANNELS),
+        VMSTATE_UINT8_ARRAY(block, Ym2612State, YM2612_CHANNELS),
+        VMSTATE_UINT16_ARRAY(ch3_fnum, Ym2612State, 3),
+        VMSTATE_UINT8_ARRAY(ch3_block, Ym2612State, 3),
+        VMSTATE_UINT8_ARRAY(key, Ym2612State, YM2612_CHANNELS),
+        VMSTATE_YM2612_OPS(phase, vmstate_info_uint32, uint32_t),
+        VMSTATE_YM2612_OPS(out, vmstate_info_int32, int32_t),
+        VMSTATE_YM2612_OPS(env, vmstate_info_int32, int32_t),
+        VMSTATE_YM2612_OPS(eg_phase, vmstate_info_uint8, uint8_t),
+        VMSTATE_2DARRAY(op.fb_prev, Ym2612State, 2, YM2612_CHANNELS, 0,
+                        vmstate_info_int32, int32_t),
+        VMSTATE_UINT32(eg_counter, Ym2612State),
+        VMSTATE_UINT8(eg_div, Ym2612State),
+        VMSTATE_UINT32(lfo_count, Ym2612State),
+        VMSTATE_UINT8(lfo_step, Ym2612State),
+        VMSTATE_UINT8(dac, Ym2612State),
+        VMSTATE_BOOL(dac_enable, Ym2612State),
+        VMSTATE_STRUCT_ARRAY(dac_fifo, Ym2612State, DAC_FIFO_SIZE, 1,
+                             ym2612_dac_write_vmstate, Ym2612DacWrite),
+        VMSTATE_UINT32(dac_head, Ym2612State),
+        VMSTATE_UINT32(dac_len, Ym2612State),
+        VMSTATE_INT64(render_ns, Ym2612State),
+        VMSTATE_UINT8(status, Ym2612State),
+        VMSTATE_UINT64(timer_a_start, Ym2612State),
+        VMSTATE_UINT64(timer_b_start, Ym2612State),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property ym2612_properties[] = {
+    DEFINE_AUDIO_PROPERTIES(Ym2612State, card),
+    DEFINE_PROP_LINK("psg", Ym2612State, psg, TYPE_SN76489, DeviceState *),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void ym2612_class_init(ObjectClass *oc, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(oc);
+    int i;
+
+    /* -log2(sin) over a quarter wave, and 2^-x, both in 1/256 steps */
+    for (i = 0; i < 256; i++) {
+        logsin_tab[i] = lround(-log2(sin((2 * i + 1) * M_PI / 1024)) * 256);
+        exp_tab[i] = lround(8191 * pow(2, -i / 256.0));
+    }
+
+    dc->desc = "Yamaha YM2612 FM synthesiser";
+    set_bit(DEVICE_CATEGORY_SOUND, dc->categories);
+    dc->vmsd = &ym2612_vmstate;
+    dc->realize = ym2612_realize;
+    dc->unrealize = ym2612_unrealize;
+    dc->reset = ym2612_reset;
+    device_class_set_props(dc, ym2612_properties);
+}
+
+static const TypeInfo ym2612_info = {
+    .name = TYPE_YM2612,
+    .parent = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(Ym2612State),
+    .class_init = ym2612_class_init,
+};
+
+static void ym2612_register_types(void)
+{
+    type_register_static(&ym2612_info);
+}
+
+type_init(ym2612_register_types)
@@ -0,0 +1,298 @@
+/*
+ * QEMU YM7101 Emulator - layer compositor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Priority between the layers is the same for every pixel:
+ *
+ *   high sprite > high A > high B > low sprite > low A > low B > backdrop
+ *
+ * where "high" is the priority bit of the name table entry or sprite and
+ * only opaque pixels take part.  Rather than walking that list for every
+ * pixel, each implementation builds opaque and priority masks for a run
+ * of pixels and lays the layers over the backdrop from the bottom of the
+ * list to the top, each one selected by its mask.
+ *
+ * In shadow/highlight mode a pixel is shadowed unless plane A or B has
+ * its priority bit set there (opaque or not), or a high priority sprite
+ * is on top.  Sprite colors 0x3E and 0x3F do not draw: they brighten or
+ * shadow what is below instead, as long as they are not hidden behind a
+ * high priority plane.
+ */
+
+#include "qemu/osdep.h"
+#include "host/cpuinfo.h"
+
+#include "ym7101-compose.h"
+
+void ym7101_compose_line_scalar(uint8_t *out, const uint8_t *sprites,
+                                const uint8_t *plane_a,
+                                const uint8_t *plane_b,
+                                uint8_t backdrop, bool shadow_highlight,
+                                int width)
+{
+    uint8_t sh = shadow_highlight ? 0xFF : 0;
+    int x;
+
+    for (x = 0; x < width; x++) {
+        uint8_t s = sprites[x];
+        uint8_t a = plane_a[x];
+        uint8_t b = plane_b[x];
+        /* All ones where the condition holds */
+        uint8_t o_s = -(uint8_t)PIXEL_OPAQUE(s);
+        uint8_t o_a = -(uint8_t)PIXEL_OPAQUE(a);
+        uint8_t o_b = -(uint8_t)PIXEL_OPAQUE(b);
+        uint8_t p_s = -(uint8_t)(s >> 7);
+        uint8_t p_a = -(uint8_t)(a >> 7);
+        uint8_t p_b = -(uint8_t)(b >> 7);
+        uint8_t light_op = sh & -(uint8_t)((s & PIXEL_COLOR_MASK) ==
+                                           PIXEL_HIGHLIGHT_OP);
+        uint8_t shadow_op = sh & -(uint8_t)((s & PIXEL_COLOR_MASK) ==
+                                            PIXEL_SHADOW_OP);
+        uint8_t h_s, h_a, h_b, shadow, light, visible;
+        uint8_t r = backdrop;
+
+        o_s &= ~(light_op | shadow_op);
+        h_s = o_s & p_s;
+        h_a = o_a & p_a;
+        h_b = o_b & p_b;
+
+        r = (r & ~o_b) | (b & o_b);
+        r = (r & ~o_a) | (a & o_a);
+        r = (r & ~o_s) | (s & o_s);
+        r = (r & ~h_b) | (b & h_b);
+        r = (r & ~h_a) | (a & h_a);
+        r = (r & ~h_s) | (s & h_s);
+        r &= PIXEL_COLOR_MASK;
+
+        visible = p_s | ~(h_a | h_b);
+        light_op &= visible;
+        shadow_op &= visible;
+        shadow = sh & ~(p_a | p_b | h_s);
+        light = light_op & ~shadow;
+        shadow = (shadow & ~light_op) | shadow_op;
+
+        out[x] = r | (shadow & PIXEL_SHADOW) | (light & PIXEL_HIGHLIGHT);
+    }
+}
+
+#if defined(CONFIG_AVX2_OPT) || defined(__SSE2__)
+#include <immintrin.h>
+
+static void __attribute__((target("sse2")))
+compose_sse2(uint8_t *out, const uint8_t *sprites, const uint8_t *plane_a,
+             const uint8_t *plane_b, uint8_t backdrop, bool shadow_highlight,
+             int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i color = _mm_set1_epi8(PIXEL_COLOR_MASK);
+    const __m128i light_color = _mm_set1_epi8(PIXEL_HIGHLIGHT_OP);
+    const __m128i shadow_color = _mm_set1_epi8(PIXEL_SHADOW_OP);
+    const __m128i shadow_bit = _mm_set1_epi8(PIXEL_SHADOW);
+    const __m128i light_bit = _mm_set1_epi8((char)PIXEL_HIGHLIGHT);
+    const __m128i sh = _mm_set1_epi8(shadow_highlight ? -1 : 0);
+    const __m128i bd = _mm_set1_epi8(backdrop);
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(sprites + x));
+        __m128i a = _mm_loadu_si128((const __m128i *)(plane_a + x));
+        __m128i b = _mm_loadu_si128((const __m128i *)(plane_b + x));
+        /* Transparent and high priority masks */
+        __m128i t_s = _mm_cmpeq_epi8(_mm_and_si128(s, nibble), zero);
+        __m128i t_a = _mm_cmpeq_epi8(_mm_and_si128(a, nibble), zero);
+        __m128i t_b = _mm_cmpeq_epi8(_mm_and_si128(b, nibble), zero);
+        __m128i p_s = _mm_cmplt_epi8(s, zero);
+        __m128i p_a = _mm_cmplt_epi8(a, zero);
+        __m128i p_b = _mm_cmplt_epi8(b, zero);
+        __m128i s_color = _mm_and_si128(s, color);
+        __m128i light_op = _mm_and_si128(sh, _mm_cmpeq_epi8(s_color,
+                                                            light_color));
+        __m128i shadow_op = _mm_and_si128(sh, _mm_cmpeq_epi8(s_color,
+                                                             shadow_color));
+        __m128i h_s, h_a, h_b, shadow, light, visible;
+        __m128i r = bd;
+
+        t_s = _mm_or_si128(t_s, _mm_or_si128(light_op, shadow_op));
+        h_s = _mm_andnot_si128(t_s, p_s);
+        h_a = _mm_andnot_si128(t_a, p_a);
+        h_b = _mm_andnot_si128(t_b, p_b);
+
+        r = _mm_or_si128(_mm_and_si128(r, t_b), _mm_andnot_si128(t_b, b));
+        r = _mm_or_si128(_mm_and_si128(r, t_a), _mm_andnot_si128(t_a, a));
+        r = _mm_or_si128(_mm_and_si128(r, t_s), _mm_andnot_si128(t_s, s));
+        r = _mm_or_si128(_mm_andnot_si128(h_b, r), _mm_and_si128(h_b, b));
+        r = _mm_or_si128(_mm_andnot_si128(h_a, r), _mm_and_si128(h_a, a));
+        r = _mm_or_si128(_mm_andnot_si128(h_s, r), _mm_and_si128(h_s, s));
+        r = _mm_and_si128(r, color);
+
+        visible = _mm_or_si128(p_s, _mm_andnot_si128(_mm_or_si128(h_a, h_b),
+                                                     sh));
+        light_op = _mm_and_si128(light_op, visible);
+        shadow_op = _mm_and_si128(shadow_op, visible);
+        shadow = _mm_andnot_si128(_mm_or_si128(_mm_or_si128(p_a, p_b), h_s),
+                                  sh);
+        light = _mm_andnot_si128(shadow, light_op);
+        shadow = _mm_or_si128(_mm_andnot_si128(light_op, shadow), shadow_op);
+
+        r = _mm_or_si128(r, _mm_and_si128(shadow, shadow_bit));
+        r = _mm_or_si128(r, _mm_and_si128(light, light_bit));
+        _mm_storeu_si128((__m128i *)(out + x), r);
+    }
+
+    ym7101_compose_line_scalar(out + x, sprites + x, plane_a + x, plane_b + x,
+                               backdrop, shadow_highlight, width - x);
+}
+
+#ifdef CONFIG_AVX2_OPT
+static void __attribute__((target("avx2")))
+compose_avx2(uint8_t *out, const uint8_t *sprites, const uint8_t *plane_a,
+             const uint8_t *plane_b, uint8_t backdrop, bool shadow_highlight,
+             int width)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i color = _mm256_set1_epi8(PIXEL_COLOR_MASK);
+    const __m256i light_color = _mm256_set1_epi8(PIXEL_HIGHLIGHT_OP);
+    const __m256i shadow_color = _mm256_set1_epi8(PIXEL_SHADOW_OP);
+    const __m256i shadow_bit = _mm256_set1_epi8(PIXEL_SHADOW);
+    const __m256i light_bit = _mm256_set1_epi8((char)PIXEL_HIGHLIGHT);
+    const __m256i sh = _mm256_set1_epi8(shadow_highlight ? -1 : 0);
+    const __m256i bd = _mm256_set1_epi8(backdrop);
+    int x;
+
+    for (x = 0; x + 32 <= width; x += 32) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(sprites + x));
+        __m256i a = _mm256_loadu_si256((const __m256i *)(plane_a + x));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(plane_b + x));
+        /* Opaque, transparent and high priority masks */
+        __m256i t_s = _mm256_cmpeq_epi8(_mm256_and_si256(s, nibble), zero);
+        __m256i t_a = _mm256_cmpeq_epi8(_mm256_and_si256(a, nibble), zero);
+        __m256i t_b = _mm256_cmpeq_epi8(_mm256_and_si256(b, nibble), zero);
+        __m256i p_s = _mm256_cmpgt_epi8(zero, s);
+        __m256i p_a = _mm256_cmpgt_epi8(zero, a);
+        __m256i p_b = _mm256_cmpgt_epi8(zero, b);
+        __m256i s_color = _mm256_and_si256(s, color);
+        __m256i light_op = _mm256_and_si256(sh,
+                               _mm256_cmpeq_epi8(s_color, light_color));
+        __m256i shadow_op = _mm256_and_si256(sh,
+                                _mm256_cmpeq_epi8(s_color, shadow_color));
+        __m256i h_s, h_a, h_b, shadow, light, visible;
+        __m256i r = bd;
+
+        t_s = _mm256_or_si256(t_s, _mm256_or_si256(light_op, shadow_op));
+        h_s = _mm256_andnot_si256(t_s, p_s);
+        h_a = _mm256_andnot_si256(t_a, p_a);
+        h_b = _mm256_andnot_si256(t_b, p_b);
+
+        r = _mm256_blendv_epi8(b, r, t_b);
+        r = _mm256_blendv_epi8(a, r, t_a);
+        r = _mm256_blendv_epi8(s, r, t_s);
+        r = _mm256_blendv_epi8(r, b, h_b);
+        r = _mm256_blendv_epi8(r, a, h_a);
+        r = _mm256_blendv_epi8(r, s, h_s);
+        r = _mm256_and_si256(r, color);
+
+        visible = _mm256_or_si256(p_s,
+                      _mm256_andnot_si256(_mm256_or_si256(h_a, h_b), sh));
+        light_op = _mm256_and_si256(light_op, visible);
+        shadow_op = _mm256_and_si256(shadow_op, visible);
+        shadow = _mm256_andnot_si256(
+                     _mm256_or_si256(_mm256_or_si256(p_a, p_b), h_s), sh);
+        light = _mm256_andnot_si256(shadow, light_op);
+        shadow = _mm256_or_si256(_mm256_andnot_si256(light_op, shadow),
+                                 shadow_op);
+
+        r = _mm256_or_si256(r, _mm256_and_si256(shadow, shadow_bit));
+        r = _mm256_or_si256(r, _mm256_and_si256(light, light_bit));
+        _mm256_storeu_si256((__m256i *)(out + x), r);
+    }
+
+    compose_sse2(out + x, sprites + x, plane_a + x, plane_b + x,
+                 backdrop, shadow_highlight, width - x);
+}
+#endif
+
+static unsigned used_accel = CPUINFO_SSE2;
+static Ym7101ComposeFn *compose_accel = compose_sse2;
+
+static unsigned select_accel_cpuinfo(unsigned info)
+{
+    /* Array is sorted in order of algorithm preference. */
+    static const struct {
+        unsigned bit;
+        Ym7101ComposeFn *fn;
+    } all[] = {
+#ifdef CONFIG_AVX2_OPT
+        { CPUINFO_AVX2, compose_avx2 },
+#endif
+        { CPUINFO_SSE2, compose_sse2 },
+        { CPUINFO_ALWAYS, ym7101_compose_line_scalar },
+    };
+
+    for (unsigned i = 0; i < ARRAY_SIZE(all); ++i) {
+        if (info & all[i].bit) {
+            compose_accel = all[i].fn;
+            return all[i].bit;
+        }
+    }
+    return 0;
+}
+
+#ifdef CONFIG_AVX2_OPT
+static void __attribute__((constructor)) init_accel(void)
+{
+    used_accel = select_accel_cpuinfo(cpuinfo_init());
+}
+#endif
+
+bool test_ym7101_compose_next_accel(void)
+{
+    unsigned used = select_accel_cpuinfo(cpuinfo & ~used_accel);
+
+    used_accel |= used;
+    return used;
+}
+
+void ym7101_compose_line(uint8_t *out, const uint8_t *sprites,
+                         const uint8_t *plane_a, const uint8_t *plane_b,
+                         uint8_t backdrop, bool shadow_highlight, int width)
+{
+    compose_accel(out, sprites, plane_a, plane_b, backdrop,
+                  shadow_highlight, width);
+}
+
+#else
+
+bool test_ym7101_compose_next_accel(void)
+{
+    return false;
+}
+
+void ym7101_compose_line(uint8_t *out, const uint8_t *sprites,
+                         const uint8_t *plane_a, const uint8_t *plane_b,
+                         uint8_t backdrop, bool shadow_highlight, int width)
+{
+    ym7101_compose_line_scalar(out, sprites, plane_a, plane_b, backdrop,
+                               shadow_highlight, width);
+}
+#endif
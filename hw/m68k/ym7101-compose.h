@@ -0,0 +1,72 @@
+/*
+ * QEMU YM7101 Emulator - layer compositor
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef HW_M68K_YM7101_COMPOSE_H
+#define HW_M68K_YM7101_COMPOSE_H
+
+/*
+ * Layer pixels are palette indices (0-63) with the tile priority
+ * folded into bit 7.  A low nibble of zero is transparent.
+ */
+#define PIXEL_PRIORITY 0x80
+#define PIXEL_COLOR_MASK 0x3F
+#define PIXEL_OPAQUE(p) (((p) & 0x0F) != 0)
+
+/*
+ * Composed pixels are palette indices with the shadow/highlight state
+ * in the top bits, ready to index a 192 entry host palette.
+ */
+#define PIXEL_SHADOW 0x40
+#define PIXEL_HIGHLIGHT 0x80
+
+/* Sprite colors that shade what is below them in shadow/highlight mode */
+#define PIXEL_HIGHLIGHT_OP 0x3E
+#define PIXEL_SHADOW_OP 0x3F
+
+/*
+ * Resolve sprites, plane A (or the window) and plane B of one line into
+ * composed pixels.  The backdrop is a palette index.
+ */
+typedef void Ym7101ComposeFn(uint8_t *out, const uint8_t *sprites,
+                             const uint8_t *plane_a, const uint8_t *plane_b,
+                             uint8_t backdrop, bool shadow_highlight,
+                             int width);
+
+/* Uses the fastest implementation the host supports */
+void ym7101_compose_line(uint8_t *out, const uint8_t *sprites,
+                         const uint8_t *plane_a, const uint8_t *plane_b,
+                         uint8_t backdrop, bool shadow_highlight, int width);
+
+/* Reference implementation, for testing */
+void ym7101_compose_line_scalar(uint8_t *out, const uint8_t *sprites,
+                                const uint8_t *plane_a,
+                                const uint8_t *plane_b,
+                                uint8_t backdrop, bool shadow_highlight,
+                                int width);
+
+/*
+ * Switch ym7101_compose_line() to the next slower implementation.
+ * Returns false once none is left.
+ */
+bool test_ym7101_compose_next_accel(void);
+
+#endif /* HW_M68K_YM7101_COMPOSE_H */
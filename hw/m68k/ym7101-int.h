@@ -0,0 +1,256 @@
+/*
+ * QEMU YM7101 Emulator - internal definitions
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef HW_M68K_YM7101_INT_H
+#define HW_M68K_YM7101_INT_H
+
+#include "hw/sysbus.h"
+#include "ui/console.h"
+#include "qemu/timer.h"
+#include "qemu/bitmap.h"
+#include "target/m68k/cpu.h"
+#include "qom/object.h"
+#include "hw/m68k/genesis.h"
+#include "ym7101-compose.h"
+
+OBJECT_DECLARE_SIMPLE_TYPE(Ym7101State, YM7101)
+
+#define PAL_MODE 0x0001
+#define DMA_BUSY 0x0002
+#define IN_HBLANK 0x0004
+#define IN_VBLANK 0x0008
+#define ODD_FRAME 0x0010
+#define SPRITE_COLLISIO 0x0020
+#define SPRITE_OVERFLOW 0x0040
+#define V_INTERRUPT 0x0080
+#define FIFO_FULL 0x0100
+#define FIFO_EMPTY 0x0200
+
+#define MODE1_HINT_ENABLE 0x10
+#define MODE1_BLANK_LEFT 0x20
+
+#define MODE2_V30 0x08
+#define MODE2_DMA_ENABLE 0x10
+#define MODE2_VINT_ENABLE 0x20
+#define MODE2_DISPLAY_ENABLE 0x40
+
+#define MODE3_VSCROLL_CELLS 0x04
+#define MODE3_HSCROLL_MASK 0x03
+
+#define MODE4_H40 0x81
+#define MODE4_INTERLACE 0x06
+#define MODE4_SHADOW_HIGHLIGHT 0x08
+
+#define MEMORY_VRAM 0x01
+#define MEMORY_CRAM 0x02
+#define MEMORY_VSRAM 0x03
+
+#define VRAM_SIZE 0x10000
+#define CRAM_SIZE 128
+#define VSRAM_SIZE 80
+
+/* VRAM seen as 8x8 4bpp tiles */
+#define VRAM_TILE_SIZE 32
+#define VRAM_TILES (VRAM_SIZE / VRAM_TILE_SIZE)
+
+/* Registers 0x00-0x12 are the ones that shape the picture */
+#define YM7101_DISPLAY_REGS 0x13
+#define YM7101_REGS 0x18
+
+/* Sprite limits in H40; H32 allows 64 per frame and 16 per line */
+#define YM7101_MAX_SPRITES 80
+#define YM7101_MAX_LINE_SPRITES 20
+
+/* Largest active display: 320x240 (H40, V30) */
+#define YM7101_MAX_WIDTH 320
+#define YM7101_MAX_HEIGHT 240
+
+typedef struct
+{
+    uint8_t vram[VRAM_SIZE];
+    uint8_t cram[CRAM_SIZE];
+    uint8_t vsram[VSRAM_SIZE];
+
+    /*
+     * Changes since the renderer last looked: one bit per VRAM tile and
+     * per CRAM entry.  Writes that store the value already there are
+     * not flagged.
+     */
+    DECLARE_BITMAP(vram_dirty, VRAM_TILES);
+    DECLARE_BITMAP(cram_dirty, CRAM_SIZE / 2);
+    bool vsram_dirty;
+
+    uint8_t transfer_type;
+    uint8_t transfer_bits;
+    uint32_t transfer_count;
+    uint32_t transfer_remain;
+    uint32_t transfer_src_addr;
+    uint32_t transfer_dest_addr;
+    uint32_t transfer_auto_inc;
+    uint16_t transfer_fill_word;
+    uint8_t transfer_run;
+    uint8_t transfer_target;
+    bool transfer_dma_busy;
+
+    uint16_t ctrl_port_buffer;
+    bool ctrl_port_set;
+} Memory;
+
+typedef struct
+{
+    uint16_t status;
+    Memory memory;
+
+    /* Register file as written; the fields below are decoded from it */
+    uint8_t regs[YM7101_REGS];
+
+    uint8_t mode_1;
+    uint8_t mode_2;
+    uint8_t mode_3;
+    uint8_t mode_4;
+
+    uint8_t h_int_lines;
+    size_t screen_size[2];
+    size_t scroll_size[2];
+    size_t window_pos[2][2];
+    uint8_t window_values[2];
+    uint8_t background;
+    size_t scroll_a_addr;
+    size_t scroll_b_addr;
+    size_t window_addr;
+    size_t sprites_addr;
+    size_t hscroll_addr;
+
+    // last_clock: ClockTime,
+    // p_clock: u32,
+    // h_clock: u32,
+    // v_clock: u32,
+    uint8_t h_scanlines;
+
+    int32_t current_x;
+    int32_t current_y;
+
+    /* Frame timing, advanced by ym7101_run_until() */
+    int64_t frame_start;
+    int32_t hint_line;
+    bool vint_done;
+    bool vint_pending;
+    bool hint_pending;
+
+    /* Fill and copy report DMA_BUSY until then */
+    int64_t dma_end;
+} State;
+
+/* Host side renderer state, never seen by the guest */
+typedef struct
+{
+    /*
+     * CRAM converted to host pixels, normal, shadowed and highlighted,
+     * indexed by composed pixel.  All refreshed when palette_dirty.
+     */
+    uint32_t palette[256];
+    bool palette_dirty;
+
+    /* Picture registers as last written, to spot real changes */
+    uint8_t regs[YM7101_DISPLAY_REGS];
+
+    /* Sprite coverage must be recomputed even without SAT writes */
+    bool rescan;
+
+    /* Geometry of the current surface */
+    int width;
+    int height;
+
+    /* Next line of the current frame to be drawn */
+    int next_line;
+
+    /* Lines whose inputs changed since they were last drawn */
+    DECLARE_BITMAP(line_dirty, YM7101_MAX_HEIGHT);
+
+    /* Lines drawn since the last ym7101_render_flush() */
+    DECLARE_BITMAP(line_updated, YM7101_MAX_HEIGHT);
+
+    /* Lines covered by sprites when the SAT was last examined */
+    DECLARE_BITMAP(sprite_lines, YM7101_MAX_HEIGHT);
+
+    /*
+     * The sprite link list as of the last SAT change: the sprites walked
+     * in link order, and per line the ones drawn there.  Lines with more
+     * sprites than the hardware draws have SPRITE_OVERFLOW in
+     * sprite_flags.
+     */
+    uint8_t sprite_order[YM7101_MAX_SPRITES];
+    int sprite_total;
+    uint8_t sprite_count[YM7101_MAX_HEIGHT];
+    uint8_t sprite_flags[YM7101_MAX_HEIGHT];
+    uint8_t sprite_list[YM7101_MAX_HEIGHT][YM7101_MAX_LINE_SPRITES];
+
+    /* The sprites layer buffer is all transparent */
+    bool sprites_clear;
+
+    /* Sprite overflow/collision raised by each line when last drawn */
+    uint8_t line_status[YM7101_MAX_HEIGHT];
+
+    /*
+     * Decoded tiles, one byte (color index 0-15) per pixel, unflipped and
+     * horizontally flipped.  Filled on first use, dropped when the tile's
+     * vram_dirty bit is collected.
+     */
+    uint8_t tiles[2][VRAM_TILES][8][8];
+    DECLARE_BITMAP(tile_valid[2], VRAM_TILES);
+
+    /* Per-line layer buffers, indexed by screen x */
+    uint8_t plane_a[YM7101_MAX_WIDTH];
+    uint8_t plane_b[YM7101_MAX_WIDTH];
+    uint8_t sprites[YM7101_MAX_WIDTH];
+    uint8_t composed[YM7101_MAX_WIDTH];
+} Ym7101Renderer;
+
+struct Ym7101State
+{
+    SysBusDevice sbd;
+    MemoryRegion mr;
+    QemuConsole *con;
+    QEMUTimer *timer;
+    QEMUTimer *dma_timer;
+    bool dma_stall;
+    State state;
+    M68kCPU *cpu;
+    DeviceState *psg;
+
+    /* Told at the start of each vertical blank */
+    NotifierList frame_notifiers;
+    /* Drawn lines are not shown while run-ahead replays frames */
+    bool display_held;
+    uint64_t mmio_accesses;
+
+    Ym7101Renderer render;
+};
+
+/* ym7101-render.c */
+void ym7101_render_invalidate(Ym7101State *s);
+void ym7101_render_register(Ym7101State *s, uint8_t reg, uint8_t value);
+void ym7101_render_begin_frame(Ym7101State *s);
+void ym7101_render_lines(Ym7101State *s, int last);
+void ym7101_render_flush(Ym7101State *s);
+
+#endif /* HW_M68K_YM7101_INT_H */
@@ -0,0 +1,731 @@
+/*
+ * QEMU YM7101 Emulator - scanline renderer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Every line is built in three passes: plane B, plane A (or the window)
+ * and the sprites are expanded into 8-bit layer buffers, the layers are
+ * composed (see ym7101-compose.c), and the result goes through the
+ * palette straight into the display surface.
+ *
+ * Name table fetches work a whole cell at a time.  Tiles are decoded on
+ * first use into a cache of one byte per pixel, with the horizontally
+ * flipped copy made only when an entry asks for it; vertical flips just
+ * pick the rows in reverse.  A cell row is then a single 8-byte load with
+ * the palette and priority bits or'ed into every pixel.
+ *
+ * Lines are only redrawn when something they show has changed.  The
+ * write paths in ym7101.c flag modified VRAM tiles and CRAM entries;
+ * before drawing, collect_dirty() maps those onto the name table rows,
+ * scroll table entries and sprites that use them, and from there onto
+ * screen lines.  A line drawn before a change is redrawn the next frame.
+ * The same tile flags drop the stale entries from the tile cache.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/bswap.h"
+#include "ui/console.h"
+#include "ui/pixel_ops.h"
+
+#include "ym7101-int.h"
+
+#define TILE_SIZE 32
+#define TILE_ROW_SIZE 4
+
+#define ENTRY_PRIORITY 0x8000
+#define ENTRY_VFLIP 0x1000
+#define ENTRY_HFLIP 0x0800
+#define ENTRY_TILE_MASK 0x07FF
+
+#define MAX_PLANE_ROWS 128
+#define WINDOW_ROWS 32
+
+static const uint8_t color_levels[8] = {
+    0, 36, 73, 109, 146, 182, 219, 255
+};
+
+static inline bool is_h40(const State *st)
+{
+    return (st->mode_4 & MODE4_H40) != 0;
+}
+
+static inline uint16_t vram_word(const Memory *m, uint32_t addr)
+{
+    return lduw_be_p(&m->vram[addr & (VRAM_SIZE - 2)]);
+}
+
+static void decode_tile(const Memory *m, int tile, bool hflip,
+                        uint8_t (*out)[8])
+{
+    const uint8_t *src = &m->vram[tile * TILE_SIZE];
+    int row, i;
+
+    for (row = 0; row < 8; row++) {
+        uint32_t bits = ldl_be_p(src + row * TILE_ROW_SIZE);
+
+        for (i = 0; i < 8; i++) {
+            int shift = hflip ? i * 4 : 28 - i * 4;
+
+            out[row][i] = (bits >> shift) & 0x0F;
+        }
+    }
+}
+
+/* One row of a name table entry's cell, as eight layer pixels */
+static inline uint64_t cell_row(Ym7101Renderer *r, const Memory *m,
+                                uint16_t entry, int row)
+{
+    int tile = entry & ENTRY_TILE_MASK;
+    int flip = (entry & ENTRY_HFLIP) ? 1 : 0;
+    uint8_t attr = ((entry >> 9) & 0x30) |
+                   ((entry & ENTRY_PRIORITY) ? PIXEL_PRIORITY : 0);
+
+    if (!test_bit(tile, r->tile_valid[flip])) {
+        decode_tile(m, tile, flip, r->tiles[flip][tile]);
+        set_bit(tile, r->tile_valid[flip]);
+    }
+    if (entry & ENTRY_VFLIP) {
+        row = 7 - row;
+    }
+
+    return ldq_he_p(r->tiles[flip][tile][row]) |
+           (attr * 0x0101010101010101ULL);
+}
+
+/* Store columns [offset, offset + n) of a cell row at out */
+static inline void put_cell_row(uint8_t *out, uint64_t pixels,
+                                int offset, int n)
+{
+    uint8_t buf[8];
+
+    if (n == 8) {
+        stq_he_p(out, pixels);
+    } else {
+        stq_he_p(buf, pixels);
+        memcpy(out, buf + offset, n);
+    }
+}
+
+static inline size_t scroll_cells(size_t size)
+{
+    /* Registers are zero until the guest programs them */
+    return size ? size : 32;
+}
+
+static int hscroll_value(const State *st, int line, int plane)
+{
+    uint32_t addr = st->hscroll_addr;
+
+    switch (st->mode_3 & MODE3_HSCROLL_MASK) {
+    case 0: /* full screen */
+        break;
+    case 1: /* first eight lines repeated */
+        addr += (line & 7) * 4;
+        break;
+    case 2: /* per cell */
+        addr += (line & ~7) * 4;
+        break;
+    case 3: /* per line */
+        addr += line * 4;
+        break;
+    }
+
+    return vram_word(&st->memory, addr + plane * 2) & 0x3FF;
+}
+
+static int vscroll_value(const State *st, int x, int plane)
+{
+    int index = plane;
+
+    if ((st->mode_3 & MODE3_VSCROLL_CELLS) && x >= 0) {
+        index = (x / 16) * 2 + plane;
+        if (index * 2 >= VSRAM_SIZE) {
+            index = plane;
+        }
+    }
+
+    return lduw_be_p(&st->memory.vsram[index * 2]) & 0x7FF;
+}
+
+/* Expand columns [x_start, x_end) of a scrolling plane for one line */
+static void render_plane(Ym7101State *s, uint8_t *out, uint32_t nt_addr,
+                         int plane, int line, int x_start, int x_end)
+{
+    const State *st = &s->state;
+    size_t w_cells = scroll_cells(st->scroll_size[0]);
+    size_t h_cells = scroll_cells(st->scroll_size[1]);
+    uint32_t w_mask = w_cells * 8 - 1;
+    uint32_t h_mask = h_cells * 8 - 1;
+    int hscroll = hscroll_value(st, line, plane);
+    int x = x_start;
+
+    while (x < x_end) {
+        uint32_t px = (x - hscroll) & w_mask;
+        uint32_t py = (line + vscroll_value(st, x, plane)) & h_mask;
+        int offset = px & 7;
+        int n = MIN(8 - offset, x_end - x);
+        uint16_t entry;
+
+        entry = vram_word(&st->memory,
+                          nt_addr + ((py >> 3) * w_cells + (px >> 3)) * 2);
+        put_cell_row(out + x, cell_row(&s->render, &st->memory, entry, py & 7),
+                     offset, n);
+        x += n;
+    }
+}
+
+/* Expand columns [x_start, x_end) of the window for one line */
+static void render_window(Ym7101State *s, uint8_t *out, int line,
+                          int x_start, int x_end)
+{
+    const State *st = &s->state;
+    size_t w_cells = is_h40(st) ? 64 : 32;
+    uint32_t row_addr = st->window_addr + (line >> 3) * w_cells * 2;
+    int x = x_start;
+
+    while (x < x_end) {
+        int offset = x & 7;
+        int n = MIN(8 - offset, x_end - x);
+        uint16_t entry = vram_word(&st->memory, row_addr + (x >> 3) * 2);
+        uint64_t pixels = cell_row(&s->render, &st->memory, entry, line & 7);
+
+        put_cell_row(out + x, pixels, offset, n);
+        x += n;
+    }
+}
+
+/* Columns covered by the window on this line, as [start, end) */
+static void window_span(const State *st, int line, int width,
+                        int *start, int *end)
+{
+    uint8_t h = st->window_values[0];
+    uint8_t v = st->window_values[1];
+    int v_edge = (v & 0x1F) * 8;
+    int h_edge = MIN((h & 0x1F) * 16, width);
+    bool in_rows = (v & 0x80) ? line >= v_edge : line < v_edge;
+
+    if (in_rows) {
+        *start = 0;
+        *end = width;
+    } else if (h & 0x80) {
+        *start = h_edge;
+        *end = width;
+    } else {
+        *start = 0;
+        *end = h_edge;
+    }
+}
+
+static inline uint32_t sprite_table(const State *st)
+{
+    return st->sprites_addr & (is_h40(st) ? 0xFC00 : 0xFE00);
+}
+
+/* Returns the SPRITE_OVERFLOW/SPRITE_COLLISIO flags raised by the line */
+static uint8_t render_sprites(Ym7101State *s, int line, int width)
+{
+    State *st = &s->state;
+    Ym7101Renderer *r = &s->render;
+    uint8_t *out = r->sprites;
+    uint32_t table = sprite_table(st);
+    uint8_t flags = r->sprite_flags[line];
+    int n;
+
+    if (!r->sprite_count[line]) {
+        if (!r->sprites_clear) {
+            memset(out, 0, YM7101_MAX_WIDTH);
+            r->sprites_clear = true;
+        }
+        return flags;
+    }
+
+    memset(out, 0, YM7101_MAX_WIDTH);
+    r->sprites_clear = false;
+
+    for (n = 0; n < r->sprite_count[line]; n++) {
+        uint32_t addr = table + r->sprite_list[line][n] * 8;
+        int y = (vram_word(&st->memory, addr) & 0x3FF) - 128;
+        uint8_t size = st->memory.vram[(addr + 2) & 0xFFFF];
+        uint16_t attr = vram_word(&st->memory, addr + 4);
+        int x = (vram_word(&st->memory, addr + 6) & 0x1FF) - 128;
+        int h_cells = ((size >> 2) & 3) + 1;
+        int v_cells = (size & 3) + 1;
+        int row = line - y;
+        int cx;
+
+        if (attr & ENTRY_VFLIP) {
+            row = v_cells * 8 - 1 - row;
+        }
+
+        for (cx = 0; cx < h_cells; cx++) {
+            int cell = (attr & ENTRY_HFLIP) ? h_cells - 1 - cx : cx;
+            uint16_t entry = (attr & ~(ENTRY_VFLIP | ENTRY_TILE_MASK)) |
+                             (((attr & ENTRY_TILE_MASK) +
+                               cell * v_cells + (row >> 3)) &
+                              ENTRY_TILE_MASK);
+            int sx = x + cx * 8;
+            uint8_t pixels[8];
+            int i;
+
+            if (sx <= -8 || sx >= width) {
+                continue;
+            }
+            stq_he_p(pixels, cell_row(r, &st->memory, entry, row & 7));
+            for (i = 0; i < 8; i++) {
+                int dx = sx + i;
+
+                if (dx < 0 || dx >= width || !PIXEL_OPAQUE(pixels[i])) {
+                    continue;
+                }
+                if (PIXEL_OPAQUE(out[dx])) {
+                    flags |= SPRITE_COLLISIO;
+                } else {
+                    out[dx] = pixels[i];
+                }
+            }
+        }
+    }
+
+    return flags;
+}
+
+static void update_palette_entry(Ym7101State *s, int i)
+{
+    uint16_t color = lduw_be_p(&s->state.memory.cram[i * 2]);
+    uint8_t r = color_levels[(color >> 1) & 7];
+    uint8_t g = color_levels[(color >> 5) & 7];
+    uint8_t b = color_levels[(color >> 9) & 7];
+    uint32_t *palette = s->render.palette;
+
+    /* Shadow halves the intensity, highlight halves it and adds half */
+    palette[i] = rgb_to_pixel32(r, g, b);
+    palette[i | PIXEL_SHADOW] = rgb_to_pixel32(r / 2, g / 2, b / 2);
+    palette[i | PIXEL_HIGHLIGHT] = rgb_to_pixel32(r / 2 + 127, g / 2 + 127,
+                                                  b / 2 + 127);
+}
+
+static void dirty_all_lines(Ym7101Renderer *r)
+{
+    bitmap_fill(r->line_dirty, YM7101_MAX_HEIGHT);
+}
+
+/* Flag screen lines [first, first + count), clipped to the display */
+static void dirty_lines(Ym7101Renderer *r, int first, int count)
+{
+    int start = MAX(first, 0);
+    int end = MIN(first + count, r->height);
+
+    if (start < end) {
+        bitmap_set(r->line_dirty, start, end - start);
+    }
+}
+
+static bool vram_range_dirty(const Memory *m, uint32_t addr, uint32_t len)
+{
+    unsigned long first = (addr & (VRAM_SIZE - 1)) / VRAM_TILE_SIZE;
+    unsigned long last = MIN((addr & (VRAM_SIZE - 1)) + len - 1,
+                             VRAM_SIZE - 1) / VRAM_TILE_SIZE;
+
+    return find_next_bit(m->vram_dirty, last + 1, first) <= last;
+}
+
+/*
+ * True if a name table row changed, either its entries or the pattern
+ * of any tile it names.
+ */
+static bool name_row_dirty(const Memory *m, uint32_t addr, int cells)
+{
+    int i;
+
+    if (vram_range_dirty(m, addr, cells * 2)) {
+        return true;
+    }
+    for (i = 0; i < cells; i++) {
+        uint16_t entry = vram_word(m, addr + i * 2);
+
+        if (test_bit(entry & ENTRY_TILE_MASK, m->vram_dirty)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void collect_plane(Ym7101State *s, uint32_t nt_addr, int plane)
+{
+    State *st = &s->state;
+    Ym7101Renderer *r = &s->render;
+    int w_cells = scroll_cells(st->scroll_size[0]);
+    int h_cells = MIN(scroll_cells(st->scroll_size[1]), MAX_PLANE_ROWS);
+    int h_px = h_cells * 8;
+    int vscroll = vscroll_value(st, -1, plane);
+    DECLARE_BITMAP(rows, MAX_PLANE_ROWS);
+    int row;
+
+    bitmap_zero(rows, MAX_PLANE_ROWS);
+    for (row = 0; row < h_cells; row++) {
+        if (name_row_dirty(&st->memory, nt_addr + row * w_cells * 2,
+                           w_cells)) {
+            set_bit(row, rows);
+        }
+    }
+    if (bitmap_empty(rows, MAX_PLANE_ROWS)) {
+        return;
+    }
+
+    /* Per-column scrolling can bring any row onto any line */
+    if (st->mode_3 & MODE3_VSCROLL_CELLS) {
+        dirty_all_lines(r);
+        return;
+    }
+
+    for (row = find_first_bit(rows, h_cells); row < h_cells;
+         row = find_next_bit(rows, h_cells, row + 1)) {
+        int y = (row * 8 - vscroll) & (h_px - 1);
+
+        /* A row straddling the bottom of the plane wraps to the top */
+        dirty_lines(r, y, 8);
+        dirty_lines(r, y - h_px, 8);
+    }
+}
+
+static void collect_window(Ym7101State *s)
+{
+    State *st = &s->state;
+    int w_cells = is_h40(st) ? 64 : 32;
+    int row;
+
+    for (row = 0; row < WINDOW_ROWS; row++) {
+        if (name_row_dirty(&st->memory, st->window_addr + row * w_cells * 2,
+                           w_cells)) {
+            dirty_lines(&s->render, row * 8, 8);
+        }
+    }
+}
+
+static void collect_hscroll(Ym7101State *s)
+{
+    State *st = &s->state;
+    Ym7101Renderer *r = &s->render;
+    int mode = st->mode_3 & MODE3_HSCROLL_MASK;
+    uint32_t base = st->hscroll_addr & (VRAM_SIZE - 1);
+    uint32_t len = (mode >= 2) ? r->height * 4 : (mode == 1 ? 32 : 4);
+    uint32_t addr;
+
+    if (mode < 2) {
+        if (vram_range_dirty(&st->memory, base, len)) {
+            dirty_all_lines(r);
+        }
+        return;
+    }
+
+    /*
+     * Per-cell and per-line tables hold four bytes per line, so each
+     * tile of the table covers eight lines.
+     */
+    for (addr = base; addr < base + len && addr < VRAM_SIZE;
+         addr += VRAM_TILE_SIZE) {
+        if (test_bit(addr / VRAM_TILE_SIZE, st->memory.vram_dirty)) {
+            dirty_lines(r, (addr - base) / 4, 8);
+        }
+    }
+}
+
+/*
+ * Walk the sprite link list once and bucket the sprites by line, with
+ * the per-frame and per-line limits of the current mode.  Returns the
+ * lines covered by any walked sprite in covered.
+ */
+static void build_sprite_lines(Ym7101State *s, unsigned long *covered)
+{
+    State *st = &s->state;
+    Ym7101Renderer *r = &s->render;
+    const Memory *m = &st->memory;
+    int max_total = is_h40(st) ? YM7101_MAX_SPRITES : 64;
+    int max_line = is_h40(st) ? YM7101_MAX_LINE_SPRITES : 16;
+    uint32_t table = sprite_table(st);
+    int index = 0;
+
+    memset(r->sprite_count, 0, sizeof(r->sprite_count));
+    memset(r->sprite_flags, 0, sizeof(r->sprite_flags));
+    bitmap_zero(covered, YM7101_MAX_HEIGHT);
+    r->sprite_total = 0;
+
+    do {
+        uint32_t addr = table + index * 8;
+        int y = (vram_word(m, addr) & 0x3FF) - 128;
+        uint8_t size = m->vram[(addr + 2) & 0xFFFF];
+        int start = MAX(y, 0);
+        int end = MIN(y + ((size & 3) + 1) * 8, r->height);
+        int line;
+
+        r->sprite_order[r->sprite_total++] = index;
+        if (start < end) {
+            bitmap_set(covered, start, end - start);
+        }
+        for (line = start; line < end; line++) {
+            if (r->sprite_count[line] < max_line) {
+                r->sprite_list[line][r->sprite_count[line]++] = index;
+            } else {
+                r->sprite_flags[line] = SPRITE_OVERFLOW;
+            }
+        }
+
+        index = m->vram[(addr + 3) & 0xFFFF] & 0x7F;
+    } while (index != 0 && r->sprite_total < max_total);
+}
+
+static void collect_sprites(Ym7101State *s)
+{
+    State *st = &s->state;
+    Ym7101Renderer *r = &s->render;
+    const Memory *m = &st->memory;
+    uint32_t table = sprite_table(st);
+    DECLARE_BITMAP(covered, YM7101_MAX_HEIGHT);
+    int n;
+
+    /*
+     * A SAT change can move, resize or unlink any sprite: redraw the
+     * lines sprites covered before and cover now.
+     */
+    if (r->rescan ||
+        vram_range_dirty(m, table, YM7101_MAX_SPRITES * 8)) {
+        build_sprite_lines(s, covered);
+        bitmap_or(r->line_dirty, r->line_dirty, r->sprite_lines,
+                  YM7101_MAX_HEIGHT);
+        bitmap_or(r->line_dirty, r->line_dirty, covered, YM7101_MAX_HEIGHT);
+        bitmap_copy(r->sprite_lines, covered, YM7101_MAX_HEIGHT);
+        return;
+    }
+
+    /* Otherwise only sprites whose patterns changed need redrawing */
+    for (n = 0; n < r->sprite_total; n++) {
+        uint32_t addr = table + r->sprite_order[n] * 8;
+        int y = (vram_word(m, addr) & 0x3FF) - 128;
+        uint8_t size = m->vram[(addr + 2) & 0xFFFF];
+        uint16_t tile = vram_word(m, addr + 4) & ENTRY_TILE_MASK;
+        int cells = (((size >> 2) & 3) + 1) * ((size & 3) + 1);
+        int i;
+
+        for (i = 0; i < cells; i++) {
+            if (test_bit((tile + i) & ENTRY_TILE_MASK, m->vram_dirty)) {
+                dirty_lines(r, y, ((size & 3) + 1) * 8);
+                break;
+            }
+        }
+    }
+}
+
+/* Turn the changes flagged by the write paths into lines to redraw */
+static void collect_dirty(Ym7101State *s)
+{
+    State *st = &s->state;
+    Memory *m = &st->memory;
+    Ym7101Renderer *r = &s->render;
+    int i;
+
+    if (r->palette_dirty) {
+        bitmap_fill(m->cram_dirty, CRAM_SIZE / 2);
+        r->palette_dirty = false;
+    }
+    if (!bitmap_empty(m->cram_dirty, CRAM_SIZE / 2)) {
+        for (i = find_first_bit(m->cram_dirty, CRAM_SIZE / 2);
+             i < CRAM_SIZE / 2;
+             i = find_next_bit(m->cram_dirty, CRAM_SIZE / 2, i + 1)) {
+            update_palette_entry(s, i);
+        }
+        bitmap_zero(m->cram_dirty, CRAM_SIZE / 2);
+        dirty_all_lines(r);
+    }
+
+    if (m->vsram_dirty) {
+        m->vsram_dirty = false;
+        dirty_all_lines(r);
+    }
+
+    if (!bitmap_empty(m->vram_dirty, VRAM_TILES)) {
+        collect_plane(s, st->scroll_a_addr, 0);
+        collect_plane(s, st->scroll_b_addr, 1);
+        collect_window(s);
+        collect_hscroll(s);
+        collect_sprites(s);
+        for (i = 0; i < 2; i++) {
+            bitmap_andnot(r->tile_valid[i], r->tile_valid[i], m->vram_dirty,
+                          VRAM_TILES);
+        }
+        bitmap_zero(m->vram_dirty, VRAM_TILES);
+        r->rescan = false;
+    } else if (r->rescan) {
+        collect_sprites(s);
+        r->rescan = false;
+    }
+}
+
+static void render_line(Ym7101State *s, int line, uint32_t *dest)
+{
+    State *st = &s->state;
+    Ym7101Renderer *r = &s->render;
+    int width = r->width;
+    uint32_t backdrop = r->palette[st->background & PIXEL_COLOR_MASK];
+    int win_start, win_end;
+    int x;
+
+    if (!(st->mode_2 & MODE2_DISPLAY_ENABLE)) {
+        for (x = 0; x < width; x++) {
+            dest[x] = backdrop;
+        }
+        r->line_status[line] = 0;
+        return;
+    }
+
+    render_plane(s, r->plane_b, st->scroll_b_addr, 1, line, 0, width);
+
+    window_span(st, line, width, &win_start, &win_end);
+    if (win_start >= win_end) {
+        render_plane(s, r->plane_a, st->scroll_a_addr, 0, line, 0, width);
+    } else {
+        render_plane(s, r->plane_a, st->scroll_a_addr, 0, line,
+                     0, win_start);
+        render_window(s, r->plane_a, line, win_start, win_end);
+        render_plane(s, r->plane_a, st->scroll_a_addr, 0, line,
+                     win_end, width);
+    }
+
+    r->line_status[line] = render_sprites(s, line, width);
+    st->status |= r->line_status[line];
+
+    ym7101_compose_line(r->composed, r->sprites, r->plane_a, r->plane_b,
+                        st->background & PIXEL_COLOR_MASK,
+                        st->mode_4 & MODE4_SHADOW_HIGHLIGHT, width);
+    for (x = 0; x < width; x++) {
+        dest[x] = r->palette[r->composed[x]];
+    }
+
+    if (st->mode_1 & MODE1_BLANK_LEFT) {
+        for (x = 0; x < 8; x++) {
+            dest[x] = backdrop;
+        }
+    }
+}
+
+void ym7101_render_invalidate(Ym7101State *s)
+{
+    Ym7101Renderer *r = &s->render;
+
+    r->palette_dirty = true;
+    r->rescan = true;
+    r->sprites_clear = false;
+    bitmap_zero(r->tile_valid[0], VRAM_TILES);
+    bitmap_zero(r->tile_valid[1], VRAM_TILES);
+    dirty_all_lines(r);
+    bitmap_fill(r->line_updated, YM7101_MAX_HEIGHT);
+}
+
+/*
+ * Register writes redraw everything, but only when they change a bit
+ * that matters to the picture: games rewrite their mode registers every
+ * frame and toggle DMA enable around each transfer.
+ */
+void ym7101_render_register(Ym7101State *s, uint8_t reg, uint8_t value)
+{
+    static const uint8_t reg_mask[YM7101_DISPLAY_REGS] = {
+        [0x00] = MODE1_BLANK_LEFT,
+        [0x01] = MODE2_DISPLAY_ENABLE | MODE2_V30,
+        [0x02 ... 0x09] = 0xFF,
+        [0x0B ... 0x0E] = 0xFF,
+        [0x10 ... 0x12] = 0xFF,
+    };
+    Ym7101Renderer *r = &s->render;
+
+    if (reg >= YM7101_DISPLAY_REGS ||
+        !((r->regs[reg] ^ value) & reg_mask[reg])) {
+        return;
+    }
+    r->regs[reg] = value;
+    r->rescan = true;
+    dirty_all_lines(r);
+}
+
+void ym7101_render_begin_frame(Ym7101State *s)
+{
+    State *st = &s->state;
+    Ym7101Renderer *r = &s->render;
+    int width = is_h40(st) ? 320 : 256;
+    int height = (st->mode_2 & MODE2_V30) ? 240 : 224;
+
+    if (width != r->width || height != r->height) {
+        r->width = width;
+        r->height = height;
+        qemu_console_resize(s->con, width, height);
+        ym7101_render_invalidate(s);
+    }
+    r->next_line = 0;
+}
+
+/* Draw the lines of the current frame up to, but excluding, last */
+void ym7101_render_lines(Ym7101State *s, int last)
+{
+    Ym7101Renderer *r = &s->render;
+    DisplaySurface *surface = qemu_console_surface(s->con);
+    uint8_t *data;
+    int stride;
+
+    last = MIN(last, r->height);
+    if (r->next_line >= last) {
+        return;
+    }
+    if (surface_bits_per_pixel(surface) != 32 ||
+        surface_width(surface) != r->width) {
+        r->next_line = last;
+        return;
+    }
+
+    collect_dirty(s);
+
+    data = surface_data(surface);
+    stride = surface_stride(surface);
+
+    for (; r->next_line < last; r->next_line++) {
+        int line = r->next_line;
+
+        /* Unchanged lines are already on the surface */
+        if (!test_and_clear_bit(line, r->line_dirty)) {
+            s->state.status |= r->line_status[line];
+            continue;
+        }
+        render_line(s, line, (uint32_t *)(data + line * stride));
+        set_bit(line, r->line_updated);
+    }
+}
+
+void ym7101_render_flush(Ym7101State *s)
+{
+    Ym7101Renderer *r = &s->render;
+    int top = find_first_bit(r->line_updated, r->height);
+
+    while (top < r->height) {
+        int end = find_next_zero_bit(r->line_updated, r->height, top);
+
+        dpy_gfx_update(s->con, 0, top, r->width, end - top);
+        top = find_next_bit(r->line_updated, r->height, end);
+    }
+    bitmap_zero(r->line_updated, YM7101_MAX_HEIGHT);
+}
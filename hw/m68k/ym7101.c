@@ -29,19 +29,14 @@
 #include "target/m68k/cpu.h"
 #include "hw/core/cpu.h"
 #include "hw/qdev-properties.h"
+#include "qemu/timer.h"
 
 #include "hw/m68k/genesis.h"
-
-#define PAL_MODE 0x0001
-#define DMA_BUSY 0x0002
-#define IN_HBLANK 0x0004
-#define IN_VBLANK 0x0008
-#define ODD_FRAME 0x0010
-#define SPRITE_COLLISIO 0x0020
-#define SPRITE_OVERFLOW 0x0040
-#define V_INTERRUPT 0x0080
-#define FIFO_FULL 0x0100
-#define FIFO_EMPTY 0x0200
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
+#include "qapi/type-helpers.h"
+#include "ym7101-int.h"
+#include "trace.h"
 
 #define REG_MODE_SET_1 0x00
 #define REG_MODE_SET_2 0x01
@@ -68,108 +63,27 @@
 #define REG_DMA_ADDR_MID 0x16
 #define REG_DMA_ADDR_HIGH 0x17
 
-#define MEMORY_VRAM 0x01
-#define MEMORY_CRAM 0x02
-#define MEMORY_VSRAM 0x03
-
 #define DMA_TYPE_NONE 0x00
 #define DMA_TYPE_MEMORY 0X01
 #define DMA_TYPE_FILL 0X02
 #define DMA_TYPE_COPY 0X03
 
-OBJECT_DECLARE_SIMPLE_TYPE(Ym7101State, YM7101)
-
 #define YM7101_SIZE 0x20
 
-#define DPRINTF printf
-// #define DPRINTF(fmt, ...)
-
-#define PRINT_PC(s) DPRINTF("PC: %08x\n", s->cpu->env.pc)
-#define PAUSE()                \
-    do                         \
-    {                          \
-        printf("PAUSE\n");     \
-        do                     \
-        {                      \
-            int c = getchar(); \
-            if (c == 'q')      \
-                exit(0);       \
-            if (c >= 0)        \
-                break;         \
-        } while (1);           \
-    } while (0)
-
-#undef PAUSE
-#define PAUSE()
+// Both standards use 3420 master clocks per line.  The line length in
+// nanoseconds follows from the NTSC (53.693175 MHz) and PAL
+// (53.203424 MHz) master clocks.
+#define NTSC_LINE_NS 63695
+#define NTSC_LINES 262
+#define PAL_LINE_NS 64281
+#define PAL_LINES 313
 
-typedef struct
-{
-    uint8_t vram[0x10000];
-    uint8_t cram[128];
-    uint8_t vsram[80];
-
-    uint8_t transfer_type;
-    uint8_t transfer_bits;
-    uint32_t transfer_count;
-    uint32_t transfer_remain;
-    uint32_t transfer_src_addr;
-    uint32_t transfer_dest_addr;
-    uint32_t transfer_auto_inc;
-    uint16_t transfer_fill_word;
-    uint8_t transfer_run;
-    uint8_t transfer_target;
-    bool transfer_dma_busy;
-
-    uint16_t ctrl_port_buffer;
-    bool ctrl_port_set;
-} Memory;
-
-typedef struct
-{
-    uint16_t status;
-    Memory memory;
-
-    uint8_t mode_1;
-    uint8_t mode_2;
-    uint8_t mode_3;
-    uint8_t mode_4;
-
-    uint8_t h_int_lines;
-    size_t screen_size[2];
-    size_t scroll_size[2];
-    size_t window_pos[2][2];
-    uint8_t window_values[2];
-    uint8_t background;
-    size_t scroll_a_addr;
-    size_t scroll_b_addr;
-    size_t window_addr;
-    size_t sprites_addr;
-    size_t hscroll_addr;
-
-    // sprites: Vec<Sprite>,
-    // sprites_by_line: Vec<Vec<usize>>,
-
-    // last_clock: ClockTime,
-    // p_clock: u32,
-    // h_clock: u32,
-    // v_clock: u32,
-    uint8_t h_scanlines;
-
-    int32_t current_x;
-    int32_t current_y;
-} State;
-
-struct Ym7101State
-{
-    SysBusDevice sbd;
-    MemoryRegion mr;
-    State state;
-    M68kCPU *cpu;
-};
+#define HINT_LEVEL 4
+#define VINT_LEVEL 6
+#define AUTOVECTOR_BASE 24
 
 static void set_dma_mode(Memory *self, uint8_t mode)
 {
-    DPRINTF("set_dma_mode\n");
     switch (mode)
     {
     case DMA_TYPE_NONE:
@@ -183,25 +97,26 @@ static void set_dma_mode(Memory *self, uint8_t mode)
     }
 }
 
-static uint8_t *get_transfer_target(Memory *self)
+static const char *get_target_name(uint8_t target)
 {
-    switch (self->transfer_target)
+    switch (target)
     {
     case MEMORY_VRAM:
-        return self->vram;
+        return "vram";
     case MEMORY_CRAM:
-        return self->cram;
+        return "cram";
     case MEMORY_VSRAM:
-        return self->vsram;
+        return "vsram";
     default:
-        g_assert(!"unhandled transfer target");
-        return NULL;
+        return "???";
     }
+
+    return "???";
 }
 
 static void setup_transfer(Memory *self, uint16_t first, uint16_t second)
 {
-    self->ctrl_port_buffer = false;
+    self->ctrl_port_set = false;
 
     self->transfer_type = (uint8_t)((((first & 0xC000) >> 14) | ((second & 0x00F0) >> 2)));
     self->transfer_dest_addr = (first & 0x3FFF);
@@ -218,131 +133,222 @@ static void setup_transfer(Memory *self, uint16_t first, uint16_t second)
         self->transfer_target = MEMORY_CRAM;
         break;
     }
-    DPRINTF("ym7101: transfer requested of type %02x (%02x) to address %04x\n", self->transfer_type, self->transfer_target, self->transfer_dest_addr);
+    trace_ym7101_command(self->transfer_type, get_target_name(self->transfer_target),
+                         self->transfer_dest_addr);
 
     if (self->transfer_type & 0x20)
     {
-        if (self->transfer_type & 0x10)
+        switch (self->transfer_bits & 0xC0)
         {
+        case 0xC0:
             set_dma_mode(self, DMA_TYPE_COPY);
+            break;
+        case 0x80:
+            // Fill starts with the next data port write
+            break;
+        default:
+            set_dma_mode(self, DMA_TYPE_MEMORY);
+            break;
         }
-        else if (!(self->transfer_bits & 0x80))
+    }
+}
+
+// Flag the tiles covering VRAM [addr, addr + len) as modified
+static void mark_vram_dirty(Memory *self, uint32_t addr, uint32_t len)
+{
+    uint32_t first = addr / VRAM_TILE_SIZE;
+    uint32_t last = (addr + len - 1) / VRAM_TILE_SIZE;
+
+    if (len)
+    {
+        bitmap_set(self->vram_dirty, first, last - first + 1);
+    }
+}
+
+// Copy into VRAM, flagging only the tiles whose contents change.  Games
+// rewrite the same sprite table and name tables every frame, this keeps
+// such frames from redrawing anything.
+static void vram_store(Memory *self, uint32_t addr, const uint8_t *src,
+                       uint32_t len)
+{
+    while (len)
+    {
+        uint32_t n = MIN(len, VRAM_TILE_SIZE - (addr % VRAM_TILE_SIZE));
+
+        if (memcmp(&self->vram[addr], src, n))
         {
-            set_dma_mode(self, DMA_TYPE_MEMORY);
+            memcpy(&self->vram[addr], src, n);
+            set_bit(addr / VRAM_TILE_SIZE, self->vram_dirty);
         }
+        addr += n;
+        src += n;
+        len -= n;
     }
 }
 
-static void update_screen_size(Ym7101State *self)
+// Store one word at the transfer destination and advance it
+static void write_target_word(Memory *self, uint16_t value)
 {
-    // TODO: Implement this
+    uint32_t addr = self->transfer_dest_addr;
+    uint8_t *p;
+
+    switch (self->transfer_target)
+    {
+    case MEMORY_VRAM:
+        // Odd addresses store the word byte-swapped
+        if (addr & 1)
+        {
+            value = bswap16(value);
+        }
+        p = &self->vram[addr & (VRAM_SIZE - 2)];
+        if (lduw_be_p(p) != value)
+        {
+            stw_be_p(p, value);
+            set_bit((addr & (VRAM_SIZE - 1)) / VRAM_TILE_SIZE,
+                    self->vram_dirty);
+        }
+        break;
+    case MEMORY_CRAM:
+        p = &self->cram[addr & (CRAM_SIZE - 2)];
+        if (lduw_be_p(p) != value)
+        {
+            stw_be_p(p, value);
+            set_bit((addr & (CRAM_SIZE - 2)) / 2, self->cram_dirty);
+        }
+        break;
+    case MEMORY_VSRAM:
+        p = &self->vsram[addr & 0x7E];
+        if ((addr & 0x7E) < VSRAM_SIZE && lduw_be_p(p) != value)
+        {
+            stw_be_p(p, value);
+            self->vsram_dirty = true;
+        }
+        break;
+    }
+
+    self->transfer_dest_addr = (addr + self->transfer_auto_inc) & 0xFFFF;
 }
 
-static void update_window_position(Ym7101State *self)
+static void update_screen_size(Ym7101State *self)
 {
     // TODO: Implement this
 }
 
-static void read_data_port(Ym7101State *self, hwaddr addr, uint64_t *data)
+static void update_window_position(Ym7101State *self)
 {
     // TODO: Implement this
 }
 
-static const char *get_target_name(uint8_t target)
+static void read_data_port(Ym7101State *self, hwaddr addr, uint64_t *data,
+                           unsigned size)
 {
-    switch (target)
+    Memory *m = &self->state.memory;
+    uint32_t from = m->transfer_dest_addr;
+    uint16_t value = 0;
+
+    m->ctrl_port_set = false;
+
+    // Long reads are two word reads, each advancing the address
+    if (size == 4)
+    {
+        uint64_t low;
+
+        read_data_port(self, addr, data, 2);
+        read_data_port(self, addr, &low, 2);
+        *data = (*data << 16) | low;
+        return;
+    }
+
+    switch (m->transfer_target)
     {
     case MEMORY_VRAM:
-        return "vram";
+        value = lduw_be_p(&m->vram[from & (VRAM_SIZE - 2)]);
+        break;
     case MEMORY_CRAM:
-        return "cram";
+        value = lduw_be_p(&m->cram[from & (CRAM_SIZE - 2)]);
+        break;
     case MEMORY_VSRAM:
-        return "vsram";
-    default:
-        return "???";
+        if ((from & 0x7E) < VSRAM_SIZE)
+        {
+            value = lduw_be_p(&m->vsram[from & 0x7E]);
+        }
+        break;
     }
+    m->transfer_dest_addr = (from + m->transfer_auto_inc) & 0xFFFF;
 
-    return "???";
-}
-
-static void dump_state(Ym7101State *self)
-{
-    /*
-    Status: Running
-    PC: 0x00001506
-    SR: 0x2700
-    D0: 0x00000000        A0: 0x0001e7db
-    D1: 0x00000001        A1: 0xffffaa00
-    D2: 0x56000000        A2: 0xfffff700
-    D3: 0x00000000        A3: 0x00001504
-    D4: 0x47111111        A4: 0x00c00000
-    D5: 0x00008540        A5: 0x00000305
-    D6: 0x0000000c        A6: 0x00c00004
-    D7: 0x00000004       USP: 0x00000000
-                        SSP: 0x00fffdc0
-                        */
-
-    printf("Status: Running\n");
-    printf("PC: 0x%08x\n", self->cpu->env.pc);
-    // printf("SR: 0x%04x\n", self->cpu->env.sr);
-    printf("D0: 0x%08x        A0: 0x%08x\n", self->cpu->env.dregs[0], self->cpu->env.aregs[0]);
-    printf("D1: 0x%08x        A1: 0x%08x\n", self->cpu->env.dregs[1], self->cpu->env.aregs[1]);
-    printf("D2: 0x%08x        A2: 0x%08x\n", self->cpu->env.dregs[2], self->cpu->env.aregs[2]);
-    printf("D3: 0x%08x        A3: 0x%08x\n", self->cpu->env.dregs[3], self->cpu->env.aregs[3]);
-    printf("D4: 0x%08x        A4: 0x%08x\n", self->cpu->env.dregs[4], self->cpu->env.aregs[4]);
-    printf("D5: 0x%08x        A5: 0x%08x\n", self->cpu->env.dregs[5], self->cpu->env.aregs[5]);
-    printf("D6: 0x%08x        A6: 0x%08x\n", self->cpu->env.dregs[6], self->cpu->env.aregs[6]);
-    printf("D7: 0x%08x       USP: 0x%08x\n", self->cpu->env.dregs[7], self->cpu->env.sp[0]);
-    printf("                     SSP: 0x%08x\n", self->cpu->env.aregs[7]);
-
-    printf("\n");
-    printf("Mode1: 0x%02x\n", self->state.mode_1);
-    printf("Mode2: 0x%02x\n", self->state.mode_2);
-    printf("Mode3: 0x%02x\n", self->state.mode_3);
-    printf("Mode4: 0x%02x\n", self->state.mode_4);
-    printf("\n");
-
-    printf("Scroll A : 0x%04zx\n", self->state.scroll_a_addr);
-    printf("Window   : 0x%04zx\n", self->state.window_addr);
-    printf("Scroll B : 0x%04zx\n", self->state.scroll_b_addr);
-    printf("HScroll  : 0x%04zx\n", self->state.hscroll_addr);
-    printf("Sprites  : 0x%04zx\n", self->state.sprites_addr);
-    printf("\n");
-
-    printf("DMA type  : %d\n", self->state.memory.transfer_type);
-    printf("DMA Source: 0x%04x\n", self->state.memory.transfer_src_addr);
-    printf("DMA Dest  : 0x%04x\n", self->state.memory.transfer_dest_addr);
-    printf("DMA Count : 0x%04x\n", self->state.memory.transfer_count);
-    printf("Auto-Inc  : 0x%04x\n", self->state.memory.transfer_auto_inc);
+    if (size == 1)
+    {
+        *data = (addr & 1) ? (value & 0xff) : (value >> 8);
+    }
+    else
+    {
+        *data = value;
+    }
 }
 
 static void write_data_port(Memory *self, uint32_t value, size_t size)
 {
-    size_t addr;
-    uint8_t *target;
-    size_t i;
+    uint32_t addr = self->transfer_dest_addr;
 
-    if ((self->transfer_type & 0x30) == 0x20)
+    if ((self->transfer_type & 0x20) && (self->transfer_bits & 0xC0) == 0x80)
     {
         g_assert(size <= 4);
         self->ctrl_port_set = false;
-        self->transfer_fill_word = (size == 2) ? value : (value & 0xff);
+        // A byte is on both halves of the bus, a long fills with its first word
+        if (size == 1)
+        {
+            self->transfer_fill_word = (value & 0xff) * 0x0101;
+        }
+        else if (size == 4)
+        {
+            self->transfer_fill_word = value >> 16;
+        }
+        else
+        {
+            self->transfer_fill_word = value;
+        }
 
+        // The triggering write lands normally before the fill runs
+        write_target_word(self, self->transfer_fill_word);
         set_dma_mode(self, DMA_TYPE_FILL);
+        return;
     }
-    else
+
+    trace_ym7101_data_write(get_target_name(self->transfer_target),
+                            addr, value, size);
+
+    // Byte writes drive the same value onto both halves of the bus
+    if (size == 1)
+    {
+        value = (value & 0xff) * 0x0101;
+        size = 2;
+    }
+
+    // Aligned, ascending VRAM writes are stored as laid out by the CPU
+    if (self->transfer_target == MEMORY_VRAM && self->transfer_auto_inc == 2 &&
+        !(addr & 1) && addr + size <= VRAM_SIZE)
     {
-        DPRINTF("ym7101: data port write %zu bytes to %s:%04x with %08x\n",
-                size, get_target_name(self->transfer_target), self->transfer_dest_addr, value);
+        uint8_t buf[4];
 
-        addr = self->transfer_dest_addr;
-        target = get_transfer_target(self);
-        for (i = 0; i < size; i++)
+        if (size == 4)
+        {
+            stl_be_p(buf, value);
+        }
+        else
         {
-            target[(addr + i) % sizeof(target)] = extract32(value, (size - i - 1) * 8, 8);
+            stw_be_p(buf, value);
         }
-        self->transfer_dest_addr += self->transfer_auto_inc;
+        vram_store(self, addr, buf, size);
+        self->transfer_dest_addr = (addr + size) & (VRAM_SIZE - 1);
+        return;
     }
+
+    // Long writes are two word writes, each advancing the address
+    if (size == 4)
+    {
+        write_target_word(self, value >> 16);
+    }
+    write_target_word(self, value);
 }
 
 static void write_control_port(Memory *self, uint32_t value, size_t size)
@@ -361,18 +367,11 @@ static void write_control_port(Memory *self, uint32_t value, size_t size)
         }
         // Return to avoid the rest of the function
         return;
-    case 4:
-        if (!self->ctrl_port_set)
-        {
-            setup_transfer(self, value >> 16, value & 0xffff);
-            return;
-        }
-        break;
     }
 
-    g_printerr("ym7101: error when writing to control port with %zu bytes of %08x\n", size, value);
-
-    g_assert(!"unhandled write_control_port");
+    qemu_log_mask(LOG_GUEST_ERROR,
+                  "ym7101: %zu byte write of 0x%x to the control port\n",
+                  size, value);
 }
 
 static size_t decode_scroll_size(uint8_t size)
@@ -386,12 +385,548 @@ static size_t decode_scroll_size(uint8_t size)
     case 3: // 0b11
         return 128;
     default:
-        DPRINTF("invalid scroll size option %d", size);
-        assert(!"invalid scroll size option");
+        // 0b10 is reserved: use the smallest plane
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "ym7101: invalid scroll size option %d\n", size);
+        return 32;
+    }
+}
+
+// Timing
+//
+// Nothing is polled: the line position is derived from the virtual
+// clock whenever the guest looks at it, and the timer only fires for
+// events that change the interrupt lines (an enabled HINT, the VINT and
+// the end of the frame).  Any access to the VDP first catches up with
+// ym7101_run_until(), which also draws the lines the beam has passed.
+
+typedef struct
+{
+    int64_t line_ns;
+    int64_t hblank_ns;
+    int total_lines;
+    int active_lines;
+} FrameTiming;
+
+static void get_frame_timing(const State *st, FrameTiming *t)
+{
+    bool h40 = (st->mode_4 & MODE4_H40) != 0;
+
+    if (st->status & PAL_MODE)
+    {
+        t->line_ns = PAL_LINE_NS;
+        t->total_lines = PAL_LINES;
+        t->active_lines = (st->mode_2 & MODE2_V30) ? 240 : 224;
+    }
+    else
+    {
+        t->line_ns = NTSC_LINE_NS;
+        t->total_lines = NTSC_LINES;
+        t->active_lines = 224;
+    }
+
+    // HBLANK starts after the active pixels: 320 of 420 or 256 of 342
+    t->hblank_ns = h40 ? t->line_ns * 320 / 420 : t->line_ns * 256 / 342;
+}
+
+static void ym7101_update_irq(Ym7101State *s)
+{
+    State *st = &s->state;
+    int level = 0;
+
+    if (s->dma_stall)
+    {
+        // The 68K cannot take an interrupt without the bus
+    }
+    else if (st->vint_pending && (st->mode_2 & MODE2_VINT_ENABLE))
+    {
+        level = VINT_LEVEL;
+    }
+    else if (st->hint_pending && (st->mode_1 & MODE1_HINT_ENABLE))
+    {
+        level = HINT_LEVEL;
+    }
+
+    if (s->cpu->env.pending_level != level)
+    {
+        trace_ym7101_irq(level);
+        m68k_set_irq_level(s->cpu, level, level ? AUTOVECTOR_BASE + level : 0);
+    }
+}
+
+static void ym7101_iack(void *opaque, int level)
+{
+    Ym7101State *s = YM7101(opaque);
+    State *st = &s->state;
+
+    switch (level)
+    {
+    case VINT_LEVEL:
+        st->vint_pending = false;
+        st->status &= ~V_INTERRUPT;
+        break;
+    case HINT_LEVEL:
+        st->hint_pending = false;
         break;
     }
 
-    return 0;
+    ym7101_update_irq(s);
+}
+
+// Hold the 68K off the bus for 'ns', as a 68K to VDP transfer does
+static void ym7101_dma_stall(Ym7101State *s, int64_t ns)
+{
+    s->dma_stall = true;
+    ym7101_update_irq(s);
+    cpu_interrupt(CPU(s->cpu), CPU_INTERRUPT_HALT);
+    timer_mod(s->dma_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + ns);
+}
+
+static void ym7101_dma_stall_end(void *opaque)
+{
+    Ym7101State *s = YM7101(opaque);
+    CPUState *cs = CPU(s->cpu);
+
+    if (s->dma_stall)
+    {
+        s->dma_stall = false;
+        cs->halted = 0;
+        qemu_cpu_kick(cs);
+        ym7101_update_irq(s);
+    }
+}
+
+static int64_t hint_time(const State *st, const FrameTiming *t)
+{
+    if (st->hint_line > t->active_lines)
+    {
+        return INT64_MAX;
+    }
+    return st->frame_start + st->hint_line * t->line_ns + t->hblank_ns;
+}
+
+static int64_t vint_time(const State *st, const FrameTiming *t)
+{
+    if (st->vint_done)
+    {
+        return INT64_MAX;
+    }
+    return st->frame_start + t->active_lines * t->line_ns;
+}
+
+static int64_t frame_end_time(const State *st, const FrameTiming *t)
+{
+    return st->frame_start + t->total_lines * t->line_ns;
+}
+
+// Draw every line whose active part has been scanned out by 'now'
+static void render_until(Ym7101State *s, const FrameTiming *t, int64_t now)
+{
+    int64_t elapsed = now - s->state.frame_start - t->hblank_ns;
+
+    if (elapsed >= 0)
+    {
+        ym7101_render_lines(s, MIN(elapsed / t->line_ns + 1,
+                                   t->active_lines));
+    }
+}
+
+static void start_frame(Ym7101State *s, int64_t when)
+{
+    State *st = &s->state;
+
+    st->frame_start = when;
+    st->hint_line = st->h_int_lines;
+    st->vint_done = false;
+    ym7101_render_begin_frame(s);
+}
+
+// Process all events up to 'now', in order
+static void ym7101_run_until(Ym7101State *s, int64_t now)
+{
+    State *st = &s->state;
+    FrameTiming t;
+
+    for (;;)
+    {
+        int64_t t_hint, t_vint, t_end;
+
+        get_frame_timing(st, &t);
+        t_hint = hint_time(st, &t);
+        t_vint = vint_time(st, &t);
+        t_end = frame_end_time(st, &t);
+
+        if (t_hint <= now && t_hint <= t_vint && t_hint <= t_end)
+        {
+            render_until(s, &t, t_hint);
+            st->hint_pending = true;
+            st->hint_line += st->h_int_lines + 1;
+        }
+        else if (t_vint <= now && t_vint <= t_end)
+        {
+            render_until(s, &t, t_vint);
+            st->vint_done = true;
+            st->vint_pending = true;
+            st->status |= V_INTERRUPT;
+            notifier_list_notify(&s->frame_notifiers, NULL);
+        }
+        else if (t_end <= now)
+        {
+            start_frame(s, t_end);
+            if (st->mode_4 & MODE4_INTERLACE)
+            {
+                st->status ^= ODD_FRAME;
+            }
+            else
+            {
+                st->status &= ~ODD_FRAME;
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    render_until(s, &t, now);
+    ym7101_update_irq(s);
+}
+
+static void ym7101_schedule(Ym7101State *s)
+{
+    State *st = &s->state;
+    FrameTiming t;
+    int64_t next;
+
+    get_frame_timing(st, &t);
+    next = MIN(vint_time(st, &t), frame_end_time(st, &t));
+    if (st->mode_1 & MODE1_HINT_ENABLE)
+    {
+        next = MIN(next, hint_time(st, &t));
+    }
+
+    timer_mod(s->timer, next);
+}
+
+static void ym7101_sync(Ym7101State *s)
+{
+    ym7101_run_until(s, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+}
+
+static void ym7101_timer_cb(void *opaque)
+{
+    Ym7101State *s = YM7101(opaque);
+
+    ym7101_sync(s);
+    ym7101_schedule(s);
+}
+
+static uint16_t read_status(Ym7101State *s)
+{
+    State *st = &s->state;
+    int64_t pos = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - st->frame_start;
+    uint16_t status = st->status & ~(IN_HBLANK | IN_VBLANK | DMA_BUSY);
+    FrameTiming t;
+
+    get_frame_timing(st, &t);
+    if (pos / t.line_ns >= t.active_lines ||
+        !(st->mode_2 & MODE2_DISPLAY_ENABLE))
+    {
+        status |= IN_VBLANK;
+    }
+    if (pos % t.line_ns >= t.hblank_ns)
+    {
+        status |= IN_HBLANK;
+    }
+    if (pos + st->frame_start < st->dma_end)
+    {
+        status |= DMA_BUSY;
+    }
+
+    // Reading the status ends a pending command and clears sprite flags
+    st->memory.ctrl_port_set = false;
+    st->status &= ~(SPRITE_OVERFLOW | SPRITE_COLLISIO);
+
+    return status;
+}
+
+// The H/V counter, including the jumps the real counters make in blanking
+static uint16_t read_hv_counter(Ym7101State *s)
+{
+    State *st = &s->state;
+    int64_t pos = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - st->frame_start;
+    bool h40 = (st->mode_4 & MODE4_H40) != 0;
+    FrameTiming t;
+    int h, v;
+
+    get_frame_timing(st, &t);
+    v = pos / t.line_ns;
+    h = (pos % t.line_ns) * (h40 ? 210 : 171) / t.line_ns;
+
+    if (h40 && h > 0xB6)
+    {
+        h += 0xE4 - 0xB7;
+    }
+    else if (!h40 && h > 0x93)
+    {
+        h += 0xE9 - 0x94;
+    }
+
+    if (!(st->status & PAL_MODE))
+    {
+        if (v > 0xEA)
+        {
+            v -= 0xEB - 0xE5;
+        }
+    }
+    else if (t.active_lines == 240)
+    {
+        if (v > 0x10A)
+        {
+            v -= 0x10B - 0x1D2;
+        }
+    }
+    else if (v > 0x102)
+    {
+        v -= 0x103 - 0x1CA;
+    }
+
+    st->current_x = h;
+    st->current_y = v;
+
+    return ((v & 0xFF) << 8) | (h & 0xFF);
+}
+
+// DMA
+//
+// Transfers are done in one go when they are triggered.  68K sources
+// are mapped straight from the CPU address space, so ROM and RAM go
+// through memcpy, and the time the transfer would have held the bus is
+// charged to the CPU as a single stall.  Fill and copy leave the CPU
+// running and only show up as DMA_BUSY until their time has elapsed.
+
+// Bytes moved per line, from the VDP access slot tables
+#define DMA_BYTES_ACTIVE_H40 18
+#define DMA_BYTES_ACTIVE_H32 16
+#define DMA_BYTES_BLANK_H40 205
+#define DMA_BYTES_BLANK_H32 167
+
+// The source of a 68K transfer wraps within a 128 KiB bank
+#define DMA_SOURCE_BANK 0x20000
+
+static uint32_t dma_length(const Memory *m)
+{
+    return m->transfer_count ? m->transfer_count : 0x10000;
+}
+
+static int64_t dma_duration(Ym7101State *s, uint32_t bytes)
+{
+    State *st = &s->state;
+    int64_t pos = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - st->frame_start;
+    bool h40 = (st->mode_4 & MODE4_H40) != 0;
+    bool blank;
+    uint32_t rate;
+    FrameTiming t;
+
+    get_frame_timing(st, &t);
+    blank = pos / t.line_ns >= t.active_lines ||
+            !(st->mode_2 & MODE2_DISPLAY_ENABLE);
+    if (blank)
+    {
+        rate = h40 ? DMA_BYTES_BLANK_H40 : DMA_BYTES_BLANK_H32;
+    }
+    else
+    {
+        rate = h40 ? DMA_BYTES_ACTIVE_H40 : DMA_BYTES_ACTIVE_H32;
+    }
+
+    return bytes * t.line_ns / rate;
+}
+
+// Store 'words' big-endian words from 'src', honouring the auto-increment
+static void dma_store_words(Memory *m, const uint8_t *src, uint32_t words)
+{
+    uint32_t i;
+
+    if (m->transfer_target == MEMORY_VRAM && m->transfer_auto_inc == 2 &&
+        !(m->transfer_dest_addr & 1))
+    {
+        while (words)
+        {
+            uint32_t dest = m->transfer_dest_addr;
+            uint32_t n = MIN(words, (VRAM_SIZE - dest) / 2);
+
+            vram_store(m, dest, src, n * 2);
+            m->transfer_dest_addr = (dest + n * 2) & (VRAM_SIZE - 1);
+            src += n * 2;
+            words -= n;
+        }
+        return;
+    }
+
+    for (i = 0; i < words; i++)
+    {
+        write_target_word(m, lduw_be_p(src + i * 2));
+    }
+}
+
+static void dma_memory(Ym7101State *s)
+{
+    Memory *m = &s->state.memory;
+    AddressSpace *as = CPU(s->cpu)->as;
+    uint32_t src = m->transfer_src_addr;
+    uint32_t words = dma_length(m);
+    int64_t stall = dma_duration(s, words * 2);
+
+    while (words)
+    {
+        uint32_t bank_left = (DMA_SOURCE_BANK -
+                              (src & (DMA_SOURCE_BANK - 1))) / 2;
+        uint32_t n = MIN(words, bank_left);
+        hwaddr len = n * 2;
+        uint8_t *buf;
+
+        buf = address_space_map(as, src, &len, false, MEMTXATTRS_UNSPECIFIED);
+        if (buf && len >= 2)
+        {
+            n = len / 2;
+            dma_store_words(m, buf, n);
+            address_space_unmap(as, buf, len, false, len);
+        }
+        else
+        {
+            uint8_t word[2];
+
+            if (buf)
+            {
+                address_space_unmap(as, buf, len, false, 0);
+            }
+            address_space_read(as, src, MEMTXATTRS_UNSPECIFIED, word, 2);
+            n = 1;
+            dma_store_words(m, word, n);
+        }
+
+        src = (src & ~(DMA_SOURCE_BANK - 1)) |
+              ((src + n * 2) & (DMA_SOURCE_BANK - 1));
+        words -= n;
+    }
+
+    m->transfer_src_addr = src;
+    ym7101_dma_stall(s, stall);
+}
+
+static void dma_fill(Ym7101State *s)
+{
+    Memory *m = &s->state.memory;
+    uint32_t length = dma_length(m);
+    uint8_t value = m->transfer_fill_word >> 8;
+    uint32_t i;
+
+    if (m->transfer_target != MEMORY_VRAM)
+    {
+        for (i = 0; i < length; i++)
+        {
+            write_target_word(m, m->transfer_fill_word);
+        }
+    }
+    else if (m->transfer_auto_inc == 1 && !(m->transfer_dest_addr & 1) &&
+             !(length & 1))
+    {
+        // Byte lanes are swapped, but in pairs the range is contiguous
+        while (length)
+        {
+            uint32_t dest = m->transfer_dest_addr;
+            uint32_t n = MIN(length, VRAM_SIZE - dest);
+
+            memset(&m->vram[dest], value, n);
+            mark_vram_dirty(m, dest, n);
+            m->transfer_dest_addr = (dest + n) & (VRAM_SIZE - 1);
+            length -= n;
+        }
+    }
+    else
+    {
+        for (i = 0; i < length; i++)
+        {
+            m->vram[m->transfer_dest_addr ^ 1] = value;
+            set_bit(m->transfer_dest_addr / VRAM_TILE_SIZE, m->vram_dirty);
+            m->transfer_dest_addr = (m->transfer_dest_addr +
+                                     m->transfer_auto_inc) & (VRAM_SIZE - 1);
+        }
+    }
+
+    s->state.dma_end = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                       dma_duration(s, dma_length(m));
+}
+
+static void dma_copy(Ym7101State *s)
+{
+    Memory *m = &s->state.memory;
+    uint32_t length = dma_length(m);
+    uint32_t src = (m->transfer_src_addr >> 1) & (VRAM_SIZE - 1);
+    uint32_t dest = m->transfer_dest_addr;
+    uint32_t i;
+
+    if (m->transfer_auto_inc == 1 && src + length <= VRAM_SIZE &&
+        dest + length <= VRAM_SIZE &&
+        (src + length <= dest || dest + length <= src))
+    {
+        vram_store(m, dest, &m->vram[src], length);
+        dest += length;
+        src += length;
+    }
+    else
+    {
+        // Byte at a time, so overlapping copies replicate like hardware
+        for (i = 0; i < length; i++)
+        {
+            if (m->vram[dest] != m->vram[src])
+            {
+                m->vram[dest] = m->vram[src];
+                set_bit(dest / VRAM_TILE_SIZE, m->vram_dirty);
+            }
+            src = (src + 1) & (VRAM_SIZE - 1);
+            dest = (dest + m->transfer_auto_inc) & (VRAM_SIZE - 1);
+        }
+    }
+
+    m->transfer_dest_addr = dest & (VRAM_SIZE - 1);
+    m->transfer_src_addr = (m->transfer_src_addr & ~0x1FFFF) |
+                           ((src & (VRAM_SIZE - 1)) << 1);
+
+    // Copies take two access slots per byte
+    s->state.dma_end = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                       dma_duration(s, length * 2);
+}
+
+// Run the DMA selected by the last command, if the guest enabled DMA
+static void ym7101_dma(Ym7101State *s)
+{
+    Memory *m = &s->state.memory;
+
+    if (s->state.mode_2 & MODE2_DMA_ENABLE)
+    {
+        trace_ym7101_dma(m->transfer_run, m->transfer_src_addr,
+                         m->transfer_dest_addr, dma_length(m));
+        switch (m->transfer_run)
+        {
+        case DMA_TYPE_MEMORY:
+            dma_memory(s);
+            break;
+        case DMA_TYPE_FILL:
+            dma_fill(s);
+            break;
+        case DMA_TYPE_COPY:
+            dma_copy(s);
+            break;
+        }
+        m->transfer_count = 0;
+        m->transfer_remain = 0;
+    }
+
+    // Later data port accesses are plain writes again
+    m->transfer_type &= ~0x20;
+    set_dma_mode(m, DMA_TYPE_NONE);
 }
 
 static void set_register(Ym7101State *self, uint16_t value)
@@ -401,8 +936,12 @@ static void set_register(Ym7101State *self, uint16_t value)
     size_t reg = ((value & 0x1F00) >> 8);
     uint8_t data = (value & 0x00FF);
 
-    // debug!("{}: register {:x} set to {:x}", DEV_NAME, reg, data);
-    DPRINTF("ym7101: register %04zx set to %02x\n", reg, data);
+    trace_ym7101_register(reg, data);
+    ym7101_render_register(self, reg, data);
+    if (reg < YM7101_REGS)
+    {
+        self->state.regs[reg] = data;
+    }
 
     switch (reg)
     {
@@ -491,8 +1030,8 @@ static void set_register(Ym7101State *self, uint16_t value)
         /* Reserved */
         break;
     default:
-        DPRINTF("ym7101: unknown register: %04zx\n", reg);
-        g_assert(!"unhandled register");
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "ym7101: unknown register: %04zx\n", reg);
         break;
     }
 }
@@ -500,12 +1039,32 @@ static void set_register(Ym7101State *self, uint16_t value)
 static MemTxResult ym7101_read(void *opaque, hwaddr addr, uint64_t *data,
                                unsigned size, MemTxAttrs attrs)
 {
-    uint8_t val1, val2;
     uint64_t mask = 0xFFFFFFFF;
     const char *port = "???";
     Ym7101State *self = YM7101(opaque);
+    uint16_t status, hv;
+    uint64_t low;
 
-    printf("****** PC = 0x%04x READ addr 0x%04llx size %d\n", self->cpu->env.pc, addr, size);
+    // The 68000 can't make these, but the bus lets anyone try
+    if (size > 1 && (addr & 1))
+    {
+        qemu_log_mask(LOG_GUEST_ERROR, "ym7101: odd %u byte read at 0x%"
+                      HWADDR_PRIx "\n", size, addr);
+        *data = ~0ULL;
+        return MEMTX_OK;
+    }
+
+    // Only the data port gives a longword at once, the rest see two words
+    if (size == 4 && addr >= 0x04)
+    {
+        ym7101_read(opaque, addr, data, 2, attrs);
+        ym7101_read(opaque, addr + 2, &low, 2, attrs);
+        *data = (*data << 16) | (low & 0xffff);
+        return MEMTX_OK;
+    }
+
+    self->mmio_accesses++;
+    ym7101_sync(self);
 
     switch (addr)
     {
@@ -513,18 +1072,17 @@ static MemTxResult ym7101_read(void *opaque, hwaddr addr, uint64_t *data,
     case 0x02:
         port = "data port";
         // Read from Data Port
-        read_data_port(self, addr, data);
+        read_data_port(self, addr, data, size);
         break;
     case 0x04:
     case 0x05:
     case 0x06:
     case 0x07:
-        g_assert(size <= 4 && ((addr - 0x04) + size <= 4));
-        DPRINTF("status = %04x\n", self->state.status);
+        status = read_status(self);
 
-        *data = self->state.status;
+        *data = status;
         *data <<= 16;
-        *data |= self->state.status;
+        *data |= status;
         *data &= mask >> ((addr - 0x04) * 8);
         *data >>= ((0x08 - addr) - size) * 8;
 
@@ -532,31 +1090,29 @@ static MemTxResult ym7101_read(void *opaque, hwaddr addr, uint64_t *data,
         // Read from Control Port
         break;
     case 0x08:
+    case 0x09:
     case 0x0A:
+    case 0x0B:
         port = "h/v counter";
         // Read from H/V Counter
-        *data = self->state.current_y & 0xff;
-        if (size > 1)
+        hv = read_hv_counter(self);
+        if (size == 1)
         {
-            *data = (*data << 8) | ((self->state.current_y >> 1) & 0xff);
+            *data = (addr & 1) ? (hv & 0xff) : (hv >> 8);
+        }
+        else
+        {
+            *data = hv;
         }
         break;
     default:
-        DPRINTF("ym7101_read: %08llx\n", addr);
-        g_assert(!"unhandled ym7101_read");
+        qemu_log_mask(LOG_GUEST_ERROR, "ym7101_read: %08" HWADDR_PRIx "\n",
+                      addr);
+        *data = ~0ULL;
         break;
     }
 
-    val1 = (*data >> 8) & 0xff;
-    val2 = *data & 0xff;
-
-    PRINT_PC(self);
-    DPRINTF("ym7101: %s read %d bytes from %llx with [%d, %d] %llx\n",
-            port, size, addr, (int)val1, (int)val2, *data);
-
-    PAUSE();
-
-    dump_state(self);
+    trace_ym7101_read(port, addr, size, *data);
 
     return MEMTX_OK;
 }
@@ -564,18 +1120,26 @@ static MemTxResult ym7101_read(void *opaque, hwaddr addr, uint64_t *data,
 static MemTxResult ym7101_write(void *opaque, hwaddr addr, uint64_t value,
                                 unsigned size, MemTxAttrs attrs)
 {
-    uint8_t val1, val2;
     const char *port = "???";
     Ym7101State *self = YM7101(opaque);
-    bool is_reg = false;
-    uint16_t flags;
 
-    printf("****** PC = 0x%04x WRITE addr 0x%04llx size %d\n", self->cpu->env.pc, addr, size);
+    if (size > 1 && (addr & 1))
+    {
+        qemu_log_mask(LOG_GUEST_ERROR, "ym7101: odd %u byte write at 0x%"
+                      HWADDR_PRIx "\n", size, addr);
+        return MEMTX_OK;
+    }
 
-    if(self->cpu->env.pc == 0x000268) {
-        printf("****** PC = 0x%04x WRITE addr 0x%04llx size %d\n", self->cpu->env.pc, addr, size);
+    // Only the data port takes a longword at once, the rest see two words
+    if (size == 4 && addr >= 0x04)
+    {
+        ym7101_write(opaque, addr, value >> 16, 2, attrs);
+        return ym7101_write(opaque, addr + 2, value & 0xffff, 2, attrs);
     }
 
+    self->mmio_accesses++;
+    ym7101_sync(self);
+
     switch (addr)
     {
     case 0x00:
@@ -583,58 +1147,46 @@ static MemTxResult ym7101_write(void *opaque, hwaddr addr, uint64_t value,
         port = "data port";
         // Write from Data Port
         write_data_port(&self->state.memory, value, size);
+        if (self->state.memory.transfer_run != DMA_TYPE_NONE)
+        {
+            ym7101_dma(self);
+        }
         break;
     case 0x04:
     case 0x06:
         // Write from Control Port
         port = "control port";
-        is_reg = ((size == 2 ? value : (value >> 16)) & 0xC000) == 0x8000;
 
-        if (is_reg)
+        if (size == 2 && (value & 0xC000) == 0x8000)
         {
-            if (size == 2)
-            {
-                set_register(self, value);
-            }
-            else
-            {
-                set_register(self, value >> 16);
-                value &= 0xffff;
-                g_assert(((value & 0xC000) == 0x8000) && "unexpected second byte ");
-                set_register(self, value);
-            }
+            set_register(self, value);
+            ym7101_update_irq(self);
+            ym7101_schedule(self);
         }
         else
         {
             write_control_port(&self->state.memory, value, size);
-            flags = self->state.memory.transfer_dma_busy ? DMA_BUSY : 0;
-            self->state.status = (self->state.status & ~DMA_BUSY) | flags;
+            if (self->state.memory.transfer_run != DMA_TYPE_NONE)
+            {
+                ym7101_dma(self);
+            }
         }
         break;
-    case 0x11:
-    case 0x12:
-    case 0x13:
-    case 0x14:
-    case 0x15:
-    case 0x16:
+    case 0x10 ... 0x17:
+        // The PSG sits on the low byte of 0x10-0x17
         port = "sound port";
+        if (self->psg && (size > 1 || (addr & 1)))
+        {
+            sn76489_write(self->psg, value);
+        }
         break;
     default:
-        DPRINTF("ym7101_write: %08llx\n", addr);
-        g_assert(!"unhandled ym7101_write");
+        qemu_log_mask(LOG_GUEST_ERROR, "ym7101_write: %08" HWADDR_PRIx "\n",
+                      addr);
         break;
     }
 
-    val1 = (value >> 8) & 0xff;
-    val2 = value & 0xff;
-
-    PRINT_PC(self);
-    DPRINTF("ym7101: %s write %d bytes to %llx with [%d, %d] %llx\n",
-            port, size, addr, (int)val1, (int)val2, value);
-
-    PAUSE();
-
-    dump_state(self);
+    trace_ym7101_write(port, addr, size, value);
 
     return MEMTX_OK;
 }
@@ -645,16 +1197,113 @@ static const MemoryRegionOps ym7101_ops = {
     .endianness = DEVICE_BIG_ENDIAN,
     .valid = {
         .min_access_size = 1,
-        .max_access_size = 2,
+        .max_access_size = 4,
+        // Longwords need only be word aligned on the 68000
+        .unaligned = true,
     },
 };
 
+HumanReadableText *qmp_x_query_ym7101(Error **errp)
+{
+    g_autoptr(GString) buf = g_string_new("");
+    Object *obj = object_resolve_path_type("", TYPE_YM7101, NULL);
+    Ym7101State *s;
+    State *st;
+    Memory *m;
+
+    if (!obj) {
+        error_setg(errp, "No YM7101 VDP present");
+        return NULL;
+    }
+    s = YM7101(obj);
+    ym7101_sync(s);
+    st = &s->state;
+    m = &st->memory;
+
+    g_string_append_printf(buf, "Status   : 0x%04x\n", st->status);
+    g_string_append_printf(buf, "H/V      : 0x%04x (line %d)\n",
+                           read_hv_counter(s), st->current_y);
+    g_string_append_printf(buf, "Mode     : 0x%02x 0x%02x 0x%02x 0x%02x\n",
+                           st->mode_1, st->mode_2, st->mode_3, st->mode_4);
+    g_string_append_printf(buf, "HINT     : every %d lines, next %d%s\n",
+                           st->h_int_lines + 1, st->hint_line,
+                           st->hint_pending ? ", pending" : "");
+    g_string_append_printf(buf, "VINT     : %s\n",
+                           st->vint_pending ? "pending" : "idle");
+    g_string_append_printf(buf, "Scroll A : 0x%04zx\n", st->scroll_a_addr);
+    g_string_append_printf(buf, "Window   : 0x%04zx\n", st->window_addr);
+    g_string_append_printf(buf, "Scroll B : 0x%04zx\n", st->scroll_b_addr);
+    g_string_append_printf(buf, "HScroll  : 0x%04zx\n", st->hscroll_addr);
+    g_string_append_printf(buf, "Sprites  : 0x%04zx\n", st->sprites_addr);
+    g_string_append_printf(buf, "Planes   : %zux%zu cells\n",
+                           st->scroll_size[0], st->scroll_size[1]);
+    g_string_append_printf(buf, "Backdrop : %d\n", st->background);
+    g_string_append_printf(buf, "Target   : %s:%04x (auto-inc %d)\n",
+                           get_target_name(m->transfer_target),
+                           m->transfer_dest_addr, m->transfer_auto_inc);
+    g_string_append_printf(buf, "DMA type : 0x%02x (bits 0x%02x)\n",
+                           m->transfer_type, m->transfer_bits);
+    g_string_append_printf(buf, "DMA src  : 0x%06x\n", m->transfer_src_addr);
+    g_string_append_printf(buf, "DMA count: 0x%04x\n", m->transfer_count);
+
+    return human_readable_text_from_str(buf);
+}
+
+static void ym7101_update_display(void *opaque)
+{
+    Ym7101State *s = YM7101(opaque);
+
+    if (!s->display_held)
+    {
+        ym7101_render_flush(s);
+    }
+}
+
+static void ym7101_invalidate_display(void *opaque)
+{
+    Ym7101State *s = YM7101(opaque);
+
+    ym7101_render_invalidate(s);
+}
+
+static const GraphicHwOps ym7101_gfx_ops = {
+    .invalidate = ym7101_invalidate_display,
+    .gfx_update = ym7101_update_display,
+};
+
 static void ym7101_reset(DeviceState *dev)
 {
     Ym7101State *s = YM7101(dev);
 
     memset(&s->state, 0, sizeof(s->state));
     s->state.status = 0x3400 | FIFO_EMPTY;
+    memset(s->render.regs, 0, sizeof(s->render.regs));
+    ym7101_render_invalidate(s);
+
+    timer_del(s->dma_timer);
+    s->dma_stall = false;
+
+    start_frame(s, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL));
+    ym7101_schedule(s);
+}
+
+void ym7101_add_frame_notifier(DeviceState *dev, Notifier *notifier)
+{
+    notifier_list_add(&YM7101(dev)->frame_notifiers, notifier);
+}
+
+void ym7101_hold_display(DeviceState *dev, bool hold)
+{
+    YM7101(dev)->display_held = hold;
+}
+
+static void ym7101_init(Object *obj)
+{
+    Ym7101State *s = YM7101(obj);
+
+    notifier_list_init(&s->frame_notifiers);
+    object_property_add_uint64_ptr(obj, "mmio-accesses", &s->mmio_accesses,
+                                   OBJ_PROP_FLAG_READ);
 }
 
 static void ym7101_realize(DeviceState *dev, Error **errp)
@@ -663,15 +1312,75 @@ static void ym7101_realize(DeviceState *dev, Error **errp)
 
     memory_region_init_io(&s->mr, OBJECT(dev), &ym7101_ops, s, "ym7101", YM7101_SIZE);
     sysbus_init_mmio(SYS_BUS_DEVICE(dev), &s->mr);
+
+    s->con = graphic_console_init(dev, 0, &ym7101_gfx_ops, s);
+    qemu_console_resize(s->con, 320, 224);
+
+    s->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, ym7101_timer_cb, s);
+    s->dma_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, ym7101_dma_stall_end, s);
+    m68k_set_iack_handler(s->cpu, ym7101_iack, s);
+}
+
+static int ym7101_post_load(void *opaque, int version_id)
+{
+    Ym7101State *s = YM7101(opaque);
+    int reg;
+
+    // Decode the picture registers again; DMA progress was loaded as is
+    for (reg = 0; reg < YM7101_DISPLAY_REGS; reg++)
+    {
+        set_register(s, (reg << 8) | s->state.regs[reg]);
+    }
+
+    ym7101_render_invalidate(s);
+    ym7101_render_begin_frame(s);
+    ym7101_update_irq(s);
+    ym7101_schedule(s);
+    return 0;
 }
 
 static const VMStateDescription ym7101_vmstate = {
     .name = TYPE_YM7101,
-    .unmigratable = 1, /* TODO: Implement this when m68k CPU is migratable */
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = ym7101_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT16(state.status, Ym7101State),
+        VMSTATE_UINT8_ARRAY(state.regs, Ym7101State, YM7101_REGS),
+        VMSTATE_UINT8_ARRAY(state.memory.vram, Ym7101State, VRAM_SIZE),
+        VMSTATE_UINT8_ARRAY(state.memory.cram, Ym7101State, CRAM_SIZE),
+        VMSTATE_UINT8_ARRAY(state.memory.vsram, Ym7101State, VSRAM_SIZE),
+        VMSTATE_UINT8(state.memory.transfer_type, Ym7101State),
+        VMSTATE_UINT8(state.memory.transfer_bits, Ym7101State),
+        VMSTATE_UINT32(state.memory.transfer_count, Ym7101State),
+        VMSTATE_UINT32(state.memory.transfer_remain, Ym7101State),
+        VMSTATE_UINT32(state.memory.transfer_src_addr, Ym7101State),
+        VMSTATE_UINT32(state.memory.transfer_dest_addr, Ym7101State),
+        VMSTATE_UINT32(state.memory.transfer_auto_inc, Ym7101State),
+        VMSTATE_UINT16(state.memory.transfer_fill_word, Ym7101State),
+        VMSTATE_UINT8(state.memory.transfer_run, Ym7101State),
+        VMSTATE_UINT8(state.memory.transfer_target, Ym7101State),
+        VMSTATE_BOOL(state.memory.transfer_dma_busy, Ym7101State),
+        VMSTATE_UINT16(state.memory.ctrl_port_buffer, Ym7101State),
+        VMSTATE_BOOL(state.memory.ctrl_port_set, Ym7101State),
+        VMSTATE_UINT8(state.h_scanlines, Ym7101State),
+        VMSTATE_INT32(state.current_x, Ym7101State),
+        VMSTATE_INT32(state.current_y, Ym7101State),
+        VMSTATE_INT64(state.frame_start, Ym7101State),
+        VMSTATE_INT32(state.hint_line, Ym7101State),
+        VMSTATE_BOOL(state.vint_done, Ym7101State),
+        VMSTATE_BOOL(state.vint_pending, Ym7101State),
+        VMSTATE_BOOL(state.hint_pending, Ym7101State),
+        VMSTATE_INT64(state.dma_end, Ym7101State),
+        VMSTATE_BOOL(dma_stall, Ym7101State),
+        VMSTATE_TIMER_PTR(dma_timer, Ym7101State),
+        VMSTATE_END_OF_LIST()
+    }
 };
 
 static Property ym7101_properties[] = {
     DEFINE_PROP_LINK("cpu", Ym7101State, cpu, TYPE_M68K_CPU, M68kCPU *),
+    DEFINE_PROP_LINK("psg", Ym7101State, psg, TYPE_SN76489, DeviceState *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -679,7 +1388,7 @@ static void ym7101_class_init(ObjectClass *oc, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(oc);
 
-    // set_bit(DEVICE_CATEGORY_DISPLAY, dc->categories);
+    set_bit(DEVICE_CATEGORY_DISPLAY, dc->categories);
     dc->vmsd = &ym7101_vmstate;
     dc->realize = ym7101_realize;
     dc->reset = ym7101_reset;
@@ -691,6 +1400,7 @@ static const TypeInfo ym7101_info = {
     .name = TYPE_YM7101,
     .parent = TYPE_SYS_BUS_DEVICE,
     .instance_size = sizeof(Ym7101State),
+    .instance_init = ym7101_init,
     .class_init = ym7101_class_init,
 };
 
@@ -0,0 +1,1082 @@
+/*
+ * Zilog Z80 interpreter
+ *
+ * Opcodes are decoded by their x/y/z/p/q bit fields.  All documented
+ * instructions are implemented, along with the undocumented ones drivers
+ * are known to use: IXH/IXL/IYH/IYL access, SLL and the DDCB/FDCB forms
+ * that also store to a register.  Undocumented flag bits 3 and 5 are
+ * produced for the common cases only.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "migration/vmstate.h"
+#include "z80-cpu.h"
+
+#define FC Z80_FLAG_C
+#define FN Z80_FLAG_N
+#define FPV Z80_FLAG_PV
+#define FX Z80_FLAG_X
+#define FH Z80_FLAG_H
+#define FY Z80_FLAG_Y
+#define FZ Z80_FLAG_Z
+#define FS Z80_FLAG_S
+
+/* Register operand 6 is memory, (HL) or (IX+d) */
+#define OPERAND_MEM 6
+
+/* Which register HL stands for under a DD/FD prefix */
+enum {
+    INDEX_HL,
+    INDEX_IX,
+    INDEX_IY,
+};
+
+static inline uint8_t sz53(uint8_t v)
+{
+    return (v & (FS | FY | FX)) | (v ? 0 : FZ);
+}
+
+static inline uint8_t sz53p(uint8_t v)
+{
+    return sz53(v) | ((ctpop8(v) & 1) ? 0 : FPV);
+}
+
+static inline uint8_t rd8(Z80CPU *z, uint16_t addr)
+{
+    return z->bus->read(z->opaque, addr);
+}
+
+static inline void wr8(Z80CPU *z, uint16_t addr, uint8_t v)
+{
+    z->bus->write(z->opaque, addr, v);
+}
+
+static inline uint16_t rd16(Z80CPU *z, uint16_t addr)
+{
+    return rd8(z, addr) | (rd8(z, addr + 1) << 8);
+}
+
+static inline void wr16(Z80CPU *z, uint16_t addr, uint16_t v)
+{
+    wr8(z, addr, v);
+    wr8(z, addr + 1, v >> 8);
+}
+
+static inline uint8_t fetch8(Z80CPU *z)
+{
+    return rd8(z, z->pc++);
+}
+
+static inline uint16_t fetch16(Z80CPU *z)
+{
+    uint16_t v = rd16(z, z->pc);
+
+    z->pc += 2;
+    return v;
+}
+
+static inline void push16(Z80CPU *z, uint16_t v)
+{
+    z->sp -= 2;
+    wr16(z, z->sp, v);
+}
+
+static inline uint16_t pop16(Z80CPU *z)
+{
+    uint16_t v = rd16(z, z->sp);
+
+    z->sp += 2;
+    return v;
+}
+
+/* Opcode fetch: bumps the low seven bits of R */
+static inline uint8_t fetch_opcode(Z80CPU *z)
+{
+    z->r = (z->r & 0x80) | ((z->r + 1) & 0x7f);
+    return fetch8(z);
+}
+
+static inline uint16_t get_bc(Z80CPU *z)
+{
+    return (z->b << 8) | z->c;
+}
+
+static inline uint16_t get_de(Z80CPU *z)
+{
+    return (z->d << 8) | z->e;
+}
+
+static inline uint16_t get_hl(Z80CPU *z)
+{
+    return (z->h << 8) | z->l;
+}
+
+static inline void set_bc(Z80CPU *z, uint16_t v)
+{
+    z->b = v >> 8;
+    z->c = v;
+}
+
+static inline void set_de(Z80CPU *z, uint16_t v)
+{
+    z->d = v >> 8;
+    z->e = v;
+}
+
+static inline void set_hl(Z80CPU *z, uint16_t v)
+{
+    z->h = v >> 8;
+    z->l = v;
+}
+
+/* HL, IX or IY */
+static uint16_t get_index(Z80CPU *z, int index)
+{
+    switch (index) {
+    case INDEX_IX:
+        return z->ix;
+    case INDEX_IY:
+        return z->iy;
+    default:
+        return get_hl(z);
+    }
+}
+
+static void set_index(Z80CPU *z, int index, uint16_t v)
+{
+    switch (index) {
+    case INDEX_IX:
+        z->ix = v;
+        break;
+    case INDEX_IY:
+        z->iy = v;
+        break;
+    default:
+        set_hl(z, v);
+        break;
+    }
+}
+
+/* rp[p]: BC, DE, HL, SP */
+static uint16_t get_rp(Z80CPU *z, int p, int index)
+{
+    switch (p) {
+    case 0:
+        return get_bc(z);
+    case 1:
+        return get_de(z);
+    case 2:
+        return get_index(z, index);
+    default:
+        return z->sp;
+    }
+}
+
+static void set_rp(Z80CPU *z, int p, int index, uint16_t v)
+{
+    switch (p) {
+    case 0:
+        set_bc(z, v);
+        break;
+    case 1:
+        set_de(z, v);
+        break;
+    case 2:
+        set_index(z, index, v);
+        break;
+    default:
+        z->sp = v;
+        break;
+    }
+}
+
+/* rp2[p]: BC, DE, HL, AF */
+static uint16_t get_rp2(Z80CPU *z, int p, int index)
+{
+    return p == 3 ? (z->a << 8) | z->f : get_rp(z, p, index);
+}
+
+static void set_rp2(Z80CPU *z, int p, int index, uint16_t v)
+{
+    if (p == 3) {
+        z->a = v >> 8;
+        z->f = v;
+    } else {
+        set_rp(z, p, index, v);
+    }
+}
+
+/* r[n] other than OPERAND_MEM; H and L become the index halves */
+static uint8_t get_reg(Z80CPU *z, int n, int index)
+{
+    switch (n) {
+    case 0:
+        return z->b;
+    case 1:
+        return z->c;
+    case 2:
+        return z->d;
+    case 3:
+        return z->e;
+    case 4:
+        return index == INDEX_HL ? z->h : get_index(z, index) >> 8;
+    case 5:
+        return index == INDEX_HL ? z->l : get_index(z, index) & 0xff;
+    default:
+        return z->a;
+    }
+}
+
+static void set_reg(Z80CPU *z, int n, int index, uint8_t v)
+{
+    uint16_t w;
+
+    switch (n) {
+    case 0:
+        z->b = v;
+        break;
+    case 1:
+        z->c = v;
+        break;
+    case 2:
+        z->d = v;
+        break;
+    case 3:
+        z->e = v;
+        break;
+    case 4:
+        if (index == INDEX_HL) {
+            z->h = v;
+        } else {
+            w = get_index(z, index);
+            set_index(z, index, (w & 0x00ff) | (v << 8));
+        }
+        break;
+    case 5:
+        if (index == INDEX_HL) {
+            z->l = v;
+        } else {
+            w = get_index(z, index);
+            set_index(z, index, (w & 0xff00) | v);
+        }
+        break;
+    default:
+        z->a = v;
+        break;
+    }
+}
+
+/* Address of (HL) or (IX+d), fetching d when indexed */
+static uint16_t mem_operand(Z80CPU *z, int index)
+{
+    if (index == INDEX_HL) {
+        return get_hl(z);
+    }
+    return get_index(z, index) + (int8_t)fetch8(z);
+}
+
+static bool condition(Z80CPU *z, int cc)
+{
+    switch (cc) {
+    case 0:
+        return !(z->f & FZ);
+    case 1:
+        return z->f & FZ;
+    case 2:
+        return !(z->f & FC);
+    case 3:
+        return z->f & FC;
+    case 4:
+        return !(z->f & FPV);
+    case 5:
+        return z->f & FPV;
+    case 6:
+        return !(z->f & FS);
+    default:
+        return z->f & FS;
+    }
+}
+
+static uint8_t add8(Z80CPU *z, uint8_t a, uint8_t v, int carry)
+{
+    unsigned r = a + v + carry;
+
+    z->f = sz53(r) | ((a ^ v ^ r) & FH) |
+           (((a ^ r) & (v ^ r) & 0x80) >> 5) | ((r >> 8) & FC);
+    return r;
+}
+
+static uint8_t sub8(Z80CPU *z, uint8_t a, uint8_t v, int carry)
+{
+    unsigned r = a - v - carry;
+
+    z->f = FN | sz53(r) | ((a ^ v ^ r) & FH) |
+           (((a ^ v) & (a ^ r) & 0x80) >> 5) | ((r >> 8) & FC);
+    return r;
+}
+
+/* alu[y] A,v: ADD ADC SUB SBC AND XOR OR CP */
+static void alu(Z80CPU *z, int op, uint8_t v)
+{
+    switch (op) {
+    case 0:
+        z->a = add8(z, z->a, v, 0);
+        break;
+    case 1:
+        z->a = add8(z, z->a, v, z->f & FC);
+        break;
+    case 2:
+        z->a = sub8(z, z->a, v, 0);
+        break;
+    case 3:
+        z->a = sub8(z, z->a, v, z->f & FC);
+        break;
+    case 4:
+        z->a &= v;
+        z->f = sz53p(z->a) | FH;
+        break;
+    case 5:
+        z->a ^= v;
+        z->f = sz53p(z->a);
+        break;
+    case 6:
+        z->a |= v;
+        z->f = sz53p(z->a);
+        break;
+    default:
+        sub8(z, z->a, v, 0);
+        /* CP takes bits 3 and 5 from the operand */
+        z->f = (z->f & ~(FX | FY)) | (v & (FX | FY));
+        break;
+    }
+}
+
+static uint8_t inc8(Z80CPU *z, uint8_t v)
+{
+    uint8_t r = v + 1;
+
+    z->f = (z->f & FC) | sz53(r) | (r == 0x80 ? FPV : 0) |
+           ((r & 0x0f) ? 0 : FH);
+    return r;
+}
+
+static uint8_t dec8(Z80CPU *z, uint8_t v)
+{
+    uint8_t r = v - 1;
+
+    z->f = (z->f & FC) | FN | sz53(r) | (v == 0x80 ? FPV : 0) |
+           ((v & 0x0f) ? 0 : FH);
+    return r;
+}
+
+static uint16_t add16(Z80CPU *z, uint16_t a, uint16_t v)
+{
+    uint32_t r = a + v;
+
+    z->f = (z->f & (FS | FZ | FPV)) | (((a ^ v ^ r) >> 8) & FH) |
+           ((r >> 8) & (FX | FY)) | ((r >> 16) & FC);
+    return r;
+}
+
+static uint16_t adc16(Z80CPU *z, uint16_t a, uint16_t v)
+{
+    uint32_t r = a + v + (z->f & FC);
+
+    z->f = ((r >> 8) & (FS | FX | FY)) | ((r & 0xffff) ? 0 : FZ) |
+           (((a ^ v ^ r) >> 8) & FH) |
+           ((~(a ^ v) & (a ^ r) & 0x8000) >> 13) | ((r >> 16) & FC);
+    return r;
+}
+
+static uint16_t sbc16(Z80CPU *z, uint16_t a, uint16_t v)
+{
+    uint32_t r = a - v - (z->f & FC);
+
+    z->f = FN | ((r >> 8) & (FS | FX | FY)) | ((r & 0xffff) ? 0 : FZ) |
+           (((a ^ v ^ r) >> 8) & FH) |
+           (((a ^ v) & (a ^ r) & 0x8000) >> 13) | ((r >> 16) & FC);
+    return r;
+}
+
+/* rot[y] v: RLC RRC RL RR SLA SRA SLL SRL */
+static uint8_t rot(Z80CPU *z, int op, uint8_t v)
+{
+    uint8_t r, carry;
+
+    switch (op) {
+    case 0:
+        carry = v >> 7;
+        r = (v << 1) | carry;
+        break;
+    case 1:
+        carry = v & 1;
+        r = (v >> 1) | (carry << 7);
+        break;
+    case 2:
+        carry = v >> 7;
+        r = (v << 1) | (z->f & FC);
+        break;
+    case 3:
+        carry = v & 1;
+        r = (v >> 1) | ((z->f & FC) << 7);
+        break;
+    case 4:
+        carry = v >> 7;
+        r = v << 1;
+        break;
+    case 5:
+        carry = v & 1;
+        r = (v >> 1) | (v & 0x80);
+        break;
+    case 6:
+        carry = v >> 7;
+        r = (v << 1) | 1;
+        break;
+    default:
+        carry = v & 1;
+        r = v >> 1;
+        break;
+    }
+
+    z->f = sz53p(r) | carry;
+    return r;
+}
+
+static void daa(Z80CPU *z)
+{
+    uint8_t a = z->a;
+    uint8_t corr = 0;
+    uint8_t carry = z->f & FC;
+    uint8_t half;
+
+    if ((z->f & FH) || (a & 0x0f) > 9) {
+        corr |= 0x06;
+    }
+    if (carry || a > 0x99) {
+        corr |= 0x60;
+        carry = FC;
+    }
+
+    if (z->f & FN) {
+        half = ((z->f & FH) && (a & 0x0f) < 6) ? FH : 0;
+        a -= corr;
+    } else {
+        half = ((a & 0x0f) > 9) ? FH : 0;
+        a += corr;
+    }
+
+    z->a = a;
+    z->f = sz53p(a) | (z->f & FN) | half | carry;
+}
+
+/* x=0 z=7: RLCA RRCA RLA RRA DAA CPL SCF CCF */
+static void accumulator_op(Z80CPU *z, int y)
+{
+    uint8_t keep = z->f & (FS | FZ | FPV);
+    uint8_t carry;
+
+    switch (y) {
+    case 0:
+        carry = z->a >> 7;
+        z->a = (z->a << 1) | carry;
+        break;
+    case 1:
+        carry = z->a & 1;
+        z->a = (z->a >> 1) | (carry << 7);
+        break;
+    case 2:
+        carry = z->a >> 7;
+        z->a = (z->a << 1) | (z->f & FC);
+        break;
+    case 3:
+        carry = z->a & 1;
+        z->a = (z->a >> 1) | ((z->f & FC) << 7);
+        break;
+    case 4:
+        daa(z);
+        return;
+    case 5:
+        z->a = ~z->a;
+        z->f = (z->f & (FS | FZ | FPV | FC)) | FH | FN |
+               (z->a & (FX | FY));
+        return;
+    case 6:
+        z->f = keep | FC | (z->a & (FX | FY));
+        return;
+    default:
+        z->f = keep | ((z->f & FC) ? FH : FC) | (z->a & (FX | FY));
+        return;
+    }
+
+    z->f = keep | (z->a & (FX | FY)) | carry;
+}
+
+/*
+ * CB prefix, T-states not counting a DD/FD prefix.  Indexed forms
+ * (DDCB/FDCB d op) work on (IX+d) and, for everything but BIT, also copy
+ * the result to r[z] unless z is 6.
+ */
+static int exec_cb(Z80CPU *z, int index)
+{
+    uint16_t addr = 0;
+    uint8_t op, v, r;
+    int x, y, n;
+    bool mem;
+
+    if (index != INDEX_HL) {
+        addr = mem_operand(z, index);
+        op = fetch8(z);
+    } else {
+        op = fetch_opcode(z);
+    }
+
+    x = op >> 6;
+    y = (op >> 3) & 7;
+    n = op & 7;
+    mem = index != INDEX_HL || n == OPERAND_MEM;
+
+    if (mem && index == INDEX_HL) {
+        addr = get_hl(z);
+    }
+    v = mem ? rd8(z, addr) : get_reg(z, n, INDEX_HL);
+
+    switch (x) {
+    case 0:
+        r = rot(z, y, v);
+        break;
+    case 1:
+        z->f = (z->f & FC) | FH | (v & (FX | FY)) |
+               ((v & (1 << y)) ? (v & (1 << y) & FS) : (FZ | FPV));
+        if (!mem) {
+            return 8;
+        }
+        return index == INDEX_HL ? 12 : 16;
+    case 2:
+        r = v & ~(1 << y);
+        break;
+    default:
+        r = v | (1 << y);
+        break;
+    }
+
+    if (!mem) {
+        set_reg(z, n, INDEX_HL, r);
+        return 8;
+    }
+
+    wr8(z, addr, r);
+    if (index != INDEX_HL && n != OPERAND_MEM) {
+        set_reg(z, n, INDEX_HL, r);
+    }
+    return index == INDEX_HL ? 15 : 19;
+}
+
+/* ED x=2: LDI CPI INI OUTI and their decrementing/repeating forms */
+static int exec_block(Z80CPU *z, int y, int op)
+{
+    int step = (y & 1) ? -1 : 1;
+    bool repeat = y >= 6;
+    uint16_t hl = get_hl(z);
+    uint16_t bc;
+    uint8_t v, n;
+
+    switch (op) {
+    case 0:
+        v = rd8(z, hl);
+        wr8(z, get_de(z), v);
+        set_de(z, get_de(z) + step);
+        set_hl(z, hl + step);
+        bc = get_bc(z) - 1;
+        set_bc(z, bc);
+        n = v + z->a;
+        z->f = (z->f & (FS | FZ | FC)) | (bc ? FPV : 0) |
+               (n & FX) | ((n << 4) & FY);
+        repeat = repeat && bc;
+        break;
+    case 1: {
+        uint8_t r, half;
+
+        v = rd8(z, hl);
+        r = z->a - v;
+        half = (z->a ^ v ^ r) & FH;
+        set_hl(z, hl + step);
+        bc = get_bc(z) - 1;
+        set_bc(z, bc);
+        n = r - (half ? 1 : 0);
+        z->f = (z->f & FC) | FN | half | (bc ? FPV : 0) | (r & FS) |
+               (r ? 0 : FZ) | (n & FX) | ((n << 4) & FY);
+        repeat = repeat && bc && r;
+        break;
+    }
+    case 2:
+        v = z->bus->in(z->opaque, get_bc(z));
+        wr8(z, hl, v);
+        set_hl(z, hl + step);
+        z->b--;
+        z->f = sz53(z->b) | ((v & 0x80) ? FN : 0);
+        repeat = repeat && z->b;
+        break;
+    default:
+        v = rd8(z, hl);
+        z->b--;
+        z->bus->out(z->opaque, get_bc(z), v);
+        set_hl(z, hl + step);
+        z->f = sz53(z->b) | ((v & 0x80) ? FN : 0);
+        repeat = repeat && z->b;
+        break;
+    }
+
+    if (repeat) {
+        z->pc -= 2;
+        return 21;
+    }
+    return 16;
+}
+
+static int exec_ed(Z80CPU *z)
+{
+    uint8_t op = fetch_opcode(z);
+    int x = op >> 6;
+    int y = (op >> 3) & 7;
+    int n = op & 7;
+    int p = y >> 1;
+    int q = y & 1;
+    uint8_t v, m;
+    uint16_t addr;
+
+    if (x == 2 && n <= 3 && y >= 4) {
+        return exec_block(z, y, n);
+    }
+    if (x != 1) {
+        return 8;
+    }
+
+    switch (n) {
+    case 0:
+        v = z->bus->in(z->opaque, get_bc(z));
+        if (y != OPERAND_MEM) {
+            set_reg(z, y, INDEX_HL, v);
+        }
+        z->f = (z->f & FC) | sz53p(v);
+        return 12;
+    case 1:
+        z->bus->out(z->opaque, get_bc(z),
+                    y == OPERAND_MEM ? 0 : get_reg(z, y, INDEX_HL));
+        return 12;
+    case 2:
+        if (q) {
+            set_hl(z, adc16(z, get_hl(z), get_rp(z, p, INDEX_HL)));
+        } else {
+            set_hl(z, sbc16(z, get_hl(z), get_rp(z, p, INDEX_HL)));
+        }
+        return 15;
+    case 3:
+        addr = fetch16(z);
+        if (q) {
+            set_rp(z, p, INDEX_HL, rd16(z, addr));
+        } else {
+            wr16(z, addr, get_rp(z, p, INDEX_HL));
+        }
+        return 20;
+    case 4:
+        z->a = sub8(z, 0, z->a, 0);
+        return 8;
+    case 5:
+        /* RETN and RETI */
+        z->iff1 = z->iff2;
+        z->pc = pop16(z);
+        return 14;
+    case 6:
+        z->im = (y & 3) ? (y & 3) - 1 : 0;
+        return 8;
+    default:
+        switch (y) {
+        case 0:
+            z->i = z->a;
+            return 9;
+        case 1:
+            z->r = z->a;
+            return 9;
+        case 2:
+        case 3:
+            z->a = y == 2 ? z->i : z->r;
+            z->f = (z->f & FC) | sz53(z->a) | (z->iff2 ? FPV : 0);
+            return 9;
+        case 4:
+            m = rd8(z, get_hl(z));
+            wr8(z, get_hl(z), (z->a << 4) | (m >> 4));
+            z->a = (z->a & 0xf0) | (m & 0x0f);
+            z->f = (z->f & FC) | sz53p(z->a);
+            return 18;
+        case 5:
+            m = rd8(z, get_hl(z));
+            wr8(z, get_hl(z), (m << 4) | (z->a & 0x0f));
+            z->a = (z->a & 0xf0) | (m >> 4);
+            z->f = (z->f & FC) | sz53p(z->a);
+            return 18;
+        default:
+            return 8;
+        }
+    }
+}
+
+/* Unprefixed and DD/FD prefixed opcodes */
+static int exec_main(Z80CPU *z, uint8_t op, int index)
+{
+    int x = op >> 6;
+    int y = (op >> 3) & 7;
+    int n = op & 7;
+    int p = y >> 1;
+    int q = y & 1;
+    /* Extra time for the prefix, and for computing (IX+d) */
+    int extra = index == INDEX_HL ? 0 : 4;
+    int disp = index == INDEX_HL ? 0 : 8;
+    uint16_t addr, w;
+    uint8_t v;
+    int8_t d;
+
+    switch (x) {
+    case 0:
+        switch (n) {
+        case 0:
+            switch (y) {
+            case 0:
+                return 4 + extra;
+            case 1:
+                w = (z->a << 8) | z->f;
+                z->a = z->af2 >> 8;
+                z->f = z->af2;
+                z->af2 = w;
+                return 4 + extra;
+            case 2:
+                d = fetch8(z);
+                if (--z->b) {
+                    z->pc += d;
+                    return 13 + extra;
+                }
+                return 8 + extra;
+            case 3:
+                d = fetch8(z);
+                z->pc += d;
+                return 12 + extra;
+            default:
+                d = fetch8(z);
+                if (condition(z, y - 4)) {
+                    z->pc += d;
+                    return 12 + extra;
+                }
+                return 7 + extra;
+            }
+        case 1:
+            if (q) {
+                set_rp(z, 2, index,
+                       add16(z, get_index(z, index), get_rp(z, p, index)));
+                return 11 + extra;
+            }
+            set_rp(z, p, index, fetch16(z));
+            return 10 + extra;
+        case 2:
+            switch (p) {
+            case 0:
+                addr = get_bc(z);
+                break;
+            case 1:
+                addr = get_de(z);
+                break;
+            default:
+                addr = fetch16(z);
+                break;
+            }
+            if (p == 2) {
+                if (q) {
+                    set_index(z, index, rd16(z, addr));
+                } else {
+                    wr16(z, addr, get_index(z, index));
+                }
+                return 16 + extra;
+            }
+            if (q) {
+                z->a = rd8(z, addr);
+            } else {
+                wr8(z, addr, z->a);
+            }
+            return (p == 3 ? 13 : 7) + extra;
+        case 3:
+            w = get_rp(z, p, index);
+            set_rp(z, p, index, q ? w - 1 : w + 1);
+            return 6 + extra;
+        case 4:
+        case 5:
+            if (y == OPERAND_MEM) {
+                addr = mem_operand(z, index);
+                v = rd8(z, addr);
+                wr8(z, addr, n == 4 ? inc8(z, v) : dec8(z, v));
+                return 11 + extra + disp;
+            }
+            v = get_reg(z, y, index);
+            set_reg(z, y, index, n == 4 ? inc8(z, v) : dec8(z, v));
+            return 4 + extra;
+        case 6:
+            if (y == OPERAND_MEM) {
+                addr = mem_operand(z, index);
+                wr8(z, addr, fetch8(z));
+                return 10 + extra + (index == INDEX_HL ? 0 : 5);
+            }
+            set_reg(z, y, index, fetch8(z));
+            return 7 + extra;
+        default:
+            accumulator_op(z, y);
+            return 4 + extra;
+        }
+
+    case 1:
+        if (y == OPERAND_MEM && n == OPERAND_MEM) {
+            z->halted = true;
+            return 4 + extra;
+        }
+        if (y == OPERAND_MEM) {
+            /* LD (IX+d),r stores the real H and L */
+            wr8(z, mem_operand(z, index), get_reg(z, n, INDEX_HL));
+            return 7 + extra + disp;
+        }
+        if (n == OPERAND_MEM) {
+            set_reg(z, y, INDEX_HL, rd8(z, mem_operand(z, index)));
+            return 7 + extra + disp;
+        }
+        set_reg(z, y, index, get_reg(z, n, index));
+        return 4 + extra;
+
+    case 2:
+        if (n == OPERAND_MEM) {
+            alu(z, y, rd8(z, mem_operand(z, index)));
+            return 7 + extra + disp;
+        }
+        alu(z, y, get_reg(z, n, index));
+        return 4 + extra;
+
+    default:
+        switch (n) {
+        case 0:
+            if (condition(z, y)) {
+                z->pc = pop16(z);
+                return 11 + extra;
+            }
+            return 5 + extra;
+        case 1:
+            if (!q) {
+                set_rp2(z, p, index, pop16(z));
+                return 10 + extra;
+            }
+            switch (p) {
+            case 0:
+                z->pc = pop16(z);
+                return 10 + extra;
+            case 1:
+                w = get_bc(z);
+                set_bc(z, z->bc2);
+                z->bc2 = w;
+                w = get_de(z);
+                set_de(z, z->de2);
+                z->de2 = w;
+                w = get_hl(z);
+                set_hl(z, z->hl2);
+                z->hl2 = w;
+                return 4 + extra;
+            case 2:
+                z->pc = get_index(z, index);
+                return 4 + extra;
+            default:
+                z->sp = get_index(z, index);
+                return 6 + extra;
+            }
+        case 2:
+            addr = fetch16(z);
+            if (condition(z, y)) {
+                z->pc = addr;
+            }
+            return 10 + extra;
+        case 3:
+            switch (y) {
+            case 0:
+                z->pc = fetch16(z);
+                return 10 + extra;
+            case 1:
+                return exec_cb(z, index) + extra;
+            case 2:
+                v = fetch8(z);
+                z->bus->out(z->opaque, (z->a << 8) | v, z->a);
+                return 11 + extra;
+            case 3:
+                v = fetch8(z);
+                z->a = z->bus->in(z->opaque, (z->a << 8) | v);
+                return 11 + extra;
+            case 4:
+                w = rd16(z, z->sp);
+                wr16(z, z->sp, get_index(z, index));
+                set_index(z, index, w);
+                return 19 + extra;
+            case 5:
+                /* EX DE,HL ignores the prefix */
+                w = get_de(z);
+                set_de(z, get_hl(z));
+                set_hl(z, w);
+                return 4 + extra;
+            case 6:
+                z->iff1 = z->iff2 = false;
+                return 4 + extra;
+            default:
+                z->iff1 = z->iff2 = true;
+                z->ei_delay = true;
+                return 4 + extra;
+            }
+        case 4:
+            addr = fetch16(z);
+            if (condition(z, y)) {
+                push16(z, z->pc);
+                z->pc = addr;
+                return 17 + extra;
+            }
+            return 10 + extra;
+        case 5:
+            if (!q) {
+                push16(z, get_rp2(z, p, index));
+                return 11 + extra;
+            }
+            switch (p) {
+            case 0:
+                addr = fetch16(z);
+                push16(z, z->pc);
+                z->pc = addr;
+                return 17 + extra;
+            case 1:
+                return exec_main(z, fetch_opcode(z), INDEX_IX) + extra;
+            case 2:
+                return exec_ed(z) + extra;
+            default:
+                return exec_main(z, fetch_opcode(z), INDEX_IY) + extra;
+            }
+        case 6:
+            alu(z, y, fetch8(z));
+            return 7 + extra;
+        default:
+            push16(z, z->pc);
+            z->pc = y * 8;
+            return 11 + extra;
+        }
+    }
+}
+
+static int z80_interrupt(Z80CPU *z)
+{
+    z->halted = false;
+    z->iff1 = z->iff2 = false;
+    z->r = (z->r & 0x80) | ((z->r + 1) & 0x7f);
+    push16(z, z->pc);
+
+    /* Nothing drives the data bus on the Genesis: it reads 0xff, RST 38h */
+    if (z->im == 2) {
+        z->pc = rd16(z, (z->i << 8) | 0xff);
+        return 19;
+    }
+    z->pc = 0x38;
+    return 13;
+}
+
+int z80_run(Z80CPU *z, int cycles)
+{
+    int done = 0;
+
+    while (done < cycles) {
+        if (z->irq && z->iff1 && !z->ei_delay) {
+            done += z80_interrupt(z);
+            continue;
+        }
+        z->ei_delay = false;
+
+        if (z->halted) {
+            /* HALT repeats 4 T-state NOPs until an interrupt */
+            int nops = (cycles - done + 3) / 4;
+
+            z->r = (z->r & 0x80) | ((z->r + nops) & 0x7f);
+            done += nops * 4;
+            break;
+        }
+
+        done += exec_main(z, fetch_opcode(z), INDEX_HL);
+    }
+
+    return done;
+}
+
+void z80_reset(Z80CPU *z)
+{
+    z->pc = 0;
+    z->i = 0;
+    z->r = 0;
+    z->im = 0;
+    z->iff1 = z->iff2 = false;
+    z->halted = false;
+    z->ei_delay = false;
+    z->a = z->f = 0xff;
+    z->sp = 0xffff;
+}
+
+void z80_init(Z80CPU *z, const Z80Bus *bus, void *opaque)
+{
+    memset(z, 0, sizeof(*z));
+    z->bus = bus;
+    z->opaque = opaque;
+    z80_reset(z);
+}
+
+const VMStateDescription vmstate_z80_cpu = {
+    .name = "z80-cpu",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT8(a, Z80CPU),
+        VMSTATE_UINT8(f, Z80CPU),
+        VMSTATE_UINT8(b, Z80CPU),
+        VMSTATE_UINT8(c, Z80CPU),
+        VMSTATE_UINT8(d, Z80CPU),
+        VMSTATE_UINT8(e, Z80CPU),
+        VMSTATE_UINT8(h, Z80CPU),
+        VMSTATE_UINT8(l, Z80CPU),
+        VMSTATE_UINT16(af2, Z80CPU),
+        VMSTATE_UINT16(bc2, Z80CPU),
+        VMSTATE_UINT16(de2, Z80CPU),
+        VMSTATE_UINT16(hl2, Z80CPU),
+        VMSTATE_UINT16(ix, Z80CPU),
+        VMSTATE_UINT16(iy, Z80CPU),
+        VMSTATE_UINT16(sp, Z80CPU),
+        VMSTATE_UINT16(pc, Z80CPU),
+        VMSTATE_UINT8(i, Z80CPU),
+        VMSTATE_UINT8(r, Z80CPU),
+        VMSTATE_UINT8(im, Z80CPU),
+        VMSTATE_BOOL(iff1, Z80CPU),
+        VMSTATE_BOOL(iff2, Z80CPU),
+        VMSTATE_BOOL(halted, Z80CPU),
+        VMSTATE_BOOL(ei_delay, Z80CPU),
+        VMSTATE_BOOL(irq, Z80CPU),
+        VMSTATE_END_OF_LIST()
+    }
+};
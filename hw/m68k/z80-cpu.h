@@ -0,0 +1,81 @@
+/*
+ * Zilog Z80 interpreter
+ *
+ * A plain instruction interpreter for the Genesis sound coprocessor.  It
+ * is not a QEMU CPU: the Z80 is driven by its owning device, which runs
+ * it for a budget of T-states at a time and provides the bus.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef HW_M68K_Z80_CPU_H
+#define HW_M68K_Z80_CPU_H
+
+#define Z80_FLAG_C 0x01
+#define Z80_FLAG_N 0x02
+#define Z80_FLAG_PV 0x04
+#define Z80_FLAG_X 0x08
+#define Z80_FLAG_H 0x10
+#define Z80_FLAG_Y 0x20
+#define Z80_FLAG_Z 0x40
+#define Z80_FLAG_S 0x80
+
+typedef struct Z80Bus
+{
+    uint8_t (*read)(void *opaque, uint16_t addr);
+    void (*write)(void *opaque, uint16_t addr, uint8_t value);
+    uint8_t (*in)(void *opaque, uint16_t port);
+    void (*out)(void *opaque, uint16_t port, uint8_t value);
+} Z80Bus;
+
+typedef struct Z80CPU
+{
+    uint8_t a, f, b, c, d, e, h, l;
+    /* Alternate set, as AF', BC', DE', HL' */
+    uint16_t af2, bc2, de2, hl2;
+    uint16_t ix, iy, sp, pc;
+    uint8_t i, r;
+    uint8_t im;
+    bool iff1;
+    bool iff2;
+    bool halted;
+
+    /* The instruction after EI runs before an interrupt is taken */
+    bool ei_delay;
+
+    /* Level of the /INT line */
+    bool irq;
+
+    const Z80Bus *bus;
+    void *opaque;
+} Z80CPU;
+
+void z80_init(Z80CPU *z, const Z80Bus *bus, void *opaque);
+void z80_reset(Z80CPU *z);
+
+/*
+ * Run for at least @cycles T-states, stopping at an instruction boundary.
+ * Returns the T-states actually used.
+ */
+int z80_run(Z80CPU *z, int cycles);
+
+/* Registers and interrupt state, for the owning device's VMState */
+extern const VMStateDescription vmstate_z80_cpu;
+
+#endif /* HW_M68K_Z80_CPU_H */
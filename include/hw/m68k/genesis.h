@@ -12,7 +12,99 @@
 #ifndef NEXT_CUBE_H
 #define NEXT_CUBE_H
 
+#include "qemu/notify.h"
+
 #define TYPE_GENESIS_CTRLS "genesis-ctrls"
+#define TYPE_GENESIS_MAPPER "genesis-mapper"
 #define TYPE_YM7101 "ym7101"
+#define TYPE_GENESIS_Z80 "genesis-z80"
+#define TYPE_YM2612 "ym2612"
+#define TYPE_SN76489 "sn76489"
+
+/* Pad buttons, as passed to genesis_ctrls_set_buttons() */
+#define GENESIS_BUTTON_UP 0x0001
+#define GENESIS_BUTTON_DOWN 0x0002
+#define GENESIS_BUTTON_LEFT 0x0004
+#define GENESIS_BUTTON_RIGHT 0x0008
+#define GENESIS_BUTTON_B 0x0010
+#define GENESIS_BUTTON_C 0x0020
+#define GENESIS_BUTTON_A 0x0040
+#define GENESIS_BUTTON_START 0x0080
+#define GENESIS_BUTTON_Z 0x0100
+#define GENESIS_BUTTON_Y 0x0200
+#define GENESIS_BUTTON_X 0x0400
+#define GENESIS_BUTTON_MODE 0x0800
+
+/* genesis-ctrls.c: set the buttons held on pad port (0 or 1) */
+void genesis_ctrls_set_buttons(DeviceState *dev, int port, uint16_t pressed);
+
+/*
+ * genesis-ctrls.c: host input on pad 1.  @notifier is called with the
+ * buttons held whenever they change; set_host_buttons puts them back
+ * after a snapshot restore.
+ */
+void genesis_ctrls_add_input_notifier(DeviceState *dev, Notifier *notifier);
+void genesis_ctrls_set_host_buttons(DeviceState *dev, uint16_t pressed);
+
+/* ym7101.c: called with NULL once per frame, when vertical blank starts */
+void ym7101_add_frame_notifier(DeviceState *dev, Notifier *notifier);
+
+/* ym7101.c: keep drawing, but show nothing new until released */
+void ym7101_hold_display(DeviceState *dev, bool hold);
+
+/* genesis-z80.c: bus control from the 68000 side, and the VDP interrupt */
+void genesis_z80_set_busreq(DeviceState *dev, bool request);
+void genesis_z80_set_reset(DeviceState *dev, bool reset);
+bool genesis_z80_bus_granted(DeviceState *dev);
+void genesis_z80_vint(DeviceState *dev);
+
+/* ym2612.c: the four ports at 0xA04000, from either CPU */
+uint8_t ym2612_read(DeviceState *dev, unsigned addr);
+void ym2612_write(DeviceState *dev, unsigned addr, uint8_t value);
+
+/* ym2612.c: render no audio, FM or PSG, past @limit_ns (INT64_MAX: none) */
+void ym2612_set_render_limit(DeviceState *dev, int64_t limit_ns);
+
+/*
+ * sn76489.c: the PSG port on the VDP.  Writes are only recorded; the FM
+ * chip's audio callback renders the PSG for the virtual time span
+ * [@start, @end) ns and adds it into its interleaved stereo @buf.
+ */
+void sn76489_write(DeviceState *dev, uint8_t value);
+void sn76489_render(DeviceState *dev, int16_t *buf, int samples, int rate,
+                    int64_t start, int64_t end);
+
+/* genesis-bench.c */
+void genesis_bench_init(DeviceState *vdp, uint32_t frames,
+                        const char *hash_file, Error **errp);
+
+/*
+ * genesis-snapshot.c: @slots in-memory copies of the machine state,
+ * without going through a migration stream
+ */
+typedef struct GenesisSnapshot GenesisSnapshot;
+GenesisSnapshot *genesis_snapshot_new(Object *machine, int slots,
+                                      Error **errp);
+void genesis_snapshot_free(GenesisSnapshot *snap);
+void genesis_snapshot_save(GenesisSnapshot *snap, int slot);
+void genesis_snapshot_load(GenesisSnapshot *snap, int slot);
+int64_t genesis_snapshot_time(GenesisSnapshot *snap, int slot);
+
+/*
+ * Whether a snapshot or rewind capture holds @rb.  ROMs, including the
+ * cartridge mapped from its file, never change.  Both restore these
+ * blocks before the devices, so that post_load hooks see the memory
+ * they go with.
+ */
+bool genesis_snapshot_ram_block(RAMBlock *rb);
+
+/* genesis-runahead.c: show @frames frames ahead of the pad input */
+void genesis_runahead_init(Object *machine, DeviceState *vdp,
+                           DeviceState *fm, DeviceState *ctrls,
+                           uint32_t frames, Error **errp);
+
+/* genesis-rewind.c: snapshot every @interval frames, keep the last @depth */
+void genesis_rewind_init(DeviceState *vdp, uint32_t interval, uint32_t depth,
+                         Error **errp);
 
 #endif /* NEXT_CUBE_H */
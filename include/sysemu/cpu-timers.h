@@ -50,6 +50,13 @@ int64_t icount_get(void);
  */
 int64_t icount_to_ns(int64_t icount);
 
+/*
+ * move the virtual clock to @ns, backwards or forwards, without touching
+ * the instruction count.  For rolling a machine back to an in-memory
+ * snapshot; must be called from the vCPU thread outside of cpu_exec.
+ */
+void icount_set_ns(int64_t ns);
+
 /* configure the icount options, including "shift" */
 void icount_configure(QemuOpts *opts, Error **errp);
 
@@ -0,0 +1,14 @@
+/*
+ * Sega Genesis rewind stubs
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
+
+void qmp_x_genesis_rewind(uint32_t frames, Error **errp)
+{
+    error_setg(errp, "Sega Genesis machine not present");
+}
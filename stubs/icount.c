@@ -30,6 +30,10 @@ int64_t icount_to_ns(int64_t icount)
     abort();
     return 0;
 }
+void icount_set_ns(int64_t ns)
+{
+    abort();
+}
 int64_t icount_round(int64_t count)
 {
     abort();
@@ -0,0 +1,15 @@
+/*
+ * YM7101 VDP stubs
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
+
+HumanReadableText *qmp_x_query_ym7101(Error **errp)
+{
+    error_setg(errp, "YM7101 VDP not present");
+    return NULL;
+}
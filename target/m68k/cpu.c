@@ -22,6 +22,7 @@
 #include "qapi/error.h"
 #include "cpu.h"
 #include "migration/vmstate.h"
+#include "hw/qdev-properties.h"
 #include "fpu/softfloat.h"
 
 static void m68k_cpu_set_pc(CPUState *cs, vaddr value)
@@ -49,6 +50,8 @@ static void m68k_restore_state_to_opc(CPUState *cs,
     if (cc_op != CC_OP_DYNAMIC) {
         cpu->env.cc_op = cc_op;
     }
+    /* The TB is left early: charge the insns before this one */
+    cpu->env.cycles += data[2];
 }
 
 static bool m68k_cpu_has_work(CPUState *cs)
@@ -136,6 +139,7 @@ static void m68000_cpu_initfn(Object *obj)
     m68k_set_feature(env, M68K_FEATURE_USP);
     m68k_set_feature(env, M68K_FEATURE_WORD_INDEX);
     m68k_set_feature(env, M68K_FEATURE_MOVEP);
+    m68k_set_feature(env, M68K_FEATURE_ADDR24);
 }
 
 /*
@@ -168,6 +172,7 @@ static void m68020_cpu_initfn(Object *obj)
 
     m68010_cpu_initfn(obj);
     m68k_unset_feature(env, M68K_FEATURE_M68010);
+    m68k_unset_feature(env, M68K_FEATURE_ADDR24);
     m68k_set_feature(env, M68K_FEATURE_M68020);
     m68k_set_feature(env, M68K_FEATURE_QUAD_MULDIV);
     m68k_set_feature(env, M68K_FEATURE_BRAL);
@@ -488,6 +493,24 @@ const VMStateDescription vmstate_68040_spregs = {
     }
 };
 
+static bool cycles_needed(void *opaque)
+{
+    M68kCPU *s = opaque;
+
+    return s->env.cycles != 0;
+}
+
+static const VMStateDescription vmstate_cycles = {
+    .name = "cpu/cycles",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = cycles_needed,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT64(env.cycles, M68kCPU),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription vmstate_m68k_cpu = {
     .name = "cpu",
     .version_id = 1,
@@ -514,6 +537,7 @@ static const VMStateDescription vmstate_m68k_cpu = {
         &vmstate_cf_spregs,
         &vmstate_68040_mmu,
         &vmstate_68040_spregs,
+        &vmstate_cycles,
         NULL
     },
 };
@@ -539,6 +563,11 @@ static const struct TCGCPUOps m68k_tcg_ops = {
 #endif /* !CONFIG_USER_ONLY */
 };
 
+static Property m68k_cpu_properties[] = {
+    DEFINE_PROP_UINT32("x-superblock", M68kCPU, superblock, 0),
+    DEFINE_PROP_END_OF_LIST()
+};
+
 static void m68k_cpu_class_init(ObjectClass *c, void *data)
 {
     M68kCPUClass *mcc = M68K_CPU_CLASS(c);
@@ -548,6 +577,7 @@ static void m68k_cpu_class_init(ObjectClass *c, void *data)
 
     device_class_set_parent_realize(dc, m68k_cpu_realizefn,
                                     &mcc->parent_realize);
+    device_class_set_props(dc, m68k_cpu_properties);
     resettable_class_set_parent_phases(rc, NULL, m68k_cpu_reset_hold, NULL,
                                        &mcc->parent_phases);
 
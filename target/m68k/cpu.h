@@ -76,7 +76,7 @@
 #define M68K_MAX_TTR 2
 #define TTR(type, index) ttr[((type & ACCESS_CODE) == ACCESS_CODE) * 2 + index]
 
-#define TARGET_INSN_START_EXTRA_WORDS 1
+#define TARGET_INSN_START_EXTRA_WORDS 2
 
 typedef CPU_LDoubleU FPReg;
 
@@ -155,6 +155,9 @@ typedef struct CPUArchState {
 
     /* Fields from here on are preserved across CPU reset. */
     uint64_t features;
+
+    /* MC68000 clock periods executed, see m68000_cycles in translate.c */
+    uint64_t cycles;
 } CPUM68KState;
 
 /*
@@ -167,6 +170,13 @@ struct ArchCPU {
     CPUState parent_obj;
 
     CPUM68KState env;
+
+    /* Interrupt acknowledge hook, see m68k_set_iack_handler() */
+    void (*iack_handler)(void *opaque, int level);
+    void *iack_opaque;
+
+    /* Insns before a TB stops following branches, 0 to stop at each one */
+    uint32_t superblock;
 };
 
 /*
@@ -302,6 +312,9 @@ typedef enum {
                               M68K_MMU_CM_040 | M68K_MMU_M_040 | \
                               M68K_MMU_WP_040)
 
+/* Address lines decoded by the 68000 and 68010 */
+#define M68K_ADDR24_MASK 0x00ffffff
+
 /* bits for 68040 MMU Translation Control Register */
 #define M68K_TCR_ENABLED 0x8000
 #define M68K_TCR_PAGE_8K 0x4000
@@ -470,6 +483,9 @@ typedef enum {
 #define MACSR_EV    0x001
 
 void m68k_set_irq_level(M68kCPU *cpu, int level, uint8_t vector);
+void m68k_set_iack_handler(M68kCPU *cpu,
+                           void (*handler)(void *opaque, int level),
+                           void *opaque);
 void m68k_switch_sp(CPUM68KState *env);
 
 void do_m68k_semihosting(CPUM68KState *env, int nr);
@@ -549,6 +565,8 @@ enum m68k_features {
     M68K_FEATURE_TRAPCC,
     /* MOVE from SR privileged (from 68010) */
     M68K_FEATURE_MOVEFROMSR_PRIV,
+    /* 24-bit address bus, A24-A31 are not decoded. (680[01]0) */
+    M68K_FEATURE_ADDR24,
 };
 
 static inline bool m68k_feature(CPUM68KState *env, int feature)
@@ -943,6 +943,9 @@ hwaddr m68k_cpu_get_phys_page_debug(CPUState *cs, vaddr addr)
 
     if ((env->mmu.tcr & M68K_TCR_ENABLED) == 0) {
         /* MMU disabled */
+        if (m68k_feature(env, M68K_FEATURE_ADDR24)) {
+            return addr & M68K_ADDR24_MASK;
+        }
         return addr;
     }
 
@@ -979,6 +982,20 @@ void m68k_set_irq_level(M68kCPU *cpu, int level, uint8_t vector)
     }
 }
 
+/*
+ * Devices that drop their request on the IACK cycle, rather than on a
+ * register access from the handler, can register a hook here.  It is
+ * called with the level being acknowledged once the exception frame
+ * has been built, and may call m68k_set_irq_level() again.
+ */
+void m68k_set_iack_handler(M68kCPU *cpu,
+                           void (*handler)(void *opaque, int level),
+                           void *opaque)
+{
+    cpu->iack_handler = handler;
+    cpu->iack_opaque = opaque;
+}
+
 bool m68k_cpu_tlb_fill(CPUState *cs, vaddr address, int size,
                        MMUAccessType qemu_access_type, int mmu_idx,
                        bool probe, uintptr_t retaddr)
@@ -993,8 +1010,17 @@ bool m68k_cpu_tlb_fill(CPUState *cs, vaddr address, int size,
 
     if ((env->mmu.tcr & M68K_TCR_ENABLED) == 0) {
         /* MMU disabled */
+        physical = address;
+        if (m68k_feature(env, M68K_FEATURE_ADDR24)) {
+            /*
+             * Every 16 MiB of the address space then aliases the bus.
+             * The TLB keeps the full virtual address, so the aliases
+             * stay on the fast path once filled.
+             */
+            physical &= M68K_ADDR24_MASK;
+        }
         tlb_set_page(cs, address & TARGET_PAGE_MASK,
-                     address & TARGET_PAGE_MASK,
+                     physical & TARGET_PAGE_MASK,
                      PAGE_READ | PAGE_WRITE | PAGE_EXEC,
                      mmu_idx, TARGET_PAGE_SIZE);
         return true;
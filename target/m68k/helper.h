@@ -14,6 +14,9 @@ DEF_HELPER_2(m68k_movec_from, i32, env, i32)
 DEF_HELPER_4(cas2w, void, env, i32, i32, i32)
 DEF_HELPER_4(cas2l, void, env, i32, i32, i32)
 DEF_HELPER_4(cas2l_parallel, void, env, i32, i32, i32)
+DEF_HELPER_4(movem_load, i32, env, i32, i32, i32)
+DEF_HELPER_4(movem_store, i32, env, i32, i32, i32)
+DEF_HELPER_6(copy_loop, i32, env, i32, i32, i32, i32, i32)
 
 #define dh_alias_fp ptr
 #define dh_ctype_fp FPReg *
@@ -22,6 +22,7 @@
 #include "exec/helper-proto.h"
 #include "exec/exec-all.h"
 #include "exec/cpu_ldst.h"
+#include "sysemu/cpu-timers.h"
 #include "semihosting/semihost.h"
 
 #if !defined(CONFIG_USER_ONLY)
@@ -460,9 +461,10 @@ void m68k_cpu_transaction_failed(CPUState *cs, hwaddr physaddr, vaddr addr,
     M68kCPU *cpu = M68K_CPU(cs);
     CPUM68KState *env = &cpu->env;
 
-    cpu_restore_state(cs, retaddr);
-
     if (m68k_feature(env, M68K_FEATURE_M68040)) {
+        /* Unwind only when leaving the TB, the access is ignored otherwise */
+        cpu_restore_state(cs, retaddr);
+
         env->mmu.mmusr = 0;
 
         /*
@@ -520,10 +522,16 @@ bool m68k_cpu_exec_interrupt(CPUState *cs, int interrupt_request)
          * Real hardware gets the interrupt vector via an IACK cycle
          * at this point.  Current emulated hardware doesn't rely on
          * this, so we provide/save the vector when the interrupt is
-         * first signalled.
+         * first signalled.  Devices that need to see the acknowledge
+         * itself register an iack_handler.
          */
+        int level = env->pending_level;
+
         cs->exception_index = env->pending_vector;
         do_interrupt_m68k_hardirq(env);
+        if (cpu->iack_handler) {
+            cpu->iack_handler(cpu->iack_opaque, level);
+        }
         return true;
     }
     return false;
@@ -870,6 +878,122 @@ void HELPER(cas2l_parallel)(CPUM68KState *env, uint32_t regs, uint32_t a1,
     do_cas2l(env, regs, a1, a2, true);
 }
 
+/*
+ * Block transfers, for MOVEM and the move (Ay)+,(Ax)+ / dbf copy loop.
+ * Each range must lie within one page: it is probed once, which raises
+ * any fault before memory changes, and RAM is then accessed through the
+ * host pointer.  They return 0 without doing anything for MMIO,
+ * watchpoints or a range crossing a page; the translated code then does
+ * the transfer one access at a time.
+ */
+static void *block_probe(CPUM68KState *env, uint32_t addr, uint32_t len,
+                         MMUAccessType access_type, uintptr_t ra)
+{
+    void *host;
+    int flags;
+
+    if ((addr & ~TARGET_PAGE_MASK) + len > TARGET_PAGE_SIZE) {
+        return NULL;
+    }
+    flags = probe_access_flags(env, addr, len, access_type,
+                               cpu_mmu_index(env, false), false, &host, ra);
+    return flags ? NULL : host;
+}
+
+static uint32_t *block_reg(CPUM68KState *env, int i)
+{
+    return i < 8 ? &env->dregs[i] : &env->aregs[i - 8];
+}
+
+uint32_t HELPER(movem_load)(CPUM68KState *env, uint32_t addr, uint32_t mask,
+                            uint32_t size)
+{
+    uint8_t *host = block_probe(env, addr, ctpop16(mask) * size,
+                                MMU_DATA_LOAD, GETPC());
+    int i;
+
+    if (!host) {
+        return 0;
+    }
+    for (i = 0; i < 16; i++) {
+        if (mask & (1 << i)) {
+            /* Words are sign extended, to address and data registers alike */
+            *block_reg(env, i) = size == 4 ? ldl_be_p(host)
+                                           : (int16_t)lduw_be_p(host);
+            host += size;
+        }
+    }
+    return 1;
+}
+
+/* @mask has register 0 at bit 0, also for the predecrement mode */
+uint32_t HELPER(movem_store)(CPUM68KState *env, uint32_t addr, uint32_t mask,
+                             uint32_t size)
+{
+    uint8_t *host = block_probe(env, addr, ctpop16(mask) * size,
+                                MMU_DATA_STORE, GETPC());
+    int i;
+
+    if (!host) {
+        return 0;
+    }
+    for (i = 0; i < 16; i++) {
+        if (mask & (1 << i)) {
+            if (size == 4) {
+                stl_be_p(host, *block_reg(env, i));
+            } else {
+                stw_be_p(host, *block_reg(env, i));
+            }
+            host += size;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Copy up to @count elements of @size bytes from @src to @dst, as far as
+ * both stay within their pages, and return how many were copied.  Each
+ * element is loaded then stored, in order, so overlapping ranges give
+ * what the loop would.  @cycles is charged for each.  Under icount each
+ * also counts as its move and dbf, out of what is left of the budget.
+ */
+uint32_t HELPER(copy_loop)(CPUM68KState *env, uint32_t src, uint32_t dst,
+                           uint32_t count, uint32_t size, uint32_t cycles)
+{
+    CPUState *cs = env_cpu(env);
+    uintptr_t ra = GETPC();
+    uint32_t room = TARGET_PAGE_SIZE - MAX(src & ~TARGET_PAGE_MASK,
+                                           dst & ~TARGET_PAGE_MASK);
+    uint32_t n = MIN(count, room / size);
+    uint8_t *s, *d;
+    uint32_t i;
+
+    if (icount_enabled()) {
+        n = MIN(n, cs->neg.icount_decr.u16.low / 2);
+    }
+    if (!n) {
+        return 0;
+    }
+    s = block_probe(env, src, n * size, MMU_DATA_LOAD, ra);
+    d = s ? block_probe(env, dst, n * size, MMU_DATA_STORE, ra) : NULL;
+    if (!d) {
+        return 0;
+    }
+
+    for (i = 0; i < n; i++, s += size, d += size) {
+        if (size == 4) {
+            stl_be_p(d, ldl_be_p(s));
+        } else {
+            stw_be_p(d, lduw_be_p(s));
+        }
+    }
+    env->cycles += (uint64_t)n * cycles;
+    if (icount_enabled()) {
+        cs->neg.icount_decr.u16.low -= 2 * n;
+    }
+    return n;
+}
+
 struct bf_data {
     uint32_t addr;
     uint32_t bofs;
@@ -24,6 +24,7 @@
 #include "exec/exec-all.h"
 #include "tcg/tcg-op.h"
 #include "qemu/log.h"
+#include "qemu/bitmap.h"
 #include "qemu/qemu-print.h"
 #include "exec/translator.h"
 
@@ -122,6 +123,15 @@ typedef struct DisasContext {
     int writeback_mask;
     TCGv writeback[8];
     bool ss_active;
+    bool count_cycles;
+    int cycles; /* MC68000 clock periods of the insns so far */
+    bool cc_liveness;
+    bool cc_dead_on_entry; /* the first insn overwrites N, Z, V and C */
+    bool bulk_mem;         /* block transfers may probe a page at once */
+    uint32_t superblock;
+    target_ulong pc_end;   /* end of the code read, for invalidation */
+    bool in_call;          /* followed a call, which returns to ret_pc */
+    target_ulong ret_pc;
 } DisasContext;
 
 static TCGv get_areg(DisasContext *s, unsigned regno)
@@ -237,6 +247,18 @@ static void set_cc_op(DisasContext *s, CCOp op)
     }
 }
 
+/*
+ * N, Z, V and C are about to be overwritten without being read: drop
+ * them, so that TCG neither computes nor stores the old values.
+ */
+static void gen_discard_flags(void)
+{
+    tcg_gen_discard_i32(QREG_CC_N);
+    tcg_gen_discard_i32(QREG_CC_Z);
+    tcg_gen_discard_i32(QREG_CC_V);
+    tcg_gen_discard_i32(QREG_CC_C);
+}
+
 /* Update the CPU env CC_OP state.  */
 static void update_cc_op(DisasContext *s)
 {
@@ -262,8 +284,33 @@ static void gen_jmp(DisasContext *s, TCGv dest)
     s->base.is_jmp = DISAS_JUMP;
 }
 
-static void gen_raise_exception(int nr)
+/* MC68000 clock periods of each opcode, filled in by register_cycles() */
+static uint8_t cycle_table[65536];
+
+static void add_cycles(DisasContext *s, int cycles)
 {
+    if (s->count_cycles) {
+        s->cycles += cycles;
+    }
+}
+
+/* Charge the cycles of the whole TB, on each way out of it */
+static void gen_charge_cycles(DisasContext *s)
+{
+    TCGv_i64 tmp;
+
+    if (!s->cycles) {
+        return;
+    }
+    tmp = tcg_temp_new_i64();
+    tcg_gen_ld_i64(tmp, tcg_env, offsetof(CPUM68KState, cycles));
+    tcg_gen_addi_i64(tmp, tmp, s->cycles);
+    tcg_gen_st_i64(tmp, tcg_env, offsetof(CPUM68KState, cycles));
+}
+
+static void gen_raise_exception(DisasContext *s, int nr)
+{
+    gen_charge_cycles(s);
     gen_helper_raise_exception(tcg_env, tcg_constant_i32(nr));
 }
 
@@ -278,7 +325,7 @@ static void gen_raise_exception_format2(DisasContext *s, int nr,
      */
     tcg_gen_st_i32(tcg_constant_i32(this_pc), tcg_env,
                    offsetof(CPUM68KState, mmu.ar));
-    gen_raise_exception(nr);
+    gen_raise_exception(s, nr);
     s->base.is_jmp = DISAS_NORETURN;
 }
 
@@ -287,7 +334,7 @@ static void gen_exception(DisasContext *s, uint32_t dest, int nr)
     update_cc_op(s);
     tcg_gen_movi_i32(QREG_PC, dest);
 
-    gen_raise_exception(nr);
+    gen_raise_exception(s, nr);
 
     s->base.is_jmp = DISAS_NORETURN;
 }
@@ -1382,6 +1429,39 @@ static void gen_exit_tb(DisasContext *s)
         }                                                               \
     } while (0)
 
+/*
+ * Superblocks: translate on at the target of an unconditional branch or
+ * call instead of leaving the TB.  A write to the code invalidates the
+ * TBs whose range [pc_first, pc_first + size) covers it, so every insn
+ * read must lie in that range: targets are kept on the first page, at
+ * or after pc_first, and pc_end records how far the code goes.  Loops
+ * are left to goto_tb, and calls nest only one deep.
+ */
+static bool follow_branch(DisasContext *s, target_ulong dest, bool call)
+{
+    target_ulong page = s->base.pc_first & TARGET_PAGE_MASK;
+
+    if (s->base.num_insns >= s->superblock || s->ss_active) {
+        return false;
+    }
+    if (dest < s->base.pc_first || dest - page >= TARGET_PAGE_SIZE - 32) {
+        return false;
+    }
+    if (call) {
+        if (s->in_call) {
+            return false;
+        }
+        s->in_call = true;
+        s->ret_pc = s->pc;
+    } else if (dest <= s->base.pc_next) {
+        return false;
+    }
+
+    s->pc_end = MAX(s->pc_end, s->pc);
+    s->pc = dest;
+    return true;
+}
+
 /* Generate a jump to an immediate address.  */
 static void gen_jmp_tb(DisasContext *s, int n, target_ulong dest,
                        target_ulong src)
@@ -1390,12 +1470,22 @@ static void gen_jmp_tb(DisasContext *s, int n, target_ulong dest,
         update_cc_op(s);
         tcg_gen_movi_i32(QREG_PC, dest);
         gen_raise_exception_format2(s, EXCP_TRACE, src);
-    } else if (translator_use_goto_tb(&s->base, dest)) {
+        s->base.is_jmp = DISAS_NORETURN;
+        return;
+    }
+
+    /* Looping back to our own start, whose first insn sets all flags */
+    if (dest == s->base.pc_first && s->cc_dead_on_entry) {
+        gen_discard_flags();
+    }
+    if (translator_use_goto_tb(&s->base, dest)) {
+        gen_charge_cycles(s);
         tcg_gen_goto_tb(n);
         tcg_gen_movi_i32(QREG_PC, dest);
         tcg_gen_exit_tb(s->base.tb, n);
     } else {
         gen_jmp_im(s, dest);
+        gen_charge_cycles(s);
         tcg_gen_exit_tb(NULL, 0);
     }
     s->base.is_jmp = DISAS_NORETURN;
@@ -1437,6 +1527,8 @@ DISAS_INSN(dbcc)
     tcg_gen_brcondi_i32(TCG_COND_EQ, tmp, -1, l1);
     gen_jmp_tb(s, 1, base + offset, s->base.pc_next);
     gen_set_label(l1);
+    /* Falling through, whether on the condition or the count, is slower */
+    add_cycles(s, 2);
     gen_jmp_tb(s, 0, s->pc, s->base.pc_next);
 }
 
@@ -1895,9 +1987,65 @@ static TCGv mreg(int reg)
     return cpu_aregs[reg & 7];
 }
 
+/* Below this, the inline TLB compare of each access is cheaper */
+#define MOVEM_BULK_REGS 6
+
+/*
+ * Try the whole of a MOVEM in one helper call, which probes the page once
+ * and copies through the host pointer.  Returns the label to branch to
+ * once done, or NULL if not attempted.  When the helper declines, for
+ * MMIO or a page crossing, the per-register code that follows runs.
+ * The 68020 stores the An of -(An) decremented, which is left to that
+ * code too.
+ */
+static TCGLabel *gen_movem_bulk(DisasContext *s, bool is_load, int mode,
+                                int reg0, int opsize, uint16_t mask,
+                                TCGv addr)
+{
+    int len = ctpop16(mask) * opsize_bytes(opsize);
+    TCGv size = tcg_constant_i32(opsize_bytes(opsize));
+    TCGLabel *l_slow, *l_done;
+    TCGv done, start;
+
+    if (!s->bulk_mem || ctpop16(mask) < MOVEM_BULK_REGS ||
+        (mode == 4 && (mask & (0x80 >> reg0)) &&
+         m68k_feature(s->env, M68K_FEATURE_EXT_FULL))) {
+        return NULL;
+    }
+
+    done = tcg_temp_new();
+    start = addr;
+    if (is_load) {
+        gen_helper_movem_load(done, tcg_env, addr,
+                              tcg_constant_i32(mask), size);
+    } else if (mode == 4) {
+        /* The registers go from the bottom of the block, in reverse order */
+        start = tcg_temp_new();
+        tcg_gen_subi_i32(start, addr, len);
+        gen_helper_movem_store(done, tcg_env, start,
+                               tcg_constant_i32(revbit16(mask)), size);
+    } else {
+        gen_helper_movem_store(done, tcg_env, addr,
+                               tcg_constant_i32(mask), size);
+    }
+
+    l_slow = gen_new_label();
+    l_done = gen_new_label();
+    tcg_gen_brcondi_i32(TCG_COND_EQ, done, 0, l_slow);
+    if (mode == 3) {
+        tcg_gen_addi_i32(cpu_aregs[reg0], addr, len);
+    } else if (mode == 4) {
+        tcg_gen_mov_i32(cpu_aregs[reg0], start);
+    }
+    tcg_gen_br(l_done);
+    gen_set_label(l_slow);
+    return l_done;
+}
+
 DISAS_INSN(movem)
 {
     TCGv addr, incr, tmp, r[16];
+    TCGLabel *l_done;
     int is_load = (insn & 0x0400) != 0;
     int opsize = (insn & 0x40) != 0 ? OS_LONG : OS_WORD;
     uint16_t mask = read_im16(env, s);
@@ -1946,6 +2094,8 @@ DISAS_INSN(movem)
     addr = tcg_temp_new();
     tcg_gen_mov_i32(addr, tmp);
     incr = tcg_constant_i32(opsize_bytes(opsize));
+    add_cycles(s, ctpop16(mask) * (opsize == OS_LONG ? 8 : 4));
+    l_done = gen_movem_bulk(s, is_load, mode, reg0, opsize, mask, addr);
 
     if (is_load) {
         /* memory to register */
@@ -1999,6 +2149,9 @@ DISAS_INSN(movem)
             }
         }
     }
+    if (l_done) {
+        gen_set_label(l_done);
+    }
 }
 
 DISAS_INSN(movep)
@@ -2443,6 +2596,53 @@ DISAS_INSN(byterev)
     tcg_gen_bswap32_i32(reg, reg);
 }
 
+/*
+ * move.l or move.w (Ay)+,(Ax)+ followed by dbf Dn back to it is the
+ * usual block copy.  Before the iteration at hand runs as normal code,
+ * copy as many of the following ones as fit in the pages of both
+ * pointers in one helper call, and step An and Dn past them.  Should
+ * the normal code then fault, the loop is left exactly as after those
+ * iterations.  Under icount the helper takes the iterations it copies
+ * out of the insn budget, and copies no more than the budget allows.
+ */
+static void gen_copy_loop(CPUM68KState *env, DisasContext *s, uint16_t insn,
+                          int opsize)
+{
+    TCGv src = cpu_aregs[REG(insn, 0)];
+    TCGv dst = cpu_aregs[REG(insn, 9)];
+    TCGv count, done;
+    uint16_t next;
+    int cycles;
+
+    /* ColdFire has no dbcc: 0x51c8 is not dbf there */
+    if (!s->bulk_mem || !m68k_feature(env, M68K_FEATURE_M68K) ||
+        opsize == OS_BYTE || extract32(insn, 3, 3) != 3 ||
+        extract32(insn, 6, 3) != 3 || REG(insn, 0) == REG(insn, 9) ||
+        s->base.max_insns == 1) {
+        return;
+    }
+    next = translator_lduw(env, &s->base, s->pc);
+    if ((next & 0xfff8) != 0x51c8 ||
+        translator_lduw(env, &s->base, s->pc + 2) != 0xfffc) {
+        return;
+    }
+    /* A write to the dbf must invalidate this TB, which relies on it */
+    s->pc_end = MAX(s->pc_end, s->pc + 4);
+    cycles = s->count_cycles ? cycle_table[insn] + cycle_table[next] : 0;
+
+    count = tcg_temp_new();
+    tcg_gen_ext16u_i32(count, DREG(next, 0));
+    done = tcg_temp_new();
+    gen_helper_copy_loop(done, tcg_env, src, dst, count,
+                         tcg_constant_i32(opsize_bytes(opsize)),
+                         tcg_constant_i32(cycles));
+    /* The count stays >= 0, so the low word does not borrow */
+    tcg_gen_sub_i32(DREG(next, 0), DREG(next, 0), done);
+    tcg_gen_shli_i32(done, done, opsize == OS_LONG ? 2 : 1);
+    tcg_gen_add_i32(src, src, done);
+    tcg_gen_add_i32(dst, dst, done);
+}
+
 DISAS_INSN(move)
 {
     TCGv src;
@@ -2463,6 +2663,7 @@ DISAS_INSN(move)
     default:
         abort();
     }
+    gen_copy_loop(env, s, insn, opsize);
     SRC_EA(env, src, opsize, 1, NULL);
     op = (insn >> 6) & 7;
     if (op == 1) {
@@ -2861,26 +3062,74 @@ DISAS_INSN(rts)
 
     tmp = gen_load(s, OS_LONG, QREG_SP, 0, IS_USER(s));
     tcg_gen_addi_i32(QREG_SP, QREG_SP, 4);
+    if (s->in_call) {
+        /* Back from a followed call, unless it changed its return address */
+        TCGLabel *l1 = gen_new_label();
+
+        s->in_call = false;
+        update_cc_op(s);
+        tcg_gen_brcondi_i32(TCG_COND_EQ, tmp, s->ret_pc, l1);
+        tcg_gen_mov_i32(QREG_PC, tmp);
+        gen_charge_cycles(s);
+        tcg_gen_lookup_and_goto_ptr();
+        gen_set_label(l1);
+        s->pc_end = MAX(s->pc_end, s->pc);
+        s->pc = s->ret_pc;
+        return;
+    }
     gen_jmp(s, tmp);
 }
 
+/* The absolute and PC relative targets of jmp and jsr are constants */
+static bool jump_target_const(CPUM68KState *env, DisasContext *s,
+                              uint16_t insn, uint32_t *dest)
+{
+    if (extract32(insn, 3, 3) != 7) {
+        return false;
+    }
+    switch (REG(insn, 0)) {
+    case 0: /* Absolute short.  */
+        *dest = (int16_t)read_im16(env, s);
+        return true;
+    case 1: /* Absolute long.  */
+        *dest = read_im32(env, s);
+        return true;
+    case 2: /* pc displacement  */
+        *dest = s->pc;
+        *dest += (int16_t)read_im16(env, s);
+        return true;
+    default:
+        return false;
+    }
+}
+
 DISAS_INSN(jump)
 {
     TCGv tmp;
+    uint32_t dest;
+    bool known;
 
     /*
      * Load the target address first to ensure correct exception
      * behavior.
      */
-    tmp = gen_lea(env, s, insn, OS_LONG);
-    if (IS_NULL_QREG(tmp)) {
-        gen_addr_fault(s);
-        return;
+    known = jump_target_const(env, s, insn, &dest);
+    if (known) {
+        tmp = tcg_constant_i32(dest);
+    } else {
+        tmp = gen_lea(env, s, insn, OS_LONG);
+        if (IS_NULL_QREG(tmp)) {
+            gen_addr_fault(s);
+            return;
+        }
     }
     if ((insn & 0x40) == 0) {
         /* jsr */
         gen_push(s, tcg_constant_i32(s->pc));
     }
+    if (known && follow_branch(s, dest, (insn & 0x40) == 0)) {
+        return;
+    }
     gen_jmp(s, tmp);
 }
 
@@ -2949,6 +3198,10 @@ DISAS_INSN(branch)
     if (op == 1) {
         /* bsr */
         gen_push(s, tcg_constant_i32(s->pc));
+        add_cycles(s, 8);
+        if (follow_branch(s, base + offset, true)) {
+            return;
+        }
     }
     if (op > 1) {
         /* Bcc */
@@ -2956,8 +3209,10 @@ DISAS_INSN(branch)
         gen_jmpcc(s, ((insn >> 8) & 0xf) ^ 1, l1);
         gen_jmp_tb(s, 1, base + offset, s->base.pc_next);
         gen_set_label(l1);
+        /* Not taken, Bcc.B is faster and Bcc.W slower */
+        add_cycles(s, (int8_t)insn ? -2 : 2);
         gen_jmp_tb(s, 0, s->pc, s->base.pc_next);
-    } else {
+    } else if (op == 1 || !follow_branch(s, base + offset, false)) {
         /* Unconditional branch.  */
         update_cc_op(s);
         gen_jmp_tb(s, 0, base + offset, s->base.pc_next);
@@ -5678,6 +5933,273 @@ DISAS_INSN(to_mext)
 
 static disas_proc opcode_table[65536];
 
+/*
+ * MC68000 execution times in clock periods, from the M68000 user's
+ * manual, for each handler and effective address.  The time of an insn
+ * is a base time, register or memory, plus the time to compute and fetch
+ * its effective address.  Data dependent times are charged at their
+ * maximum, except for shift counts and branches that the handlers know.
+ */
+typedef enum {
+    CYC_NONE,   /* register time only */
+    CYC_EA,     /* plus <ea> in bits 5..0; memory time unless Dn, An, #imm */
+    CYC_QUICK,  /* as CYC_EA, but An is always long */
+    CYC_DIR,    /* as CYC_EA; Dn,<ea> when bit 8 is set also writes back */
+    CYC_MOVE,   /* plus source <ea> and destination <ea> in bits 11..6 */
+    CYC_SHIFT,  /* plus 2 per bit of an immediate count */
+    CYC_JMP,    /* plus control address time, jmp and jsr */
+    CYC_LEA,    /* plus control address time, lea and pea */
+    CYC_MOVEM,  /* plus control address time, movem; handler adds regs */
+} CycleKind;
+
+typedef enum {
+    CYC_W,      /* word operand, first time */
+    CYC_L,      /* long operand, first time */
+    CYC_SIZE,   /* operand size in bits 7..6, long takes second time */
+    CYC_MOVE_SIZE, /* operand size in bits 13..12 */
+    CYC_BIT6_L, /* bit 6 set: long operand and second time */
+    CYC_BIT8_L, /* bit 8 set: long operand and second time */
+    CYC_BIT6,   /* bit 6 set: second time, word operand */
+    CYC_BIT8,   /* bit 8 set: second time, word operand */
+    CYC_BIT10,  /* bit 10 set: second time, word operand */
+    CYC_BITOP,  /* bits 7..6 nonzero: second time, byte operand */
+} CycleSelect;
+
+typedef struct {
+    disas_proc proc;
+    uint8_t kind;
+    uint8_t select;
+    uint8_t reg[2];
+    uint8_t mem[2];
+} M68kInsnCycles;
+
+#define CYCLES(name, kind, select, r1, r2, m1, m2) \
+    { disas_##name, CYC_##kind, CYC_##select, { r1, r2 }, { m1, m2 } }
+
+static const M68kInsnCycles m68000_cycles[] = {
+    CYCLES(undef,        NONE,  W,        34,  34,  34,  34),
+    CYCLES(undef_mac,    NONE,  W,        34,  34,  34,  34),
+    CYCLES(undef_fpu,    NONE,  W,        34,  34,  34,  34),
+    CYCLES(illegal,      NONE,  W,        34,  34,  34,  34),
+    CYCLES(arith_im,     EA,    SIZE,      8,  16,  12,  20),
+    CYCLES(bitop_reg,    EA,    BITOP,     6,   8,   4,   8),
+    CYCLES(bitop_im,     EA,    BITOP,    10,  12,   8,  12),
+    CYCLES(movep,        NONE,  BIT6_L,   16,  24,  16,  24),
+    CYCLES(move,         MOVE,  MOVE_SIZE, 4,   4,   4,   4),
+    CYCLES(chk,          EA,    W,        10,  10,  10,  10),
+    CYCLES(negx,         EA,    SIZE,      4,   6,   8,  12),
+    CYCLES(clr,          EA,    SIZE,      4,   6,   8,  12),
+    CYCLES(neg,          EA,    SIZE,      4,   6,   8,  12),
+    CYCLES(not,          EA,    SIZE,      4,   6,   8,  12),
+    CYCLES(move_from_sr, EA,    W,         6,   6,   8,   8),
+    CYCLES(move_to_ccr,  EA,    W,        12,  12,  12,  12),
+    CYCLES(move_to_sr,   EA,    W,        12,  12,  12,  12),
+    CYCLES(nbcd,         EA,    W,         6,   6,   8,   8),
+    CYCLES(lea,          LEA,   W,         4,   4,   4,   4),
+    CYCLES(pea,          LEA,   W,        12,  12,  12,  12),
+    CYCLES(swap,         NONE,  W,         4,   4,   4,   4),
+    CYCLES(ext,          NONE,  W,         4,   4,   4,   4),
+    CYCLES(movem,        MOVEM, BIT10,     8,  12,   8,  12),
+    CYCLES(tst,          EA,    SIZE,      4,   4,   4,   4),
+    CYCLES(tas,          EA,    W,         4,   4,  10,  10),
+    CYCLES(halt,         NONE,  W,         4,   4,   4,   4),
+    CYCLES(trap,         NONE,  W,        34,  34,  34,  34),
+    CYCLES(link,         NONE,  W,        16,  16,  16,  16),
+    CYCLES(unlk,         NONE,  W,        12,  12,  12,  12),
+    CYCLES(move_to_usp,  NONE,  W,         4,   4,   4,   4),
+    CYCLES(move_from_usp, NONE, W,         4,   4,   4,   4),
+    CYCLES(reset,        NONE,  W,       132, 132, 132, 132),
+    CYCLES(stop,         NONE,  W,         4,   4,   4,   4),
+    CYCLES(rte,          NONE,  W,        20,  20,  20,  20),
+    CYCLES(nop,          NONE,  W,         4,   4,   4,   4),
+    CYCLES(rts,          NONE,  W,        16,  16,  16,  16),
+    CYCLES(trapv,        NONE,  W,         4,   4,   4,   4),
+    CYCLES(rtr,          NONE,  W,        20,  20,  20,  20),
+    CYCLES(jump,         JMP,   BIT6,     16,   8,  16,   8),
+    CYCLES(addsubq,      QUICK, SIZE,      4,   8,   8,  12),
+    CYCLES(scc,          EA,    W,         4,   4,   8,   8),
+    CYCLES(dbcc,         NONE,  W,        10,  10,  10,  10),
+    CYCLES(branch,       NONE,  W,        10,  10,  10,  10),
+    CYCLES(moveq,        NONE,  W,         4,   4,   4,   4),
+    CYCLES(or,           DIR,   SIZE,      4,   8,   4,   6),
+    CYCLES(and,          DIR,   SIZE,      4,   8,   4,   6),
+    CYCLES(addsub,       DIR,   SIZE,      4,   8,   4,   6),
+    CYCLES(divw,         EA,    BIT8,    140, 158, 140, 158),
+    CYCLES(mulw,         EA,    BIT8,     70,  70,  70,  70),
+    CYCLES(sbcd_reg,     NONE,  W,         6,   6,   6,   6),
+    CYCLES(sbcd_mem,     NONE,  W,        18,  18,  18,  18),
+    CYCLES(abcd_reg,     NONE,  W,         6,   6,   6,   6),
+    CYCLES(abcd_mem,     NONE,  W,        18,  18,  18,  18),
+    CYCLES(subx_reg,     NONE,  SIZE,      4,   8,   4,   8),
+    CYCLES(subx_mem,     NONE,  SIZE,     18,  30,  18,  30),
+    CYCLES(addx_reg,     NONE,  SIZE,      4,   8,   4,   8),
+    CYCLES(addx_mem,     NONE,  SIZE,     18,  30,  18,  30),
+    CYCLES(suba,         EA,    BIT8_L,    8,   8,   8,   6),
+    CYCLES(adda,         EA,    BIT8_L,    8,   8,   8,   6),
+    CYCLES(cmp,          EA,    SIZE,      4,   6,   4,   6),
+    CYCLES(cmpa,         EA,    BIT8_L,    6,   6,   6,   6),
+    CYCLES(cmpm,         NONE,  SIZE,     12,  20,  12,  20),
+    CYCLES(eor,          EA,    SIZE,      4,   8,   8,  12),
+    CYCLES(exg_dd,       NONE,  W,         6,   6,   6,   6),
+    CYCLES(exg_aa,       NONE,  W,         6,   6,   6,   6),
+    CYCLES(exg_da,       NONE,  W,         6,   6,   6,   6),
+    CYCLES(shift8_im,    SHIFT, SIZE,      6,   8,   6,   8),
+    CYCLES(shift16_im,   SHIFT, SIZE,      6,   8,   6,   8),
+    CYCLES(shift_im,     SHIFT, SIZE,      6,   8,   6,   8),
+    CYCLES(shift8_reg,   SHIFT, SIZE,      6,   8,   6,   8),
+    CYCLES(shift16_reg,  SHIFT, SIZE,      6,   8,   6,   8),
+    CYCLES(shift_reg,    SHIFT, SIZE,      6,   8,   6,   8),
+    CYCLES(rotate_im,    SHIFT, SIZE,      6,   8,   6,   8),
+    CYCLES(rotate8_im,   SHIFT, SIZE,      6,   8,   6,   8),
+    CYCLES(rotate16_im,  SHIFT, SIZE,      6,   8,   6,   8),
+    CYCLES(rotate_reg,   SHIFT, SIZE,      6,   8,   6,   8),
+    CYCLES(rotate8_reg,  SHIFT, SIZE,      6,   8,   6,   8),
+    CYCLES(rotate16_reg, SHIFT, SIZE,      6,   8,   6,   8),
+    CYCLES(shift_mem,    EA,    W,         8,   8,   8,   8),
+    CYCLES(rotate_mem,   EA,    W,         8,   8,   8,   8),
+};
+
+#undef CYCLES
+
+/* Effective address time, by mode and then register for mode 7 */
+static const uint8_t ea_cycles[12][2] = {
+    { 0, 0 },   /* Dn */
+    { 0, 0 },   /* An */
+    { 4, 8 },   /* (An) */
+    { 4, 8 },   /* (An)+ */
+    { 6, 10 },  /* -(An) */
+    { 8, 12 },  /* (d16,An) */
+    { 10, 14 }, /* (d8,An,Xn) */
+    { 8, 12 },  /* (xxx).W */
+    { 12, 16 }, /* (xxx).L */
+    { 8, 12 },  /* (d16,PC) */
+    { 10, 14 }, /* (d8,PC,Xn) */
+    { 4, 8 },   /* #imm */
+};
+
+/* Control address time of jmp/jsr, lea/pea and movem */
+static const uint8_t ea_control_cycles[3][12] = {
+    { 0, 0, 0, 0, 0, 2, 6, 2, 4, 2, 6, 0 },
+    { 0, 0, 0, 0, 0, 4, 8, 4, 8, 4, 8, 0 },
+    { 0, 0, 0, 0, 0, 4, 6, 4, 8, 4, 6, 0 },
+};
+
+static int ea_cycles_index(int mode, int reg)
+{
+    if (mode < 7) {
+        return mode;
+    }
+    return reg <= 4 ? 7 + reg : -1;
+}
+
+static int insn_cycles(const M68kInsnCycles *c, uint16_t insn)
+{
+    int ea = ea_cycles_index(extract32(insn, 3, 3), extract32(insn, 0, 3));
+    bool second, is_long;
+    int cycles;
+
+    switch (c->select) {
+    case CYC_SIZE:
+        second = is_long = extract32(insn, 6, 2) == 2;
+        break;
+    case CYC_MOVE_SIZE:
+        second = is_long = extract32(insn, 12, 2) == 2;
+        break;
+    case CYC_BIT6_L:
+        second = is_long = extract32(insn, 6, 1);
+        break;
+    case CYC_BIT8_L:
+        second = is_long = extract32(insn, 8, 1);
+        break;
+    case CYC_BIT6:
+        second = extract32(insn, 6, 1);
+        is_long = false;
+        break;
+    case CYC_BIT8:
+        second = extract32(insn, 8, 1);
+        is_long = false;
+        break;
+    case CYC_BIT10:
+        second = extract32(insn, 10, 1);
+        is_long = false;
+        break;
+    case CYC_BITOP:
+        second = extract32(insn, 6, 2) != 0;
+        is_long = false;
+        break;
+    case CYC_L:
+        second = false;
+        is_long = true;
+        break;
+    default:
+        second = is_long = false;
+        break;
+    }
+
+    if (ea < 0) {
+        return c->reg[second];
+    }
+
+    switch (c->kind) {
+    case CYC_EA:
+    case CYC_QUICK:
+    case CYC_DIR:
+        if (c->kind == CYC_QUICK && ea == 1) {
+            return c->reg[1];
+        }
+        if (c->kind == CYC_DIR && (insn & 0x100)) {
+            /* Dn,<ea>: writing back to memory */
+            cycles = c->mem[second] + (is_long ? 6 : 4);
+            return cycles + ea_cycles[ea][is_long];
+        }
+        cycles = ea <= 1 || ea == 11 ? c->reg[second] : c->mem[second];
+        return cycles + ea_cycles[ea][is_long];
+    case CYC_MOVE:
+        cycles = c->reg[second] + ea_cycles[ea][is_long];
+        /* The destination has no predecrement penalty */
+        ea = ea_cycles_index(extract32(insn, 6, 3), extract32(insn, 9, 3));
+        if (ea == 4) {
+            ea = 2;
+        }
+        return ea < 0 ? cycles : cycles + ea_cycles[ea][is_long];
+    case CYC_SHIFT:
+        if (insn & 0x20) {
+            /* The count is in a register, and not known here */
+            return c->reg[second];
+        }
+        cycles = extract32(insn, 9, 3);
+        return c->reg[second] + 2 * (cycles ? cycles : 8);
+    case CYC_JMP:
+        return c->reg[second] + ea_control_cycles[0][ea];
+    case CYC_LEA:
+        return c->reg[second] + ea_control_cycles[1][ea];
+    case CYC_MOVEM:
+        return c->reg[second] + ea_control_cycles[2][ea];
+    default:
+        return c->reg[second];
+    }
+}
+
+/* Insns without an entry take the four periods of the shortest ones */
+static void register_cycles(void)
+{
+    const M68kInsnCycles *c = NULL;
+    int i, j;
+
+    for (i = 0; i < ARRAY_SIZE(cycle_table); i++) {
+        if (!c || c->proc != opcode_table[i]) {
+            c = NULL;
+            for (j = 0; j < ARRAY_SIZE(m68000_cycles); j++) {
+                if (m68000_cycles[j].proc == opcode_table[i]) {
+                    c = &m68000_cycles[j];
+                    break;
+                }
+            }
+        }
+        cycle_table[i] = c ? insn_cycles(c, i) : 4;
+    }
+}
+
 static void
 register_opcode (disas_proc proc, uint16_t opcode, uint16_t mask)
 {
@@ -5713,6 +6235,65 @@ register_opcode (disas_proc proc, uint16_t opcode, uint16_t mask)
   }
 }
 
+/*
+ * Insns that set N, Z, V and C without reading any flag first.  The old
+ * flags are dead once such an insn starts, unless the insn can still
+ * raise an exception at translation time: only effective addresses that
+ * always decode are accepted, which leaves out the indexed modes and
+ * their extension word.
+ */
+static DECLARE_BITMAP(cc_dead_map, 65536);
+
+static bool cc_dead_ea(int mode, int reg0, bool store)
+{
+    switch (mode) {
+    case 6:
+        return false;
+    case 7:
+        return reg0 == 0 || reg0 == 1 || (!store && (reg0 == 2 || reg0 == 4));
+    default:
+        return true;
+    }
+}
+
+static bool insn_kills_flags(disas_proc proc, uint16_t insn)
+{
+    int mode = extract32(insn, 3, 3);
+    int reg0 = REG(insn, 0);
+
+    if (proc == disas_moveq || proc == disas_ext || proc == disas_swap) {
+        return true;
+    }
+    if (proc == disas_move) {
+        /* movea leaves the flags alone */
+        return extract32(insn, 6, 3) != 1 && cc_dead_ea(mode, reg0, false) &&
+               cc_dead_ea(extract32(insn, 6, 3), REG(insn, 9), true);
+    }
+    if (proc == disas_tst || proc == disas_cmp) {
+        return cc_dead_ea(mode, reg0, false);
+    }
+    if (proc == disas_clr || proc == disas_not || proc == disas_neg ||
+        proc == disas_eor) {
+        return cc_dead_ea(mode, reg0, true);
+    }
+    if (proc == disas_and || proc == disas_or || proc == disas_addsub) {
+        /* <ea>,Dn or Dn,<ea> */
+        return cc_dead_ea(mode, reg0, insn & 0x100);
+    }
+    return false;
+}
+
+static void register_cc_dead(void)
+{
+    int i;
+
+    for (i = 0; i < 65536; i++) {
+        if (insn_kills_flags(opcode_table[i], i)) {
+            set_bit(i, cc_dead_map);
+        }
+    }
+}
+
 /*
  * Register m68k opcode handlers.  Order is important.
  * Later insn override earlier ones.
@@ -5968,6 +6549,9 @@ void register_m68k_insns (CPUM68KState *env)
     INSN(move16_mem, f600, ffe0, M68040);
     INSN(move16_reg, f620, fff8, M68040);
 #undef INSN
+
+    register_cycles();
+    register_cc_dead();
 }
 
 static void m68k_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cpu)
@@ -5985,6 +6569,26 @@ static void m68k_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cpu)
     dc->writeback_mask = 0;
 
     dc->ss_active = (M68K_SR_TRACE(env->sr) == M68K_SR_TRACE_ANY_INS);
+    /* The cycle table has MC68000 times, which also fit the 68010 */
+    dc->count_cycles = m68k_feature(env, M68K_FEATURE_M68K) &&
+                       !m68k_feature(env, M68K_FEATURE_M68020);
+    dc->cycles = 0;
+    /*
+     * An access fault would push the dropped flags in its frame, and
+     * only the 68040 and 68060 MMUs fault on data accesses.
+     */
+    dc->cc_liveness = !m68k_feature(env, M68K_FEATURE_M68040) &&
+                      !m68k_feature(env, M68K_FEATURE_M68060);
+    dc->cc_dead_on_entry = false;
+    /*
+     * The 68040 and 68060 MMUs can fault in the middle of a block, and
+     * their access error frames describe the one access that faulted.
+     */
+    dc->bulk_mem = !m68k_feature(env, M68K_FEATURE_M68040) &&
+                   !m68k_feature(env, M68K_FEATURE_M68060);
+    dc->superblock = env_archcpu(env)->superblock;
+    dc->pc_end = dc->pc;
+    dc->in_call = false;
     /* If architectural single step active, limit to 1 */
     if (dc->ss_active) {
         dc->base.max_insns = 1;
@@ -5998,7 +6602,7 @@ static void m68k_tr_tb_start(DisasContextBase *dcbase, CPUState *cpu)
 static void m68k_tr_insn_start(DisasContextBase *dcbase, CPUState *cpu)
 {
     DisasContext *dc = container_of(dcbase, DisasContext, base);
-    tcg_gen_insn_start(dc->base.pc_next, dc->cc_op);
+    tcg_gen_insn_start(dc->base.pc_next, dc->cc_op, dc->cycles);
 }
 
 static void m68k_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
@@ -6007,11 +6611,19 @@ static void m68k_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
     CPUM68KState *env = cpu_env(cpu);
     uint16_t insn = read_im16(env, dc);
 
+    add_cycles(dc, cycle_table[insn]);
+    if (dc->cc_liveness && test_bit(insn, cc_dead_map)) {
+        gen_discard_flags();
+        if (dc->base.num_insns == 1) {
+            dc->cc_dead_on_entry = true;
+        }
+    }
     opcode_table[insn](env, dc, insn);
     do_writebacks(dc);
 
     dc->pc_prev = dc->base.pc_next;
     dc->base.pc_next = dc->pc;
+    dc->pc_end = MAX(dc->pc_end, dc->pc);
 
     if (dc->base.is_jmp == DISAS_NEXT) {
         /*
@@ -6052,6 +6664,7 @@ static void m68k_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
         if (dc->ss_active) {
             gen_raise_exception_format2(dc, EXCP_TRACE, dc->pc_prev);
         } else {
+            gen_charge_cycles(dc);
             tcg_gen_lookup_and_goto_ptr();
         }
         break;
@@ -6063,12 +6676,16 @@ static void m68k_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
         if (dc->ss_active) {
             gen_raise_exception_format2(dc, EXCP_TRACE, dc->pc_prev);
         } else {
+            gen_charge_cycles(dc);
             tcg_gen_exit_tb(NULL, 0);
         }
         break;
     default:
         g_assert_not_reached();
     }
+
+    /* The TB size covers all the code read, see follow_branch() */
+    dc->base.pc_next = dc->pc_end;
 }
 
 static void m68k_tr_disas_log(const DisasContextBase *dcbase,
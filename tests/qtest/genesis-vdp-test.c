@@ -0,0 +1,162 @@
+/*
+ * QTest for the Sega Genesis YM7101 VDP
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+
+#define VDP_DATA    0xc00000
+#define VDP_CTRL    0xc00004
+#define VDP_HV      0xc00008
+
+/* Register @reg set to @val through the control port */
+#define VDP_REG(reg, val) (0x8000 | (reg) << 8 | (val))
+
+#define REG_MODE_SET_2      0x01
+#define REG_AUTO_INCREMENT  0x0f
+#define REG_SCROLL_SIZE     0x10
+#define REG_DMA_COUNTER_LOW 0x13
+#define REG_DMA_COUNTER_HIGH 0x14
+#define REG_DMA_ADDR_HIGH   0x17
+
+#define MODE2_DMA_ENABLE    0x10
+#define MODE2_MODE5         0x04
+#define DMA_FILL            0x80
+
+#define FILL_ADDR   0x1000
+#define FILL_LEN    0x40
+
+static char *cart_path;
+
+static QTestState *genesis_start(void)
+{
+    return qtest_initf("-machine sega-genesis,cart=%s", cart_path);
+}
+
+static char *vdp_info(QTestState *qts)
+{
+    return qtest_hmp(qts, "info ym7101");
+}
+
+static void test_scroll_size_invalid(void)
+{
+    QTestState *qts = genesis_start();
+    g_autofree char *info = NULL;
+
+    /* 0b10 is reserved: the guest must not bring QEMU down with it */
+    qtest_writew(qts, VDP_CTRL, VDP_REG(REG_SCROLL_SIZE, 0x12));
+    info = vdp_info(qts);
+    g_assert_nonnull(strstr(info, "Planes   : 32x64 cells"));
+
+    qtest_quit(qts);
+}
+
+/* A longword from the second control port word runs into the H/V counter */
+static void test_long_read(void)
+{
+    QTestState *qts = genesis_start();
+    uint16_t status = qtest_readw(qts, VDP_CTRL);
+    uint16_t hv = qtest_readw(qts, VDP_HV);
+    uint32_t val = qtest_readl(qts, VDP_CTRL + 2);
+
+    g_assert_cmphex(val >> 16, ==, status);
+    g_assert_cmphex(val & 0xffff, ==, hv);
+    g_assert_cmphex(qtest_readl(qts, VDP_CTRL), ==, status << 16 | status);
+
+    /* Not something a 68000 can do: open bus, and no abort */
+    g_assert_cmphex(qtest_readw(qts, VDP_CTRL + 1), ==, 0xffff);
+
+    qtest_quit(qts);
+}
+
+static void vdp_command(QTestState *qts, uint8_t code, uint16_t addr)
+{
+    qtest_writew(qts, VDP_CTRL, (code & 3) << 14 | (addr & 0x3fff));
+    qtest_writew(qts, VDP_CTRL, (code & 0x3c) << 2 | addr >> 14);
+}
+
+/* Fill from the data port write made by @trigger, then read VRAM back */
+static void check_fill(void (*trigger)(QTestState *), uint16_t word)
+{
+    QTestState *qts = genesis_start();
+    int i;
+
+    qtest_writew(qts, VDP_CTRL,
+                 VDP_REG(REG_MODE_SET_2, MODE2_DMA_ENABLE | MODE2_MODE5));
+    qtest_writew(qts, VDP_CTRL, VDP_REG(REG_AUTO_INCREMENT, 1));
+    qtest_writew(qts, VDP_CTRL, VDP_REG(REG_DMA_COUNTER_LOW, FILL_LEN));
+    qtest_writew(qts, VDP_CTRL, VDP_REG(REG_DMA_COUNTER_HIGH, 0));
+    qtest_writew(qts, VDP_CTRL, VDP_REG(REG_DMA_ADDR_HIGH, DMA_FILL));
+
+    /* VRAM write, with DMA */
+    vdp_command(qts, 0x21, FILL_ADDR);
+    trigger(qts);
+
+    qtest_writew(qts, VDP_CTRL, VDP_REG(REG_AUTO_INCREMENT, 2));
+    vdp_command(qts, 0x00, FILL_ADDR);
+    for (i = 0; i < FILL_LEN; i += 2) {
+        g_assert_cmphex(qtest_readw(qts, VDP_DATA), ==, word);
+    }
+
+    qtest_quit(qts);
+}
+
+static void fill_word(QTestState *qts)
+{
+    qtest_writew(qts, VDP_DATA, 0x5a5a);
+}
+
+/* Both halves of the bus carry the byte */
+static void fill_byte(QTestState *qts)
+{
+    qtest_writeb(qts, VDP_DATA + 1, 0x5a);
+}
+
+/* The fill starts with the first word */
+static void fill_long(QTestState *qts)
+{
+    qtest_writel(qts, VDP_DATA, 0x5a5a1234);
+}
+
+static void test_fill_word(void)
+{
+    check_fill(fill_word, 0x5a5a);
+}
+
+static void test_fill_byte(void)
+{
+    check_fill(fill_byte, 0x5a5a);
+}
+
+static void test_fill_long(void)
+{
+    check_fill(fill_long, 0x5a5a);
+}
+
+int main(int argc, char **argv)
+{
+    g_autofree uint8_t *cart = g_malloc0(0x200);
+    int fd, ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    /* Just the vectors: the tests drive the VDP from qtest */
+    fd = g_file_open_tmp("genesis-vdp-test-XXXXXX.bin", &cart_path, NULL);
+    g_assert(fd >= 0);
+    g_assert(write(fd, cart, 0x200) == 0x200);
+    close(fd);
+
+    qtest_add_func("/genesis-vdp/scroll-size-invalid",
+                   test_scroll_size_invalid);
+    qtest_add_func("/genesis-vdp/long-read", test_long_read);
+    qtest_add_func("/genesis-vdp/fill/word", test_fill_word);
+    qtest_add_func("/genesis-vdp/fill/byte", test_fill_byte);
+    qtest_add_func("/genesis-vdp/fill/long", test_fill_long);
+    ret = g_test_run();
+
+    unlink(cart_path);
+    g_free(cart_path);
+    return ret;
+}
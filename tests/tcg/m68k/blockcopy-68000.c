@@ -0,0 +1,134 @@
+/*
+ * Check the m68k block transfers of blockcopy.h on a 68000, which
+ * counts clock periods as it copies.  The C library needs a 68020, so
+ * this stands alone and only makes the exit and write system calls.
+ *
+ * Run it with "qemu-m68k -cpu m68000 blockcopy-68000".
+ */
+
+#include <stdint.h>
+#include "blockcopy.h"
+
+#define PAGE        4096
+#define LONGS       (PAGE / 4)
+
+#define NR_exit     1
+#define NR_write    4
+
+/* Two pages of source, then two of destination */
+static uint32_t buf[4 * LONGS] __attribute__((aligned(PAGE)));
+
+asm("\t.globl _start\n"
+    "_start:\n\t"
+    "jbsr main\n\t"
+    "move.l %d0, %d1\n\t"
+    "moveq #1, %d0\n\t"
+    "trap #0");
+
+static void fail(const char *msg, int len)
+{
+    register long d0 asm("d0") = NR_write;
+    register long d1 asm("d1") = 2;
+    register long d2 asm("d2") = (long)msg;
+    register long d3 asm("d3") = len;
+
+    asm volatile("trap #0" : "+d"(d0) : "d"(d1), "d"(d2), "d"(d3) : "memory");
+
+    d0 = NR_exit;
+    d1 = 1;
+    asm volatile("trap #0" : : "d"(d0), "d"(d1));
+    __builtin_unreachable();
+}
+
+#define check(cond) do {                                        \
+        if (!(cond)) {                                          \
+            static const char msg[] = "blockcopy-68000: "       \
+                                      #cond " failed\n";        \
+            fail(msg, sizeof(msg) - 1);                         \
+        }                                                       \
+    } while (0)
+
+/* xorshift, as a 68000 has no 32 bit multiply */
+static void fill(uint32_t *p, int n, uint32_t seed)
+{
+    uint32_t x = seed | 1;
+
+    while (n--) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        *p++ = x;
+    }
+}
+
+static int same(const void *a, const void *b, int len)
+{
+    const uint8_t *p = a, *q = b;
+
+    while (len--) {
+        if (*p++ != *q++) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void test_copy_loop(void)
+{
+    uint32_t *src = buf, *dst = buf + 2 * LONGS;
+    uint16_t *wsrc = (uint16_t *)src, *wdst = (uint16_t *)dst;
+    int i, n;
+
+    /* Within a page, then across one on either side */
+    for (n = 1; n <= LONGS; n = n * 3 + 1) {
+        fill(src, 2 * LONGS, n);
+        fill(dst, 2 * LONGS, 0);
+        dst[4] = dst[5 + n] = 0;
+        copy_loop(dst + 5, src + LONGS - n / 2, n);
+        check(same(dst + 5, src + LONGS - n / 2, n << 2));
+        check(dst[4] == 0 && dst[5 + n] == 0);
+
+        copy_loop_word(wdst + LONGS * 2 - n / 2, wsrc + 3, n);
+        check(same(wdst + LONGS * 2 - n / 2, wsrc + 3, n << 1));
+    }
+
+    /* Overlapping one element ahead repeats the first */
+    fill(src, LONGS, 1);
+    copy_loop(src + 1, src, LONGS - 1);
+    for (i = 1; i < LONGS; i++) {
+        check(src[i] == src[0]);
+    }
+}
+
+static void test_movem(void)
+{
+    uint32_t *src = buf, *dst = buf + 2 * LONGS;
+    int16_t *wsrc = (int16_t *)src;
+    int blocks = 2 * LONGS / MOVEM_REGS - 1;
+    uint32_t *from, *to;
+    int i;
+
+    /* These run across the middle of both buffers */
+    fill(src, 2 * LONGS, 2);
+    movem_copy(dst, src, blocks);
+    check(same(dst, src, blocks * MOVEM_REGS * 4));
+
+    to = dst + blocks * MOVEM_REGS;
+    movem_push(to, src, blocks);
+    for (from = src; to > dst; from += MOVEM_REGS) {
+        to -= MOVEM_REGS;
+        check(same(to, from, MOVEM_REGS * 4));
+    }
+
+    movem_widen(dst, (uint16_t *)src, blocks);
+    for (i = 0; i < blocks * MOVEM_REGS; i++) {
+        check(dst[i] == (uint32_t)(int32_t)wsrc[i]);
+    }
+}
+
+int main(void)
+{
+    test_copy_loop();
+    test_movem();
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * Test and time m68k block transfers: movem, and the
+ * move.l (a0)+,(a1)+ / dbf copy loop.  Copies that overlap or cross a
+ * page boundary check the paths that cannot use the bulk helpers.
+ *
+ * The 68040 does each access on its own, so time it with
+ * "qemu-m68k -cpu m68020 blockcopy".
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "blockcopy.h"
+
+#define PAGE        4096
+#define LONGS       (PAGE / 4)
+#define ROUNDS      2000
+
+static uint32_t *buf;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *name, double start, long elems)
+{
+    printf("%-24s %6.2f ns/long\n", name, (now() - start) / elems);
+}
+
+static void fill(uint32_t *p, int n, uint32_t seed)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        p[i] = seed * 0x9e3779b9u + i * 0x85ebca6bu;
+    }
+}
+
+static void test_copy_loop(void)
+{
+    uint32_t *src = buf, *dst = buf + 2 * LONGS;
+    uint16_t *wsrc = (uint16_t *)src, *wdst = (uint16_t *)dst;
+    int i, n;
+
+    /* Within a page, then across one on either side */
+    for (n = 1; n <= LONGS; n = n * 3 + 1) {
+        fill(src, 2 * LONGS, n);
+        memset(dst, 0, 2 * PAGE);
+        copy_loop(dst + 5, src + LONGS - n / 2, n);
+        assert(!memcmp(dst + 5, src + LONGS - n / 2, n * 4));
+        assert(dst[4] == 0 && dst[5 + n] == 0);
+
+        copy_loop_word(wdst + LONGS * 2 - n / 2, wsrc + 3, n);
+        assert(!memcmp(wdst + LONGS * 2 - n / 2, wsrc + 3, n * 2));
+    }
+
+    /* Overlapping one element ahead repeats the first */
+    fill(src, LONGS, 1);
+    copy_loop(src + 1, src, LONGS - 1);
+    for (i = 1; i < LONGS; i++) {
+        assert(src[i] == src[0]);
+    }
+}
+
+static void test_movem(void)
+{
+    uint32_t *src = buf, *dst = buf + 2 * LONGS;
+    int16_t *wsrc = (int16_t *)src;
+    int blocks = 2 * LONGS / MOVEM_REGS - 1;
+    int i;
+
+    /* These run across the middle of both buffers */
+    fill(src, 2 * LONGS, 2);
+    movem_copy(dst, src, blocks);
+    assert(!memcmp(dst, src, blocks * MOVEM_REGS * 4));
+
+    movem_push(dst + blocks * MOVEM_REGS, src, blocks);
+    for (i = 0; i < blocks; i++) {
+        assert(!memcmp(dst + (blocks - 1 - i) * MOVEM_REGS,
+                       src + i * MOVEM_REGS, MOVEM_REGS * 4));
+    }
+
+    movem_widen(dst, (uint16_t *)src, blocks);
+    for (i = 0; i < blocks * MOVEM_REGS; i++) {
+        assert(dst[i] == (uint32_t)(int32_t)wsrc[i]);
+    }
+}
+
+static void bench(void)
+{
+    uint32_t *src = buf, *dst = buf + 2 * LONGS;
+    int blocks = LONGS / MOVEM_REGS;
+    double start;
+    int i;
+
+    start = now();
+    for (i = 0; i < ROUNDS; i++) {
+        copy_loop(dst, src, LONGS);
+    }
+    report("move.l (a0)+,(a1)+ dbf", start, (long)ROUNDS * LONGS);
+
+    start = now();
+    for (i = 0; i < ROUNDS; i++) {
+        movem_copy(dst, src, blocks);
+    }
+    report("movem.l", start, (long)ROUNDS * blocks * MOVEM_REGS);
+
+    start = now();
+    for (i = 0; i < ROUNDS; i++) {
+        movem_push(dst + blocks * MOVEM_REGS, src, blocks);
+    }
+    report("movem.l -(a0)", start, (long)ROUNDS * blocks * MOVEM_REGS);
+}
+
+int main(int argc, char **argv)
+{
+    /* Two pages of source, then two of destination */
+    buf = mmap(NULL, 4 * PAGE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(buf != MAP_FAILED);
+
+    test_copy_loop();
+    test_movem();
+    bench();
+    return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * The m68k block transfers timed and checked by blockcopy.c and
+ * blockcopy-68000.c.  Only 68000 instructions are used.
+ */
+
+#ifndef BLOCKCOPY_H
+#define BLOCKCOPY_H
+
+#define MOVEM_REGS  10
+
+/* move.l (src)+,(dst)+ / dbf, for 1 <= n <= 65536 */
+static void copy_loop(uint32_t *dst, const uint32_t *src, uint32_t n)
+{
+    uint32_t count = n - 1;
+
+    asm volatile("1:\tmove.l (%1)+, (%0)+\n\t"
+                 "dbf %2, 1b"
+                 : "+a"(dst), "+a"(src), "+d"(count) : : "memory");
+}
+
+static void copy_loop_word(uint16_t *dst, const uint16_t *src, uint32_t n)
+{
+    uint32_t count = n - 1;
+
+    asm volatile("1:\tmove.w (%1)+, (%0)+\n\t"
+                 "dbf %2, 1b"
+                 : "+a"(dst), "+a"(src), "+d"(count) : : "memory");
+}
+
+/* movem.l (src)+ then movem.l to (dst), MOVEM_REGS longs at a time */
+static void movem_copy(uint32_t *dst, const uint32_t *src, uint32_t blocks)
+{
+    asm volatile("1:\tmovem.l (%1)+, %%d1-%%d7/%%a2-%%a4\n\t"
+                 "movem.l %%d1-%%d7/%%a2-%%a4, (%0)\n\t"
+                 "lea 40(%0), %0\n\t"
+                 "subq.l #1, %2\n\t"
+                 "bne.s 1b"
+                 : "+a"(dst), "+a"(src), "+d"(blocks) : :
+                 "d1", "d2", "d3", "d4", "d5", "d6", "d7",
+                 "a2", "a3", "a4", "memory");
+}
+
+/* Blocks stored with -(dst) from @end downwards, so in reverse order */
+static void movem_push(uint32_t *end, const uint32_t *src, uint32_t blocks)
+{
+    asm volatile("1:\tmovem.l (%1)+, %%d1-%%d7/%%a2-%%a4\n\t"
+                 "movem.l %%d1-%%d7/%%a2-%%a4, -(%0)\n\t"
+                 "subq.l #1, %2\n\t"
+                 "bne.s 1b"
+                 : "+a"(end), "+a"(src), "+d"(blocks) : :
+                 "d1", "d2", "d3", "d4", "d5", "d6", "d7",
+                 "a2", "a3", "a4", "memory");
+}
+
+/* Words are sign extended into the registers */
+static void movem_widen(uint32_t *dst, const uint16_t *src, uint32_t blocks)
+{
+    asm volatile("1:\tmovem.w (%1)+, %%d1-%%d7/%%a2-%%a4\n\t"
+                 "movem.l %%d1-%%d7/%%a2-%%a4, (%0)\n\t"
+                 "lea 40(%0), %0\n\t"
+                 "subq.l #1, %2\n\t"
+                 "bne.s 1b"
+                 : "+a"(dst), "+a"(src), "+d"(blocks) : :
+                 "d1", "d2", "d3", "d4", "d5", "d6", "d7",
+                 "a2", "a3", "a4", "memory");
+}
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Test m68k superblock translation: code reached through a followed
+ * forward branch, a followed call and its rts, a callee that changes
+ * its return address, and a write to code inside a followed block.
+ *
+ * Run it with "qemu-m68k -cpu m68020,x-superblock=64 superblock".
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define ROUNDS 100
+
+/* The moveq is skipped, on to the addq on the same page */
+static int forward_bra(void)
+{
+    int r;
+
+    asm volatile("moveq #0, %0\n\t"
+                 "bra.s 1f\n\t"
+                 "moveq #1, %0\n"
+                 "1:\taddq.l #2, %0"
+                 : "=d"(r));
+    return r;
+}
+
+/* Into the callee and back past the rts, both followed */
+static int leaf_call(void)
+{
+    int r;
+
+    asm volatile("moveq #0, %0\n\t"
+                 "bsr.s 2f\n\t"
+                 "addq.l #8, %0\n\t"
+                 "bra.s 3f\n"
+                 "2:\taddq.l #1, %0\n\t"
+                 "rts\n"
+                 "3:"
+                 : "=d"(r) : : "memory");
+    return r;
+}
+
+/* The callee returns past the addq.l #8: the rts must not be followed */
+static int changed_return(void)
+{
+    int r;
+
+    asm volatile("moveq #0, %0\n\t"
+                 "bsr.s 2f\n\t"
+                 "addq.l #8, %0\n\t"
+                 "addq.l #2, %0\n\t"
+                 "bra.s 3f\n"
+                 "2:\taddq.l #1, %0\n\t"
+                 "addq.l #2, (%%sp)\n\t"
+                 "rts\n"
+                 "3:"
+                 : "=d"(r) : : "memory");
+    return r;
+}
+
+/* bra.s over a nop to moveq #1,%d0 then rts, all one superblock */
+static const uint16_t smc_code[] = {
+    0x6002,     /* bra.s 1f */
+    0x4e71,     /* nop */
+    0x7001,     /* 1: moveq #1, %d0 */
+    0x4e75,     /* rts */
+};
+
+#define SMC_IMM 5   /* byte offset of the moveq immediate */
+
+static void test_smc(void)
+{
+    uint8_t *code = mmap(NULL, 4096, PROT_READ | PROT_WRITE | PROT_EXEC,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    int (*fn)(void) = (int (*)(void))code;
+    int i;
+
+    assert(code != MAP_FAILED);
+    memcpy(code, smc_code, sizeof(smc_code));
+
+    /* The write lands in the followed part: the TB must go */
+    for (i = 0; i < ROUNDS; i++) {
+        code[SMC_IMM] = i & 0x7f;
+        assert(fn() == (i & 0x7f));
+    }
+    munmap(code, 4096);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    for (i = 0; i < ROUNDS; i++) {
+        assert(forward_bra() == 2);
+        assert(leaf_call() == 9);
+        assert(changed_return() == 3);
+    }
+    test_smc();
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * Genesis run-ahead snapshot ring test
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "../hw/m68k/genesis-runahead.h"
+
+#define FRAMES 3
+#define TICKS 64
+
+/*
+ * Run the ring as genesis_runahead_frame_work() does, with the input
+ * changing at the frames set in @changes, and check that the frames
+ * shown never go back.  @frame is the frame the machine is at, which a
+ * rollback moves back to the frame saved in the slot.
+ */
+static void run_ring(const bool *changes)
+{
+    GenesisRunAheadRing r = { .slots = FRAMES + 1 };
+    int saved[FRAMES + 1];
+    int frame = 0, shown = -1;
+    int tick;
+
+    for (tick = 0; tick < TICKS; tick++, frame++) {
+        if (changes[tick] && r.count) {
+            frame = saved[genesis_runahead_rollback(&r)];
+        } else {
+            saved[genesis_runahead_advance(&r)] = frame;
+        }
+        g_assert_cmpint(r.count, >=, 1);
+        g_assert_cmpint(r.count, <=, r.slots);
+        g_assert_cmpint(r.replay, <, r.slots);
+
+        /* The display is held while frames are replayed */
+        if (!r.replay) {
+            g_assert_cmpint(frame, >=, shown);
+            shown = frame;
+        }
+    }
+    /* Back to running FRAMES frames ahead, with nothing left to replay */
+    g_assert_cmpint(r.replay, ==, 0);
+    g_assert_cmpint(r.count, ==, r.slots);
+}
+
+static void check_single_change(void)
+{
+    bool changes[TICKS] = { [20] = true };
+
+    run_ring(changes);
+}
+
+/* A change during the replay of the previous one */
+static void check_consecutive_changes(void)
+{
+    bool changes[TICKS] = { [20] = true, [21] = true };
+
+    run_ring(changes);
+}
+
+static void check_changes_every_frame(void)
+{
+    bool changes[TICKS];
+
+    memset(changes, true, sizeof(changes));
+    memset(changes, false, 10);
+    memset(changes + TICKS - 10, false, 10);
+    run_ring(changes);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/genesis-runahead/single", check_single_change);
+    g_test_add_func("/genesis-runahead/consecutive",
+                    check_consecutive_changes);
+    g_test_add_func("/genesis-runahead/every-frame",
+                    check_changes_every_frame);
+    return g_test_run();
+}
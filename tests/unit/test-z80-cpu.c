@@ -0,0 +1,94 @@
+/*
+ * Z80 interpreter instruction timing test
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "migration/vmstate.h"
+#include "../hw/m68k/z80-cpu.h"
+
+typedef struct {
+    const char *name;
+    uint8_t code[4];
+    int tstates;
+} TimingCase;
+
+/* T-states from the Z80 user manual */
+static const TimingCase cases[] = {
+    { "NOP", { 0x00 }, 4 },
+    { "LD HL,nn", { 0x21, 0x34, 0x12 }, 10 },
+    { "LD IX,nn", { 0xdd, 0x21, 0x34, 0x12 }, 14 },
+    { "LD IY,nn", { 0xfd, 0x21, 0x34, 0x12 }, 14 },
+    { "INC IX", { 0xdd, 0x23 }, 10 },
+    { "ADD IY,BC", { 0xfd, 0x09 }, 15 },
+    { "PUSH IX", { 0xdd, 0xe5 }, 15 },
+    { "JP (IY)", { 0xfd, 0xe9 }, 8 },
+    { "EX (SP),IX", { 0xdd, 0xe3 }, 23 },
+    { "LD A,(IX+d)", { 0xdd, 0x7e, 0x05 }, 19 },
+    { "LD (IX+d),n", { 0xdd, 0x36, 0x05, 0x42 }, 19 },
+    { "INC (IY+d)", { 0xfd, 0x34, 0xfe }, 23 },
+    { "BIT 0,(IX+d)", { 0xdd, 0xcb, 0x05, 0x46 }, 20 },
+    { "RLC (IX+d)", { 0xdd, 0xcb, 0x05, 0x06 }, 23 },
+    { "SET 0,(IY+d)", { 0xfd, 0xcb, 0x05, 0xc6 }, 23 },
+    { "RES 7,(IY+d),A", { 0xfd, 0xcb, 0x05, 0xbf }, 23 },
+};
+
+static uint8_t ram[0x10000];
+
+static uint8_t test_read(void *opaque, uint16_t addr)
+{
+    return ram[addr];
+}
+
+static void test_write(void *opaque, uint16_t addr, uint8_t value)
+{
+    ram[addr] = value;
+}
+
+static uint8_t test_in(void *opaque, uint16_t port)
+{
+    return 0xff;
+}
+
+static void test_out(void *opaque, uint16_t port, uint8_t value)
+{
+}
+
+static const Z80Bus test_bus = {
+    .read = test_read,
+    .write = test_write,
+    .in = test_in,
+    .out = test_out,
+};
+
+static void check_timing(void)
+{
+    Z80CPU z;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(cases); i++) {
+        const TimingCase *c = &cases[i];
+        int t;
+
+        memset(ram, 0, sizeof(ram));
+        memcpy(ram, c->code, sizeof(c->code));
+        z80_init(&z, &test_bus, NULL);
+        z.ix = z.iy = 0x8000;
+        z.sp = 0xf000;
+
+        /* One instruction, however short the budget */
+        t = z80_run(&z, 1);
+        if (t != c->tstates) {
+            g_error("%s: took %d T-states, expected %d",
+                    c->name, t, c->tstates);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/z80-cpu/timing", check_timing);
+    return g_test_run();
+}